@@ -0,0 +1,605 @@
+#pragma once
+
+#include "header.h"
+#include "tools/benchmarkreport.h"
+#include "tools/syntheticmosaic.h"
+#include "tools/threadpool.h"
+#include "tools/timehelper.h"
+#include "tools/trace.h"
+#include "mpicbg/stitching/CollectionStitchingImgLib.h"
+#include "mpicbg/stitching/GlobalOptimization.h"
+#include "mpicbg/stitching/ImageCollectionElement.h"
+#include "mpicbg/stitching/ShardedRegistration.h"
+#include "mpicbg/stitching/StitchingParameters.h"
+#include "mpicbg/stitching/fusion/Fusion.h"
+#include "stitching/io/TilePyramid.h"
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+
+/**
+ * End-to-end benchmarks on a {@link SyntheticMosaic}: pairwise registration, global
+ * optimization, the decomposition into regions, every fusion method and the reduced
+ * resolutions of a tiled pyramid, each with its throughput and, against the known
+ * positions or pixels, its error.
+ *
+ * Run as "StitchingCpp benchmark [key=value ...]" with
+ * tiles=4x3[x2] tile=512x512[x64] overlap=0.2 jitter=4 noise=0.02 bits=16 channels=1
+ * seed=1 repeat=3 json=results.jsonl (a third tile count or tile size makes it 3d).
+ * Every case is run repeat times and the best time is reported.
+ */
+class Benchmark {
+public:
+	static int run(vector<string> args)
+	{
+		SyntheticMosaicParameters mosaicParameters;
+		int repeat = 3;
+		string json;
+
+		if (!parse(args, mosaicParameters, repeat, json))
+			return 1;
+
+		SyntheticMosaic mosaic(mosaicParameters);
+		BenchmarkReport report(configuration(mosaicParameters));
+
+		LOGINFO("Benchmark on " << mosaic.numTiles() << " synthetic tiles of " << mosaicParameters.tileWidth << "x" << mosaicParameters.tileHeight
+			<< (mosaicParameters.dimensionality == 3 ? "x" + to_string(mosaicParameters.tileDepth) : "") << ", " << mosaicParameters.bitDepth << " bit, "
+			<< mosaicParameters.channels << " channel(s), " << ThreadPool::global().numThreads() << " threads");
+
+		// generate
+		long long start = TimeHelper::nanoseconds();
+		ArrayList< ImageCollectionElement > elements = createElements(mosaic);
+		double seconds = (TimeHelper::nanoseconds() - start) / 1e9;
+
+		BenchmarkReport::Result generated;
+		generated.name = "generate tiles";
+		generated.seconds = seconds;
+		generated.amount = megapixels(mosaic) * mosaic.numTiles();
+		generated.unit = "MP/s";
+		report.add(generated);
+
+		StitchingParameters params = parameters(mosaicParameters);
+		Vector< ComparePair > pairs = ShardedRegistration.findPairs(elements, params);
+
+		for (ComparePair pair : pairs)
+			for (ImagePlusTimePoint tile : new ImagePlusTimePoint[]{ pair.getTile1(), pair.getTile2() })
+				if (tile.getImagePlus() == null)
+					tile.setImagePlus(tile.getElement().open(false));
+
+		benchmarkRegistration(mosaic, pairs, params, repeat, report);
+		benchmarkOptimization(mosaic, pairs, params, repeat, report);
+
+		if (mosaicParameters.bitDepth == 8)
+			benchmarkFusion(UnsignedByteType(), mosaic, elements, params, repeat, report);
+		else if (mosaicParameters.bitDepth == 16)
+			benchmarkFusion(UnsignedShortType(), mosaic, elements, params, repeat, report);
+		else
+			benchmarkFusion(FloatType(), mosaic, elements, params, repeat, report);
+
+		benchmarkPyramid(mosaic, 48, repeat, report);
+
+		for (ImageCollectionElement element : elements)
+			element.close();
+
+		LOGINFO("\n" << report.table());
+
+		if (!json.empty() && report.writeJson(json))
+			LOGINFO("Results written to " << json);
+
+		return 0;
+	}
+
+protected:
+	/** all pairs on the pool, like the registration of a collection, without a journal */
+	static void benchmarkRegistration(SyntheticMosaic& mosaic, Vector< ComparePair >& pairs, StitchingParameters params, int repeat, BenchmarkReport& report)
+	{
+		BenchmarkReport::Result result;
+		result.name = "pairwise registration";
+		result.amount = pairs.size();
+		result.unit = "pairs/s";
+		result.errorUnit = "px";
+		result.seconds = INFINITY;
+
+		for (int r = 0; r < repeat; ++r)
+		{
+			// a journal that is not opened only remembers the pairs of this repetition
+			RegistrationJournal journal;
+			ThreadPool::TaskGroup group;
+			atomic< bool > failed(false);
+
+			long long start = TimeHelper::nanoseconds();
+
+			for (int p = 0; p < pairs.size(); ++p)
+				ThreadPool::global().submit(group, [&, p]()
+				{
+					if (!failed && !CollectionStitchingImgLib.computePair(pairs.get(p), params, journal))
+						failed = true;
+				});
+
+			group.wait();
+			result.seconds = std::min(result.seconds, (TimeHelper::nanoseconds() - start) / 1e9);
+
+			if (failed)
+				LOGERR("Pairwise registration failed.");
+		}
+
+		// the relative shift is the position of the second tile relative to the first one
+		result.meanError = result.maxError = 0;
+
+		for (ComparePair pair : pairs)
+		{
+			const std::array<double, 3>& p1 = mosaic.truePosition(pair.getTile1().getElement().getIndex());
+			const std::array<double, 3>& p2 = mosaic.truePosition(pair.getTile2().getElement().getIndex());
+			double distance = 0;
+
+			for (int d = 0; d < params.dimensionality; ++d)
+			{
+				double e = pair.getRelativeShift()[d] - (p2[d] - p1[d]);
+				distance += e * e;
+			}
+
+			result.meanError += std::sqrt(distance) / pairs.size();
+			result.maxError = std::max(result.maxError, std::sqrt(distance));
+		}
+
+		report.add(result);
+	}
+
+	/** the optimization of the registered pairs, starting from the nominal layout every time */
+	static void benchmarkOptimization(SyntheticMosaic& mosaic, Vector< ComparePair >& pairs, StitchingParameters params, int repeat, BenchmarkReport& report)
+	{
+		BenchmarkReport::Result result;
+		result.name = "global optimization";
+		result.amount = mosaic.numTiles();
+		result.unit = "tiles/s";
+		result.errorUnit = "px";
+		result.seconds = INFINITY;
+
+		ArrayList< ImagePlusTimePoint > optimized;
+
+		for (int r = 0; r < repeat; ++r)
+		{
+			for (ComparePair pair : pairs)
+				for (ImagePlusTimePoint tile : new ImagePlusTimePoint[]{ pair.getTile1(), pair.getTile2() })
+					setPosition(tile, mosaic.nominalPosition(tile.getElement().getIndex()), params.dimensionality);
+
+			long long start = TimeHelper::nanoseconds();
+			optimized = GlobalOptimization.optimize(pairs, pairs.get(0).getTile1(), params);
+			result.seconds = std::min(result.seconds, (TimeHelper::nanoseconds() - start) / 1e9);
+		}
+
+		vector< std::array<double, 3> > estimated(mosaic.numTiles());
+
+		for (int i = 0; i < mosaic.numTiles(); ++i)
+			estimated[i] = mosaic.nominalPosition(i);
+
+		for (ImagePlusTimePoint tile : optimized)
+		{
+			double[] position = new double[params.dimensionality];
+			((InvertibleBoundable)tile.getModel()).applyInPlace(position);
+
+			for (int d = 0; d < params.dimensionality; ++d)
+				estimated[tile.getElement().getIndex()][d] = position[d];
+		}
+
+		mosaic.positionError(estimated, pairs.get(0).getTile1().getElement().getIndex(), result.meanError, result.maxError);
+		report.add(result);
+	}
+
+	/**
+	 * Every fusion method on the true positions, interpolated (subpixel), so the fused image
+	 * can be compared with the noiseless texture. The overlap method counts the tiles at each
+	 * pixel and has no error. The decomposition into regions is timed by its trace span.
+	 */
+	template<class T>
+	static void benchmarkFusion(T targetType, SyntheticMosaic& mosaic, ArrayList< ImageCollectionElement >& elements, StitchingParameters params, int repeat, BenchmarkReport& report)
+	{
+		static const char* methods[] = { "blending", "average", "median", "max", "min", "overlap" };
+
+		ArrayList< ImagePlus > images = new ArrayList< ImagePlus >();
+		ArrayList< InvertibleBoundable > models = new ArrayList< InvertibleBoundable >();
+
+		for (int i = 0; i < elements.size(); ++i)
+		{
+			images.add(elements.get(i).open(false));
+
+			if (params.dimensionality == 2)
+			{
+				TranslationModel2D model = new TranslationModel2D();
+				model.set(mosaic.truePosition(i)[0], mosaic.truePosition(i)[1]);
+				models.add(model);
+			}
+			else
+			{
+				TranslationModel3D model = new TranslationModel3D();
+				model.set(mosaic.truePosition(i)[0], mosaic.truePosition(i)[1], mosaic.truePosition(i)[2]);
+				models.add(model);
+			}
+		}
+
+		double[] offset = new double[params.dimensionality];
+		int[] size = new int[params.dimensionality];
+		Fusion.estimateBounds(offset, size, images, models, params.dimensionality);
+
+		double fusedPixels = (double)mosaic.getParameters().channels;
+		for (int d = 0; d < params.dimensionality; ++d)
+			fusedPixels *= size[d] + 1;
+
+		bool tracing = Trace::global().isEnabled();
+		Trace::global().setEnabled(true);
+
+		BenchmarkReport::Result regions;
+		regions.name = "region decomposition";
+		regions.amount = mosaic.numTiles();
+		regions.unit = "tiles/s";
+		regions.seconds = INFINITY;
+
+		for (int method = 0; method < 6; ++method)
+		{
+			bool overlap = method == 5;
+
+			BenchmarkReport::Result result;
+			result.name = string("fusion ") + methods[method];
+			result.amount = fusedPixels / 1e6;
+			result.unit = "MP/s";
+			result.errorUnit = overlap ? "" : "% range";
+			result.seconds = INFINITY;
+
+			ImagePlus fused = null;
+
+			for (int r = 0; r < repeat; ++r)
+			{
+				Trace::global().clear();
+
+				long long start = TimeHelper::nanoseconds();
+				fused = Fusion.fuse(targetType, images, models, params.dimensionality, true, method, null, false, false, false);
+				result.seconds = std::min(result.seconds, (TimeHelper::nanoseconds() - start) / 1e9);
+
+				for (const Trace::Event& e : Trace::global().events())
+					if (string(e.name) == "region build")
+						regions.seconds = std::min(regions.seconds, e.duration / 1e9);
+			}
+
+			if (fused != null && !overlap)
+				fusionError(mosaic, fused, offset, result.meanError, result.maxError);
+
+			report.add(result);
+		}
+
+		Trace::global().clear();
+		Trace::global().setEnabled(tracing);
+
+		if (!std::isinf(regions.seconds))
+			report.add(regions);
+	}
+
+	/** RMS and largest difference of the fused image from the noiseless texture, in % of the intensity range */
+	static void fusionError(SyntheticMosaic& mosaic, ImagePlus fused, double[] offset, double& rms, double& max)
+	{
+		const SyntheticMosaicParameters& p = mosaic.getParameters();
+		int numSlices = p.dimensionality == 3 ? fused.getNSlices() : 1;
+		double sum = 0, count = 0;
+		max = 0;
+
+		for (int z = 0; z < numSlices; ++z)
+			for (int c = 0; c < p.channels; ++c)
+			{
+				ImageProcessor ip = fused.getStack().getProcessor(1 + c + z * p.channels);
+
+				for (int y = 0; y < fused.getHeight(); ++y)
+					for (int x = 0; x < fused.getWidth(); ++x)
+					{
+						// pixels no tile covers are 0 and skipped, the texture is never 0
+						double value = ip.getf(x, y) / mosaic.maxValue();
+
+						if (value == 0)
+							continue;
+
+						double e = 100 * std::abs(value - mosaic.texture(offset[0] + x, offset[1] + y, p.dimensionality == 3 ? offset[2] + z : 0, c));
+						sum += e * e;
+						count += 1;
+						max = std::max(max, e);
+					}
+			}
+
+		rms = count > 0 ? std::sqrt(sum / count) : 0;
+	}
+
+	/**
+	 * The reduced resolutions that a {@link TilePyramid} builds from a plane of the texture,
+	 * 32 tiles wide and high, written as float with tiles of tileSize pixels (not a power
+	 * of two, so the tiles cannot be halved down to single pixels), read back and compared
+	 * with the plane averaged in blocks of 2^level pixels. Only blocks inside the plane are
+	 * compared.
+	 */
+	static void benchmarkPyramid(SyntheticMosaic& mosaic, int tileSize, int repeat, BenchmarkReport& report)
+	{
+		int width = 32 * tileSize, height = 32 * tileSize;
+		vector<float> plane((size_t)width * height);
+
+		ThreadPool::global().parallelFor(0, height, 16, [&](long long from, long long to)
+		{
+			for (int y = (int)from; y < to; ++y)
+				for (int x = 0; x < width; ++x)
+					plane[(size_t)y * width + x] = (float)(mosaic.texture(x, y, 0, 0) * mosaic.maxValue());
+		});
+
+		string path = "benchmark_pyramid.tif";
+		int numLevels = TilePyramid::levelsFor(width, height, tileSize, tileSize);
+
+		BenchmarkReport::Result result;
+		result.name = "pyramid " + to_string(tileSize) + "px tiles";
+		result.amount = (double)width * height / 1e6;
+		result.unit = "MP/s";
+		result.errorUnit = "% range";
+		result.parameters = { { "levels", to_string(numLevels) } };
+		result.seconds = INFINITY;
+
+		std::unique_ptr<TiledTiffWriter> writer;
+
+		for (int r = 0; r < repeat; ++r)
+		{
+			writer.reset(new TiledTiffWriter(path, width, height, 1, tileSize, tileSize, 32, true, numLevels));
+
+			long long start = TimeHelper::nanoseconds();
+
+			if (!writer->open())
+				return;
+
+			TilePyramid pyramid(*writer);
+			vector<float> tile((size_t)tileSize * tileSize);
+
+			for (int tileY = 0; tileY < writer->tilesY(); ++tileY)
+				for (int tileX = 0; tileX < writer->tilesX(); ++tileX)
+				{
+					for (int y = 0; y < tileSize; ++y)
+						for (int x = 0; x < tileSize; ++x)
+						{
+							int px = tileX * tileSize + x, py = tileY * tileSize + y;
+							tile[(size_t)y * tileSize + x] = px < width && py < height ? plane[(size_t)py * width + px] : 0;
+						}
+
+					pyramid.add(0, tileX, tileY, tile.data());
+				}
+
+			if (!writer->close())
+				return;
+
+			result.seconds = std::min(result.seconds, (TimeHelper::nanoseconds() - start) / 1e9);
+		}
+
+		// every level against the plane averaged in blocks, read back tile by tile
+		std::ifstream file(path, std::ios::binary);
+		double sum = 0, count = 0;
+		result.maxError = 0;
+
+		for (int level = 1; level < numLevels; ++level)
+		{
+			int scale = 1 << level;
+
+			for (int tileY = 0; tileY < writer->tilesY(level); ++tileY)
+				for (int tileX = 0; tileX < writer->tilesX(level); ++tileX)
+				{
+					vector<float> tile((size_t)tileSize * tileSize);
+					file.seekg(writer->tileOffset(0, level, tileX, tileY));
+					file.read((char*)tile.data(), tile.size() * sizeof(float));
+
+					for (int y = 0; y < tileSize; ++y)
+						for (int x = 0; x < tileSize; ++x)
+						{
+							int px = tileX * tileSize + x, py = tileY * tileSize + y;
+
+							if ((px + 1) * scale > width || (py + 1) * scale > height)
+								continue;
+
+							double expected = 0;
+
+							for (int by = 0; by < scale; ++by)
+								for (int bx = 0; bx < scale; ++bx)
+									expected += plane[(size_t)(py * scale + by) * width + px * scale + bx];
+
+							double e = 100 * std::abs(tile[(size_t)y * tileSize + x] - expected / (scale * scale)) / mosaic.maxValue();
+							sum += e * e;
+							count += 1;
+							result.maxError = std::max(result.maxError, e);
+						}
+				}
+		}
+
+		file.close();
+		std::remove(path.c_str());
+
+		result.meanError = count > 0 ? std::sqrt(sum / count) : 0;
+		report.add(result);
+	}
+
+	/** one element per tile with the nominal layout as approximate position, the tiles are rendered in parallel */
+	static ArrayList< ImageCollectionElement > createElements(SyntheticMosaic& mosaic)
+	{
+		const SyntheticMosaicParameters& p = mosaic.getParameters();
+		ArrayList< ImageCollectionElement > elements = new ArrayList< ImageCollectionElement >();
+		vector< ImagePlus > images(mosaic.numTiles());
+
+		ThreadPool::global().parallelFor(0, mosaic.numTiles(), 1, [&](int from, int to)
+		{
+			for (int i = from; i < to; ++i)
+				images[i] = toImagePlus(mosaic, i);
+		});
+
+		for (int i = 0; i < mosaic.numTiles(); ++i)
+		{
+			std::array<int, 3> grid = mosaic.gridPosition(i);
+			ImageCollectionElement element(new File("synthetic_x" + to_string(grid[0]) + "_y" + to_string(grid[1]) + "_z" + to_string(grid[2]) + ".tif"), i);
+			std::array<double, 3> nominal = mosaic.nominalPosition(i);
+
+			element.setDimensionality(p.dimensionality);
+
+			if (p.dimensionality == 2)
+			{
+				element.setModel(new TranslationModel2D());
+				element.setOffset({ (float)nominal[0], (float)nominal[1] });
+			}
+			else
+			{
+				element.setModel(new TranslationModel3D());
+				element.setOffset({ (float)nominal[0], (float)nominal[1], (float)nominal[2] });
+			}
+
+			element.setImagePlus(images[i]);
+			elements.add(element);
+		}
+
+		return elements;
+	}
+
+	/** a CZ hyperstack of the tile in the pixel type of the bit depth */
+	static ImagePlus toImagePlus(SyntheticMosaic& mosaic, int tile)
+	{
+		const SyntheticMosaicParameters& p = mosaic.getParameters();
+		int w = p.tileWidth, h = p.tileHeight, numSlices = p.dimensionality == 3 ? p.tileDepth : 1;
+		ImageStack stack = new ImageStack(w, h);
+		vector< vector<float> > channels;
+
+		for (int c = 0; c < p.channels; ++c)
+			channels.push_back(mosaic.renderTile(tile, c));
+
+		for (int z = 0; z < numSlices; ++z)
+			for (int c = 0; c < p.channels; ++c)
+			{
+				const float* plane = channels[c].data() + (size_t)z * w * h;
+
+				if (p.bitDepth == 8)
+				{
+					byte[] pixels = new byte[w * h];
+					for (int i = 0; i < w * h; ++i)
+						pixels[i] = (byte)(int)plane[i];
+					stack.addSlice("", new ByteProcessor(w, h, pixels));
+				}
+				else if (p.bitDepth == 16)
+				{
+					short[] pixels = new short[w * h];
+					for (int i = 0; i < w * h; ++i)
+						pixels[i] = (short)(int)plane[i];
+					stack.addSlice("", new ShortProcessor(w, h, pixels, null));
+				}
+				else
+				{
+					float[] pixels = new float[w * h];
+					for (int i = 0; i < w * h; ++i)
+						pixels[i] = plane[i];
+					stack.addSlice("", new FloatProcessor(w, h, pixels, null));
+				}
+			}
+
+		ImagePlus imp = new ImagePlus("synthetic " + to_string(tile), stack);
+		imp.setDimensions(p.channels, numSlices, 1);
+		imp.setOpenAsHyperStack(p.channels > 1);
+
+		return imp;
+	}
+
+	/** the parameters Stitching_Grid uses, on all channels */
+	static StitchingParameters parameters(const SyntheticMosaicParameters& p)
+	{
+		StitchingParameters params;
+		params.dimensionality = p.dimensionality;
+		params.fusionMethod = 0;
+		params.regThreshold = 0.3;
+		params.relativeThreshold = 2.5;
+		params.absoluteThreshold = 3.5;
+		params.computeOverlap = true;
+		params.subpixelAccuracy = true;
+		params.channel1 = 0;
+		params.channel2 = 0;
+		params.timeSelect = 0;
+		params.checkPeaks = 5;
+		params.registrationJournal = "";
+		return params;
+	}
+
+	static void setPosition(ImagePlusTimePoint tile, const std::array<double, 3>& position, int dimensionality)
+	{
+		if (dimensionality == 2)
+			((TranslationModel2D)tile.getModel()).set(position[0], position[1]);
+		else
+			((TranslationModel3D)tile.getModel()).set(position[0], position[1], position[2]);
+	}
+
+	static double megapixels(SyntheticMosaic& mosaic)
+	{
+		const SyntheticMosaicParameters& p = mosaic.getParameters();
+		return (double)p.tileWidth * p.tileHeight * (p.dimensionality == 3 ? p.tileDepth : 1) * p.channels / 1e6;
+	}
+
+	static vector< std::pair<string, string> > configuration(const SyntheticMosaicParameters& p)
+	{
+		return {
+			{ "dimensionality", to_string(p.dimensionality) },
+			{ "tiles", to_string(p.tilesX) + "x" + to_string(p.tilesY) + (p.dimensionality == 3 ? "x" + to_string(p.tilesZ) : "") },
+			{ "tile", to_string(p.tileWidth) + "x" + to_string(p.tileHeight) + (p.dimensionality == 3 ? "x" + to_string(p.tileDepth) : "") },
+			{ "overlap", to_string(p.overlap) },
+			{ "noise", to_string(p.noise) },
+			{ "bits", to_string(p.bitDepth) },
+			{ "channels", to_string(p.channels) },
+			{ "seed", to_string(p.seed) },
+			{ "threads", to_string(ThreadPool::global().numThreads()) }
+		};
+	}
+
+	/** @return false (and logs why) if an argument is not understood */
+	static bool parse(const vector<string>& args, SyntheticMosaicParameters& p, int& repeat, string& json)
+	{
+		for (const string& arg : args)
+		{
+			size_t equals = arg.find('=');
+			string key = arg.substr(0, equals);
+			string value = equals == string::npos ? "" : arg.substr(equals + 1);
+			int a = 0, b = 0, c = 0;
+			int numValues = sscanf(value.c_str(), "%dx%dx%d", &a, &b, &c);
+
+			if (key == "tiles" && numValues >= 2)
+			{
+				p.tilesX = a;
+				p.tilesY = b;
+				p.tilesZ = numValues == 3 ? c : 1;
+				p.dimensionality = numValues == 3 ? 3 : p.dimensionality;
+			}
+			else if (key == "tile" && numValues >= 2)
+			{
+				p.tileWidth = a;
+				p.tileHeight = b;
+
+				if (numValues == 3)
+				{
+					p.tileDepth = c;
+					p.dimensionality = 3;
+				}
+			}
+			else if (key == "overlap")
+				p.overlap = atof(value.c_str());
+			else if (key == "jitter")
+				p.jitter = atof(value.c_str());
+			else if (key == "noise")
+				p.noise = atof(value.c_str());
+			else if (key == "bits" && (value == "8" || value == "16" || value == "32"))
+				p.bitDepth = atoi(value.c_str());
+			else if (key == "channels" && atoi(value.c_str()) > 0)
+				p.channels = atoi(value.c_str());
+			else if (key == "seed")
+				p.seed = strtoull(value.c_str(), nullptr, 10);
+			else if (key == "repeat" && atoi(value.c_str()) > 0)
+				repeat = atoi(value.c_str());
+			else if (key == "json")
+				json = value;
+			else
+			{
+				LOGERR("Unknown benchmark argument '" << arg << "'.");
+				return false;
+			}
+		}
+
+		return true;
+	}
+};
@@ -0,0 +1,432 @@
+#pragma once
+
+#include "header.h"
+#include "tools/benchmarkreport.h"
+#include "tools/timehelper.h"
+#include "mpicbg/stitching/fusion/AveragePixelFusion.h"
+#include "mpicbg/stitching/fusion/BlendingPixelFusion.h"
+#include "mpicbg/stitching/fusion/ClassifiedRegion.h"
+#include "mpicbg/stitching/fusion/ImageInterpolation.h"
+#include "mpicbg/stitching/fusion/Interval.h"
+#include "mpicbg/stitching/fusion/MaxPixelFusion.h"
+#include "mpicbg/stitching/fusion/MedianPixelFusion.h"
+#include "mpicbg/stitching/fusion/MinPixelFusion.h"
+#include "mpicbg/stitching/fusion/SampleVolume.h"
+#include "mpicbg/stitching/fusion/TranslationInterpolator.h"
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <random>
+
+import net.imglib2.img.display.imagej.ImageJFunctions;
+import net.imglib2.interpolation.randomaccess.NLinearInterpolatorFactory;
+import net.imglib2.interpolation.randomaccess.NearestNeighborInterpolatorFactory;
+
+/**
+ * Micro-benchmarks of the inner loops of the fusion, each isolated from the rest of the
+ * pipeline: the pixel fusion methods, the blending weight, the interpolation of the
+ * sources (imglib nearest neighbor and n-linear as well as the native paths on
+ * {@link SampleVolume}) and the intersection of {@link ClassifiedRegion}s.
+ *
+ * Every case runs for 1 to 8 overlapping images and for 8, 16 and 32 bit sources (the
+ * region intersection does not depend on the pixel type), so a regression can be traced
+ * to one kernel and one overlap count. Single threaded, so the numbers do not depend on
+ * the machine's cores.
+ *
+ * Run as "StitchingCpp microbenchmark [key=value ...]" with size=256 (the width and height
+ * of the sources) repeat=5 json=micro.jsonl. Every case is run repeat times and the best
+ * time is reported.
+ */
+class MicroBenchmark {
+public:
+	static const int maxOverlaps = 8;
+
+	static int run(vector<string> args)
+	{
+		int size = 256, repeat = 5;
+		string json;
+
+		if (!parse(args, size, repeat, json))
+			return 1;
+
+		BenchmarkReport report({ { "size", to_string(size) }, { "repeat", to_string(repeat) } });
+
+		LOGINFO("Micro-benchmarks on " << size << "x" << size << " sources, 1 to " << maxOverlaps << " overlaps, 8, 16 and 32 bit");
+
+		for (int bits : { 8, 16, 32 })
+		{
+			Sources sources(size, bits);
+
+			for (int overlaps = 1; overlaps <= maxOverlaps; ++overlaps)
+			{
+				benchmarkFusion(sources, overlaps, repeat, report);
+				benchmarkInterpolation(sources, overlaps, repeat, report);
+			}
+		}
+
+		for (int overlaps = 1; overlaps <= maxOverlaps; ++overlaps)
+			benchmarkIntersection(overlaps, repeat, report);
+
+		LOGINFO("\n" << report.table());
+
+		if (!json.empty() && report.writeJson(json))
+			LOGINFO("Results written to " << json);
+
+		return 0;
+	}
+
+protected:
+	/**
+	 * maxOverlaps random planes of one pixel type, as {@link SampleVolume}s for the native
+	 * paths and as ImagePlus for imglib, and random subpixel positions inside them.
+	 */
+	struct Sources {
+		int size, bits;
+		vector< vector<uint8_t> > bytes;
+		vector< vector<uint16_t> > shorts;
+		vector< vector<float> > floats;
+		vector< SampleVolume > volumes;
+		vector< ImagePlus > images;
+		vector< double > positions;
+
+		Sources(int size, int bits) : size(size), bits(bits)
+		{
+			std::mt19937_64 random(bits);
+			std::uniform_real_distribution<double> value(0, 1);
+			std::uniform_real_distribution<double> position(0, size - 1);
+			int n = size * size;
+
+			for (int i = 0; i < maxOverlaps; ++i)
+			{
+				SampleVolume volume;
+				volume.width = volume.height = size;
+				volume.depth = 1;
+				volume.rowStride = size;
+
+				if (bits == 8)
+				{
+					bytes.emplace_back(n);
+					for (uint8_t& v : bytes.back())
+						v = (uint8_t)(value(random) * 255);
+
+					volume.format = PlaneCopy::UINT8;
+					volume.planes.push_back(bytes.back().data());
+
+					byte[] pixels = new byte[n];
+					for (int j = 0; j < n; ++j)
+						pixels[j] = (byte)bytes.back()[j];
+					images.push_back(new ImagePlus("", new ByteProcessor(size, size, pixels)));
+				}
+				else if (bits == 16)
+				{
+					shorts.emplace_back(n);
+					for (uint16_t& v : shorts.back())
+						v = (uint16_t)(value(random) * 65535);
+
+					volume.format = PlaneCopy::UINT16;
+					volume.planes.push_back(shorts.back().data());
+
+					short[] pixels = new short[n];
+					for (int j = 0; j < n; ++j)
+						pixels[j] = (short)shorts.back()[j];
+					images.push_back(new ImagePlus("", new ShortProcessor(size, size, pixels, null)));
+				}
+				else
+				{
+					floats.emplace_back(n);
+					for (float& v : floats.back())
+						v = (float)value(random);
+
+					volume.format = PlaneCopy::FLOAT32;
+					volume.planes.push_back(floats.back().data());
+
+					float[] pixels = new float[n];
+					for (int j = 0; j < n; ++j)
+						pixels[j] = floats.back()[j];
+					images.push_back(new ImagePlus("", new FloatProcessor(size, size, pixels, null)));
+				}
+
+				volumes.push_back(volume);
+			}
+
+			for (int i = 0; i < 2 * n; ++i)
+				positions.push_back(position(random));
+		}
+
+		int numPixels() const { return size * size; }
+	};
+
+	/** Each pixel fusion method on the native samples of the overlapping images, one output pixel at a time. */
+	static void benchmarkFusion(Sources& sources, int overlaps, int repeat, BenchmarkReport& report)
+	{
+		AveragePixelFusion average;
+		MedianPixelFusion median;
+		MaxPixelFusion max;
+		MinPixelFusion min;
+
+		std::pair<const char*, PixelFusion*> methods[] = { { "average", &average }, { "median", &median }, { "max", &max }, { "min", &min } };
+
+		for (auto& method : methods)
+		{
+			PixelFusion* fusion = method.second;
+
+			add(report, string("fusion ") + method.first, sources, overlaps, repeat, [&]()
+			{
+				double sum = 0;
+				double[] position = new double[2];
+
+				for (int y = 0; y < sources.size; ++y)
+					for (int x = 0; x < sources.size; ++x)
+					{
+						fusion->clear();
+
+						for (int i = 0; i < overlaps; ++i)
+							fusion->addValue(sources.volumes[i].get(x, y, 0), i, position);
+
+						sum += fusion->getValue();
+					}
+
+				return sum;
+			});
+		}
+
+		// the weight of every image at every pixel is what makes blending more expensive than averaging
+		add(report, "fusion blending weight", sources, overlaps, repeat, [&]()
+		{
+			double sum = 0;
+			double[] location = new double[2];
+			long[] dimensions = new long[]{ sources.size, sources.size };
+			double[] border = new double[]{ 0, 0 };
+
+			for (int y = 0; y < sources.size; ++y)
+				for (int x = 0; x < sources.size; ++x)
+				{
+					double weightSum = 0, valueSum = 0;
+
+					for (int i = 0; i < overlaps; ++i)
+					{
+						// every image is shifted a little, as overlapping tiles are
+						location[0] = SampleVolume::mirror(x + 3 * i, sources.size);
+						location[1] = SampleVolume::mirror(y + 5 * i, sources.size);
+
+						double weight = BlendingPixelFusion::computeWeight(location, dimensions, border, 0.2);
+						weightSum += weight;
+						valueSum += weight * sources.volumes[i].get(x, y, 0);
+					}
+
+					sum += weightSum == 0 ? 0 : valueSum / weightSum;
+				}
+
+			return sum;
+		});
+	}
+
+	/**
+	 * Sampling the overlapping images at random subpixel positions, with the imglib
+	 * interpolators of {@link ImageInterpolation} and with the native paths of the
+	 * subpixel fusion, plus whole rows with a {@link TranslationInterpolator}.
+	 */
+	static void benchmarkInterpolation(Sources& sources, int overlaps, int repeat, BenchmarkReport& report)
+	{
+		int n = sources.numPixels();
+		const double* positions = sources.positions.data();
+
+		for (int linear = 0; linear < 2; ++linear)
+		{
+			ArrayList< RealRandomAccess< ? : public RealType< ? > > > interpolators = new ArrayList< RealRandomAccess< ? : public RealType< ? > > >();
+
+			for (int i = 0; i < overlaps; ++i)
+			{
+				Img< ? : public RealType< ? > > img = ImageJFunctions.wrap(sources.images[i]);
+
+				if (linear)
+					interpolators.add(new ImageInterpolation(img, new NLinearInterpolatorFactory(), true).createInterpolator());
+				else
+					interpolators.add(new ImageInterpolation(img, new NearestNeighborInterpolatorFactory(), true).createInterpolator());
+			}
+
+			add(report, linear ? "imglib n-linear" : "imglib nearest", sources, overlaps, repeat, [&]()
+			{
+				double sum = 0;
+
+				for (int p = 0; p < n; ++p)
+					for (int i = 0; i < overlaps; ++i)
+					{
+						interpolators.get(i).setPosition(positions + 2 * p);
+						sum += interpolators.get(i).get().getRealDouble();
+					}
+
+				return sum;
+			});
+		}
+
+		add(report, "native nearest", sources, overlaps, repeat, [&]()
+		{
+			double sum = 0;
+
+			for (int p = 0; p < n; ++p)
+				for (int i = 0; i < overlaps; ++i)
+				{
+					const SampleVolume& volume = sources.volumes[i];
+					int x = SampleVolume::mirror((int)std::floor(positions[2 * p] + 0.5), volume.width);
+					int y = SampleVolume::mirror((int)std::floor(positions[2 * p + 1] + 0.5), volume.height);
+					sum += volume.get(x, y, 0);
+				}
+
+			return sum;
+		});
+
+		add(report, "native n-linear", sources, overlaps, repeat, [&]()
+		{
+			double sum = 0;
+
+			for (int p = 0; p < n; ++p)
+				for (int i = 0; i < overlaps; ++i)
+					sum += sources.volumes[i].interpolate(positions + 2 * p, 2);
+
+			return sum;
+		});
+
+		vector< TranslationInterpolator > samplers;
+
+		for (int i = 0; i < overlaps; ++i)
+		{
+			double shift[] = { positions[2 * i] - std::floor(positions[2 * i]), positions[2 * i + 1] - std::floor(positions[2 * i + 1]) };
+			samplers.push_back(TranslationInterpolator(&sources.volumes[i], shift, 2));
+		}
+
+		add(report, "translation rows", sources, overlaps, repeat, [&]()
+		{
+			double sum = 0;
+			vector<float> row(sources.size), scratch;
+
+			for (int y = 0; y < sources.size; ++y)
+				for (int i = 0; i < overlaps; ++i)
+				{
+					samplers[i].sampleRow(0, y, 0, sources.size, row.data(), scratch);
+					sum += row[y];
+				}
+
+			return sum;
+		});
+	}
+
+	/**
+	 * The test at the heart of the region decomposition: tiles that overlap with the given
+	 * number of others are intersected with a grid of placed regions, and the classes are
+	 * merged where they intersect, like splitting does.
+	 */
+	static void benchmarkIntersection(int overlaps, int repeat, BenchmarkReport& report)
+	{
+		const int grid = 32, cell = 16, tile = 64;
+		ArrayList< ClassifiedRegion > placed = new ArrayList< ClassifiedRegion >();
+		ArrayList< ClassifiedRegion > tiles = new ArrayList< ClassifiedRegion >();
+
+		for (int y = 0; y < grid; ++y)
+			for (int x = 0; x < grid; ++x)
+			{
+				ClassifiedRegion region = new ClassifiedRegion(2);
+				region.set(new Interval(x * cell, x * cell + cell - 1), 0);
+				region.set(new Interval(y * cell, y * cell + cell - 1), 1);
+
+				for (int c = 0; c < overlaps; ++c)
+					region.addClass(c);
+
+				placed.add(region);
+			}
+
+		// stacks of overlaps tiles, each shifted a little from the previous one
+		for (int t = 0; t < 64; ++t)
+		{
+			int x0 = t % 8 * (grid * cell - tile) / 8, y0 = t / 8 * (grid * cell - tile) / 8;
+
+			for (int i = 0; i < overlaps; ++i)
+			{
+				ClassifiedRegion region = new ClassifiedRegion(2);
+				region.set(new Interval(x0 + 3 * i, x0 + 3 * i + tile - 1), 0);
+				region.set(new Interval(y0 + 5 * i, y0 + 5 * i + tile - 1), 1);
+				region.addClass(overlaps + i);
+				tiles.add(region);
+			}
+		}
+
+		BenchmarkReport::Result result;
+		result.name = "region intersection";
+		result.amount = (double)tiles.size() * placed.size() / 1e6;
+		result.unit = "M tests/s";
+		result.parameters = { { "overlaps", to_string(overlaps) }, { "bits", "-" } };
+		result.seconds = INFINITY;
+
+		for (int r = 0; r < repeat; ++r)
+		{
+			long long start = TimeHelper::nanoseconds();
+			long long merged = 0;
+
+			for (ClassifiedRegion query : tiles)
+				for (ClassifiedRegion region : placed)
+					if (query.intersects(region))
+					{
+						ClassifiedRegion child = new ClassifiedRegion(region);
+						child.addAllClasses(query);
+						merged += child.classArray().length;
+					}
+
+			result.seconds = std::min(result.seconds, (TimeHelper::nanoseconds() - start) / 1e9);
+			consume((double)merged);
+		}
+
+		report.add(result);
+	}
+
+	/** Times a kernel that returns a checksum, so the compiler cannot drop its work, and adds its best time. */
+	static void add(BenchmarkReport& report, const string& name, const Sources& sources, int overlaps, int repeat, const std::function<double()>& kernel)
+	{
+		BenchmarkReport::Result result;
+		result.name = name;
+		result.amount = sources.numPixels() / 1e6;
+		result.unit = "MP/s";
+		result.parameters = { { "overlaps", to_string(overlaps) }, { "bits", to_string(sources.bits) } };
+		result.seconds = INFINITY;
+
+		for (int r = 0; r < repeat; ++r)
+		{
+			long long start = TimeHelper::nanoseconds();
+			double checksum = kernel();
+			result.seconds = std::min(result.seconds, (TimeHelper::nanoseconds() - start) / 1e9);
+			consume(checksum);
+		}
+
+		report.add(result);
+	}
+
+	/** @return false (and logs why) if an argument is not understood */
+	static bool parse(const vector<string>& args, int& size, int& repeat, string& json)
+	{
+		for (const string& arg : args)
+		{
+			size_t equals = arg.find('=');
+			string key = arg.substr(0, equals);
+			string value = equals == string::npos ? "" : arg.substr(equals + 1);
+
+			if (key == "size" && atoi(value.c_str()) >= 16)
+				size = atoi(value.c_str());
+			else if (key == "repeat" && atoi(value.c_str()) > 0)
+				repeat = atoi(value.c_str());
+			else if (key == "json")
+				json = value;
+			else
+			{
+				LOGERR("Unknown micro-benchmark argument '" << arg << "'.");
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	static void consume(double checksum)
+	{
+		static volatile double sink = 0;
+		sink = sink + checksum;
+	}
+};
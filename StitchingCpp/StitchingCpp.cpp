@@ -2,8 +2,18 @@
 //
 
 #include <iostream>
+#include "Benchmark.h"
+#include "MicroBenchmark.h"
 
-int main()
+int main(int argc, char* argv[])
 {
+	// StitchingCpp benchmark [key=value ...], see Benchmark
+	if (argc > 1 && std::string(argv[1]) == "benchmark")
+		return Benchmark::run(std::vector<std::string>(argv + 2, argv + argc));
+
+	// StitchingCpp microbenchmark [key=value ...], see MicroBenchmark
+	if (argc > 1 && std::string(argv[1]) == "microbenchmark")
+		return MicroBenchmark::run(std::vector<std::string>(argv + 2, argv + argc));
+
 	return 0;
 }
@@ -6,8 +6,10 @@
 #include <chrono>
 #include <thread>
 #include <map>
+#include "tools/logger.h"
 
 using namespace std;
 
-#define LOGINFO(msg) (std::cout << msg << std::endl)
-#define LOGERR(msg) (std::cout << "Error: " << msg << std::endl)
\ No newline at end of file
+// written by the background thread of the Logger, msg is only formatted if the level is enabled
+#define LOGINFO(msg) (Logger::global().isEnabled(LogLevel::info) ? Logger::global().log(LogLevel::info, LogMessage() << msg) : (void)0)
+#define LOGERR(msg) (Logger::global().isEnabled(LogLevel::error) ? Logger::global().log(LogLevel::error, LogMessage() << msg) : (void)0)
\ No newline at end of file
@@ -1,5 +1,66 @@
 #pragma once
 #include "header.h"
-#include ""
+#include "DirectAccessContainerFactory.h"
 
-class ArrayContainerFactory : 
\ No newline at end of file
+/**
+ * All pixels in one aligned array, x fastest. This is a single {@link RawSpan}, so it
+ * is the fastest container to iterate over, but the image has to fit into one
+ * allocation.
+ */
+template<class T>
+class ArrayContainer : public Container<T> {
+public:
+	/** @param scratch - take the array from the scratch arena of the calling thread */
+	ArrayContainer(const vector<int>& dim, bool scratch) : Container<T>(dim),
+		pixels(scratch ? AlignedBuffer<T>::scratch((size_t)this->numPixels) : AlignedBuffer<T>((size_t)this->numPixels)) {}
+
+	virtual int numSpans() const override { return 1; }
+
+	virtual RawSpan<T> span(int) override
+	{
+		RawSpan<T> span;
+		span.data = pixels.data();
+		span.size = this->numPixels;
+
+		for (int d = 0; d < this->getNumDimensions(); ++d)
+			span.dim[d] = this->dimensions[d];
+
+		return span;
+	}
+
+	virtual T& at(int x, int y, int z = 0) override
+	{
+		return pixels.data()[((long long)z * this->getDimension(1) + y) * this->getDimension(0) + x];
+	}
+
+	T* data() { return pixels.data(); }
+
+private:
+	AlignedBuffer<T> pixels;
+};
+
+class ArrayContainerFactory : public DirectAccessContainerFactory<ArrayContainerFactory> {
+protected:
+	bool scratch;
+
+public:
+	/**
+	 * @param scratch - allocate from the {@link ScratchArena} of the creating thread, for
+	 * short-lived images like the rois and FFTs of one pair
+	 */
+	explicit ArrayContainerFactory(bool scratch = false) : scratch(scratch) {}
+
+	template<class T>
+	Container<T>* make(const vector<int>& dim)
+	{
+		if ((int)dim.size() > Container<T>::maxDimensions)
+		{
+			LOGERR("ArrayContainerFactory: only up to " << Container<T>::maxDimensions << " dimensions are supported.");
+			return nullptr;
+		}
+
+		return new ArrayContainer<T>(dim, scratch);
+	}
+
+	virtual void printProperties() override { LOGINFO("ArrayContainerFactory(): all pixels in one array"); }
+};
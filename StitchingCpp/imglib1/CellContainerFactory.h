@@ -0,0 +1,91 @@
+#pragma once
+#include "header.h"
+#include "DirectAccessContainerFactory.h"
+#include <algorithm>
+
+/**
+ * The image cut into cells (blocks) that are stored one after the other, each cell x
+ * fastest. A cell is a {@link RawSpan}, so a neighbourhood is close in memory in all
+ * dimensions, which is what the region intersection and the blockwise fusion want.
+ * Cells at the border are cropped to the image.
+ */
+template<class T>
+class CellContainer : public Container<T> {
+public:
+	CellContainer(const vector<int>& dim, int cellSize) : Container<T>(dim), pixels((size_t)this->numPixels)
+	{
+		for (int d = 0; d < 3; ++d)
+		{
+			cellDim[d] = d < this->getNumDimensions() ? std::min(cellSize, this->getDimension(d)) : 1;
+			numCells[d] = (this->getDimension(d) + cellDim[d] - 1) / cellDim[d];
+		}
+
+		long long offset = 0;
+
+		for (int cz = 0; cz < numCells[2]; ++cz)
+			for (int cy = 0; cy < numCells[1]; ++cy)
+				for (int cx = 0; cx < numCells[0]; ++cx)
+				{
+					RawSpan<T> cell;
+					int c[3] = { cx, cy, cz };
+
+					for (int d = 0; d < 3; ++d)
+					{
+						cell.min[d] = c[d] * cellDim[d];
+						cell.dim[d] = std::min(cellDim[d], this->getDimension(d) - cell.min[d]);
+					}
+
+					cell.data = pixels.data() + offset;
+					cell.size = (long long)cell.dim[0] * cell.dim[1] * cell.dim[2];
+					offset += cell.size;
+					cells.push_back(cell);
+				}
+	}
+
+	virtual int numSpans() const override { return (int)cells.size(); }
+
+	virtual RawSpan<T> span(int i) override { return cells[i]; }
+
+	virtual T& at(int x, int y, int z = 0) override
+	{
+		const RawSpan<T>& cell = cells[((long long)z / cellDim[2] * numCells[1] + y / cellDim[1]) * numCells[0] + x / cellDim[0]];
+		return cell.data[((long long)(z - cell.min[2]) * cell.dim[1] + (y - cell.min[1])) * cell.dim[0] + (x - cell.min[0])];
+	}
+
+	int getCellSize(int d) const { return cellDim[d]; }
+
+private:
+	AlignedBuffer<T> pixels;
+	vector< RawSpan<T> > cells;
+	int cellDim[3];
+	int numCells[3];
+};
+
+class CellContainerFactory : public DirectAccessContainerFactory<CellContainerFactory> {
+protected:
+	int cellSize;
+
+public:
+	/** @param cellSize - edge length of the cells, 0 picks 256 for 2d and 64 for 3d images */
+	explicit CellContainerFactory(int cellSize = 0) : cellSize(cellSize) {}
+
+	template<class T>
+	Container<T>* make(const vector<int>& dim)
+	{
+		if ((int)dim.size() > Container<T>::maxDimensions)
+		{
+			LOGERR("CellContainerFactory: only up to " << Container<T>::maxDimensions << " dimensions are supported.");
+			return nullptr;
+		}
+
+		int size = cellSize > 0 ? cellSize : (dim.size() < 3 ? 256 : 64);
+		return new CellContainer<T>(dim, size);
+	}
+
+	virtual void printProperties() override { LOGINFO("CellContainerFactory(): cells of " << cellSize << " pixels per dimension"); }
+
+	virtual void setParameters(string configuration) override
+	{
+		cellSize = atoi(configuration.c_str());
+	}
+};
@@ -0,0 +1,124 @@
+#pragma once
+#include "header.h"
+#include "tools/alignedbuffer.h"
+
+/**
+ * A contiguous block of pixels in a container: the box [min, min + dim) of the image,
+ * stored x fastest, then y, then z. Array containers have one span for the whole image,
+ * planar containers one per slice and cell containers one per cell, so loops over the
+ * spans run on raw memory without any per-pixel indirection.
+ */
+template<class T>
+struct RawSpan {
+	T* data = nullptr;
+	long long size = 0;
+	int min[3] = { 0, 0, 0 };
+	int dim[3] = { 1, 1, 1 };
+};
+
+/**
+ * The storage of an image of up to three dimensions, as a set of {@link RawSpan}s.
+ */
+template<class T>
+class Container {
+public:
+	static const int maxDimensions = 3;
+
+	explicit Container(const vector<int>& dimensions) : dimensions(dimensions), numPixels(1)
+	{
+		for (int d : dimensions)
+			numPixels *= d;
+	}
+
+	virtual ~Container() {}
+
+	Container(const Container&) = delete;
+	Container& operator=(const Container&) = delete;
+
+	int getNumDimensions() const { return (int)dimensions.size(); }
+	int getDimension(int d) const { return d < (int)dimensions.size() ? dimensions[d] : 1; }
+	const vector<int>& getDimensions() const { return dimensions; }
+	long long getNumPixels() const { return numPixels; }
+
+	virtual int numSpans() const = 0;
+	virtual RawSpan<T> span(int i) = 0;
+
+	/** the pixel at a position, slow compared to the spans, for single lookups only */
+	virtual T& at(int x, int y, int z = 0) = 0;
+
+protected:
+	vector<int> dimensions;
+	long long numPixels;
+};
+
+/**
+ * Iterates over all pixels of a {@link Container} span by span, in storage order. The
+ * pixels are visited in the order of the spans, not necessarily in raster order of the
+ * image, but the cursor knows the position of each one. Loops that do not need
+ * positions should take whole spans with {@link #nextSpan}.
+ */
+template<class T>
+class SpanCursor {
+public:
+	explicit SpanCursor(Container<T>& container) : container(container), spanIndex(-1), index(-1), x(0), y(0), z(0) {}
+
+	bool hasNext() const { return index + 1 < current.size || spanIndex + 1 < container.numSpans(); }
+
+	void fwd()
+	{
+		if (++index >= current.size)
+		{
+			current = container.span(++spanIndex);
+			index = 0;
+			x = current.min[0];
+			y = current.min[1];
+			z = current.min[2];
+			return;
+		}
+
+		if (++x == current.min[0] + current.dim[0])
+		{
+			x = current.min[0];
+
+			if (++y == current.min[1] + current.dim[1])
+			{
+				y = current.min[1];
+				++z;
+			}
+		}
+	}
+
+	T& get() const { return current.data[index]; }
+
+	int getPosition(int d) const { return d == 0 ? x : d == 1 ? y : z; }
+
+	/**
+	 * Hands out the next whole span, the per-pixel state is not touched.
+	 *
+	 * @return false if there are no more spans
+	 */
+	bool nextSpan(RawSpan<T>& span)
+	{
+		if (spanIndex + 1 >= container.numSpans())
+			return false;
+
+		span = container.span(++spanIndex);
+		index = span.size - 1;
+		current = span;
+		return true;
+	}
+
+	void reset()
+	{
+		spanIndex = -1;
+		index = -1;
+		current = RawSpan<T>();
+	}
+
+private:
+	Container<T>& container;
+	RawSpan<T> current;
+	int spanIndex;
+	long long index;
+	int x, y, z;
+};
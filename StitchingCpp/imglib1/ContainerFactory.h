@@ -1,22 +1,39 @@
 #pragma once
 #include "header.h"
 #include "Factory.h"
+#include "Container.h"
+#include <complex>
+#include <cstdint>
 
+/**
+ * Creates the {@link Container}s an image is stored in. A virtual member can not be a
+ * template, so there is one virtual per sample type the pipeline uses (the pixel types
+ * of ImageJ and the complex values of the FFT); {@link #createContainer} picks the
+ * right one.
+ */
 class ContainerFactory : public Factory {
 protected:
-	bool useOptimizedContainers = true;
+	bool optimizedContainers = true;
 
 public:
+	virtual ~ContainerFactory() {}
+
 	/**
-	 * This method is called by {@link Image}. The {@link ContainerFactory} can decide how to create the {@link Container},
-	 * if it is for example a {@link DirectAccessContainerFactory} it will ask the {@link Type} to create a
-	 * suitable {@link Container} for the {@link Type} and the dimensionality
-	 *
-	 * @return {@link Container} - the instantiated Container
+	 * @return {@link Container} - the instantiated Container, owned by the caller
 	 */
 	template<class T>
-	virtual <T extends Type<T>> Container<T> createContainer(int dim[], T type) = 0;
+	Container<T>* createContainer(const vector<int>& dim) { return create(dim, (T*)nullptr); }
+
+	void setOptimizedContainerUse(bool useOptimizedContainers) { this->optimizedContainers = useOptimizedContainers; }
+	bool useOptimizedContainers() { return optimizedContainers; }
 
-	void setOptimizedContainerUse(bool useOptimizedContainers) { this->useOptimizedContainers = useOptimizedContainers; }
-	bool useOptimizedContainers() { return useOptimizedContainers; }
-};
\ No newline at end of file
+	virtual void printProperties() override {}
+	virtual string getErrorMessage() override { return ""; }
+	virtual void setParameters(string) override {}
+
+protected:
+	virtual Container<uint8_t>* create(const vector<int>& dim, uint8_t*) = 0;
+	virtual Container<uint16_t>* create(const vector<int>& dim, uint16_t*) = 0;
+	virtual Container<float>* create(const vector<int>& dim, float*) = 0;
+	virtual Container< std::complex<float> >* create(const vector<int>& dim, std::complex<float>*) = 0;
+};
@@ -1,4 +1,17 @@
 #pragma once
 #include "header.h"
+#include "PixelGridContainerFactory.h"
 
-class DirectAccessContainerFactory : public
\ No newline at end of file
+/**
+ * Base of the factories whose containers store the pixels in native arrays, which
+ * cursors and algorithms can access directly through {@link RawSpan}s. Each subclass
+ * only has to provide one template for all sample types.
+ */
+template<class Derived>
+class DirectAccessContainerFactory : public PixelGridContainerFactory {
+protected:
+	virtual Container<uint8_t>* create(const vector<int>& dim, uint8_t*) override { return ((Derived*)this)->template make<uint8_t>(dim); }
+	virtual Container<uint16_t>* create(const vector<int>& dim, uint16_t*) override { return ((Derived*)this)->template make<uint16_t>(dim); }
+	virtual Container<float>* create(const vector<int>& dim, float*) override { return ((Derived*)this)->template make<float>(dim); }
+	virtual Container< std::complex<float> >* create(const vector<int>& dim, std::complex<float>*) override { return ((Derived*)this)->template make< std::complex<float> >(dim); }
+};
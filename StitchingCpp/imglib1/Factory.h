@@ -3,7 +3,9 @@
 
 class Factory {
 public:
+	virtual ~Factory() {}
+
 	virtual void printProperties() = 0;
 	virtual string getErrorMessage() = 0;
 	virtual void setParameters(string configuration) = 0;
-};
\ No newline at end of file
+};
@@ -1,25 +1,10 @@
 #pragma once
-
 #include "header.h"
 #include "ContainerFactory.h"
 
-
-
-class PixelGridContainerFactory : public ContainerFactory
-{
-public:
-	PixelGridContainerFactory : public ContainerFactory();
-	~PixelGridContainerFactory : public ContainerFactory();
-	template<class T>
-	virtual <T extends Type<T>> PixelGridContainer<T> createContainer(int dim[], T type) = 0;
-private:
-
+/**
+ * Base of the factories whose containers store a regular grid of pixels, as opposed
+ * to e.g. sparse or functional images.
+ */
+class PixelGridContainerFactory : public ContainerFactory {
 };
-
-PixelGridContainerFactory : public ContainerFactory::PixelGridContainerFactory : public ContainerFactory()
-{
-}
-
-PixelGridContainerFactory : public ContainerFactory::~PixelGridContainerFactory : public ContainerFactory()
-{
-}
\ No newline at end of file
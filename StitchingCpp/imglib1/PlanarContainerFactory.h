@@ -0,0 +1,59 @@
+#pragma once
+#include "header.h"
+#include "DirectAccessContainerFactory.h"
+
+/**
+ * One aligned array per xy plane, like the slices of an ImageStack. Each plane is a
+ * {@link RawSpan}; large stacks do not need one huge allocation.
+ */
+template<class T>
+class PlanarContainer : public Container<T> {
+public:
+	explicit PlanarContainer(const vector<int>& dim) : Container<T>(dim)
+	{
+		long long planeSize = (long long)this->getDimension(0) * this->getDimension(1);
+
+		for (int z = 0; z < this->getDimension(2); ++z)
+			planes.push_back(AlignedBuffer<T>((size_t)planeSize));
+	}
+
+	virtual int numSpans() const override { return (int)planes.size(); }
+
+	virtual RawSpan<T> span(int i) override
+	{
+		RawSpan<T> span;
+		span.data = planes[i].data();
+		span.size = (long long)planes[i].size();
+		span.min[2] = i;
+		span.dim[0] = this->getDimension(0);
+		span.dim[1] = this->getDimension(1);
+		return span;
+	}
+
+	virtual T& at(int x, int y, int z = 0) override
+	{
+		return planes[z].data()[(long long)y * this->getDimension(0) + x];
+	}
+
+	T* plane(int z) { return planes[z].data(); }
+
+private:
+	vector< AlignedBuffer<T> > planes;
+};
+
+class PlanarContainerFactory : public DirectAccessContainerFactory<PlanarContainerFactory> {
+public:
+	template<class T>
+	Container<T>* make(const vector<int>& dim)
+	{
+		if ((int)dim.size() > Container<T>::maxDimensions)
+		{
+			LOGERR("PlanarContainerFactory: only up to " << Container<T>::maxDimensions << " dimensions are supported.");
+			return nullptr;
+		}
+
+		return new PlanarContainer<T>(dim);
+	}
+
+	virtual void printProperties() override { LOGINFO("PlanarContainerFactory(): one array per plane"); }
+};
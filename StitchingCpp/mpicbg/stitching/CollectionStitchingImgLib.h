@@ -20,6 +20,10 @@
  * #L%
  */
 // package mpicbg.stitching;
+#include "header.h"
+#include "tools/scratcharena.h"
+#include "tools/threadpool.h"
+#include "RegistrationJournal.h"
 
 import ij.IJ;
 import ij.gui.Roi;
@@ -27,10 +31,8 @@ import ij.gui.Roi;
 import java.awt.Rectangle;
 import java.util.ArrayList;
 import java.util.Vector;
-import java.util.concurrent.atomic.AtomicInteger;
 
 import stitching.utils.Log;
-import mpicbg.imglib.multithreading.SimpleMultiThreading;
 import mpicbg.imglib.util.Util;
 import mpicbg.models.TranslationModel2D;
 import mpicbg.models.TranslationModel3D;
@@ -54,62 +56,48 @@ class CollectionStitchingImgLib
 				return null;
 			}
 			
-			// compute all compare pairs
-			// compute all matchings
-			AtomicInteger ai = new AtomicInteger(0);
+			// results of an earlier run with the same tiles and parameters
+			RegistrationJournal journal;
 			
-			int numThreads;
+			if ( !params.registrationJournal.empty() && journal.open( params.registrationJournal ) && journal.size() > 0 )
+				LOGINFO( "Found " + journal.size() + " pairwise results in '" + params.registrationJournal + "'." );
+			
+			// compute all compare pairs on the pool, its workers and with them their
+			// scratch arenas live as long as the process
+			ThreadPool& pool = ThreadPool::global();
+			ThreadPool::TaskGroup group;
+			atomic< bool > failed( false );
+			
+			long time = TimeHelper::milliseconds();
 			
 			if ( params.cpuMemChoice == 0 )
-				numThreads = 1;
+			{
+				// save memory, one pair at a time
+				pool.submit( group, [&]()
+				{
+					for ( int i = 0; i < pairs.size() && !failed; ++i )
+						if ( !computePair( pairs.get( i ), params, journal ) )
+							failed = true;
+				});
+			}
 			else
-				numThreads = Runtime.getRuntime().availableProcessors();
+			{
+				for ( int i = 0; i < pairs.size(); ++i )
+					pool.submit( group, [&, i]()
+					{
+						if ( !failed && !computePair( pairs.get( i ), params, journal ) )
+							failed = true;
+					});
+			}
 			
-	        Thread[] threads = SimpleMultiThreading.newThreads( numThreads );
-	    	
-	        for ( int ithread = 0; ithread < threads.length; ++ithread )
-	            threads[ ithread ] = new Thread(new Runnable()
-	            {
-	                @Override
-	                public void run()
-	                {		
-	                   	int myNumber = ai.getAndIncrement();
-	                    
-	                    for ( int i = 0; i < pairs.size(); i++ )
-	                    {
-	                    	if ( i % numThreads == myNumber )
-	                    	{
-	                    		ComparePair pair = pairs.get( i );
-	                    		
-	                    		long start = TimeHelper::milliseconds();			
-	                			
-	                    		// where do we approximately overlap?
-	                			Roi roi1 = getROI( pair.getTile1().getElement(), pair.getTile2().getElement() );
-	                			Roi roi2 = getROI( pair.getTile2().getElement(), pair.getTile1().getElement() );
-	                			
-	            				PairWiseStitchingResult result = PairWiseStitchingImgLib.stitchPairwise( pair.getImagePlus1(), pair.getImagePlus2(), roi1, roi2, pair.getTimePoint1(), pair.getTimePoint2(), params );			
-	            				if ( result == null )
-	            				{
-	            					LOGERR( "Collection stitching failed" );
-	            					return;
-	            				}
-	
-	            				if ( params.dimensionality == 2 )
-	            					pair.setRelativeShift( new float[]{ result.getOffset( 0 ), result.getOffset( 1 ) } );
-	            				else
-	            					pair.setRelativeShift( new float[]{ result.getOffset( 0 ), result.getOffset( 1 ), result.getOffset( 2 ) } );
-	            				
-	            				pair.setCrossCorrelation( result.getCrossCorrelation() );
-	
-	            				LOGINFO( pair.getImagePlus1().getTitle() + "[" + pair.getTimePoint1() + "]" + " -> " + pair.getImagePlus2().getTitle() + "[" + pair.getTimePoint2() + "]" + ": " +
-	            						Util.printCoordinates( result.getOffset() ) + " correlation (R)=" + result.getCrossCorrelation() + " (" + (TimeHelper::milliseconds() - start) + " ms)");
-	                    	}
-	                    }
-	                }
-	            });
+			group.wait();
+			
+			if ( failed )
+				LOGERR( "Collection stitching failed" );
 	        
-	        long time = TimeHelper::milliseconds();
-	        SimpleMultiThreading.startAndJoin( threads );
+	        // the scratch buffers of the pairs are not needed anymore
+	        LOGINFO( "Scratch buffers: " + ScratchPool::global().getCachedBytes() / ( 1024 * 1024 ) + " MB cached, " + (int)( 100 * ScratchPool::global().getReuseRatio() ) + "% reused." );
+	        ScratchPool::global().releaseAll();
 	        
 	        // get the positions of all tiles
 			optimized = GlobalOptimization.optimize( pairs, pairs.get( 0 ).getTile1(), params );
@@ -144,6 +132,95 @@ class CollectionStitchingImgLib
 		return optimized;
 	}
 
+	/**
+	 * Computes the relative shift of one pair, or reads it from the journal if the same pair
+	 * was computed before, and journals new results.
+	 * 
+	 * @return false if the pairwise stitching failed
+	 */
+	public static boolean computePair( ComparePair pair, StitchingParameters params, RegistrationJournal& journal )
+	{
+		long start = TimeHelper::milliseconds();
+		
+		// where do we approximately overlap?
+		Roi roi1 = getROI( pair.getTile1().getElement(), pair.getTile2().getElement() );
+		Roi roi2 = getROI( pair.getTile2().getElement(), pair.getTile1().getElement() );
+		
+		uint64_t key = RegistrationJournal::key( describePair( pair, roi1, roi2, params ) );
+		RegistrationJournal::Entry entry;
+		
+		if ( journal.lookup( key, entry ) && entry.numDimensions == params.dimensionality )
+		{
+			pair.setRelativeShift( params.dimensionality == 2 ? new float[]{ entry.shift[ 0 ], entry.shift[ 1 ] } : new float[]{ entry.shift[ 0 ], entry.shift[ 1 ], entry.shift[ 2 ] } );
+			pair.setCrossCorrelation( entry.crossCorrelation );
+			pair.setPhaseCorrelation( entry.phaseCorrelation );
+			
+			LOGINFO( pair.getImagePlus1().getTitle() + "[" + pair.getTimePoint1() + "]" + " -> " + pair.getImagePlus2().getTitle() + "[" + pair.getTimePoint2() + "]" <<
+					LogField( "shift", Util.printCoordinates( pair.getRelativeShift() ) ) << LogField( "R", entry.crossCorrelation ) << LogField( "source", "journal" ) );
+			return true;
+		}
+		
+		PairWiseStitchingResult result = PairWiseStitchingImgLib.stitchPairwise( pair.getImagePlus1(), pair.getImagePlus2(), roi1, roi2, pair.getTimePoint1(), pair.getTimePoint2(), params );
+		
+		if ( result == null )
+			return false;
+		
+		if ( params.dimensionality == 2 )
+			pair.setRelativeShift( new float[]{ result.getOffset( 0 ), result.getOffset( 1 ) } );
+		else
+			pair.setRelativeShift( new float[]{ result.getOffset( 0 ), result.getOffset( 1 ), result.getOffset( 2 ) } );
+		
+		pair.setCrossCorrelation( result.getCrossCorrelation() );
+		pair.setPhaseCorrelation( result.getPhaseCorrelation() );
+		
+		entry.numDimensions = params.dimensionality;
+		for ( int d = 0; d < params.dimensionality; ++d )
+			entry.shift[ d ] = result.getOffset( d );
+		entry.crossCorrelation = result.getCrossCorrelation();
+		entry.phaseCorrelation = result.getPhaseCorrelation();
+		journal.append( key, entry );
+		
+		LOGINFO( pair.getImagePlus1().getTitle() + "[" + pair.getTimePoint1() + "]" + " -> " + pair.getImagePlus2().getTitle() + "[" + pair.getTimePoint2() + "]" <<
+				LogField( "shift", Util.printCoordinates( result.getOffset() ) ) << LogField( "R", result.getCrossCorrelation() ) << LogField( "ms", TimeHelper::milliseconds() - start ) );
+		
+		return true;
+	}
+
+	/**
+	 * Everything the result of a pair depends on: the identity of both tile files (path, size,
+	 * modification time), the rois, timepoints and channels, and the registration parameters.
+	 * Fusion parameters are not part of it, re-fusing reuses the registration.
+	 */
+	protected static string describePair( ComparePair pair, Roi roi1, Roi roi2, StitchingParameters params )
+	{
+		std::ostringstream description;
+		
+		description << tileIdentity( pair.getTile1() ) << '|' << pair.getTimePoint1() << '|' << describeRoi( roi1 ) << '|'
+				<< tileIdentity( pair.getTile2() ) << '|' << pair.getTimePoint2() << '|' << describeRoi( roi2 ) << '|'
+				<< params.channel1 << '|' << params.channel2 << '|' << params.dimensionality << '|'
+				<< params.checkPeaks << '|' << params.subpixelAccuracy << '|' << params.bVirtual;
+		
+		return description.str();
+	}
+
+	protected static string tileIdentity( ImagePlusTimePoint tile )
+	{
+		// series opened from one file (multi-series stitching) are told apart by their index
+		if ( tile.getElement().getFile() == null )
+			return tile.getImagePlus().getTitle() + "#" + tile.getElement().getIndex();
+		
+		return RegistrationJournal::fileIdentity( tile.getElement().getFile().getAbsolutePath() ) + "#" + tile.getElement().getIndex();
+	}
+
+	protected static string describeRoi( Roi roi )
+	{
+		if ( roi == null )
+			return "all";
+		
+		Rectangle r = roi.getBounds();
+		return to_string( r.x ) + "," + r.y + "," + r.width + "," + r.height;
+	}
+
 	protected static Roi getROI( ImageCollectionElement e1, ImageCollectionElement e2 )
 	{
 		int start[] = new int[ 2 ], end[] = new int[ 2 ];
@@ -176,6 +253,21 @@ class CollectionStitchingImgLib
 		return new Roi( new Rectangle( start[ 0 ], start[ 1 ], end[ 0 ] - start[ 0 ], end[ 1 ] - start[ 1 ] ) );
 	}
 
+	/** @return true if the approximate layout of the two elements overlaps in all dimensions */
+	public static boolean overlaps( ImageCollectionElement e1, ImageCollectionElement e2, int dimensionality )
+	{
+		for ( int d = 0; d < dimensionality; ++d )
+		{
+			if ( !( ( e2.offset[ d ] >= e1.offset[ d ] && e2.offset[ d ] <= e1.offset[ d ] + e1.size[ d ] ) || 
+				    ( e2.offset[ d ] + e2.size[ d ] >= e1.offset[ d ] && e2.offset[ d ] + e2.size[ d ] <= e1.offset[ d ] + e1.size[ d ] ) ||
+				    ( e2.offset[ d ] <= e1.offset[ d ] && e2.offset[ d ] >= e1.offset[ d ] + e1.size[ d ] ) 
+			   )  )
+				return false;
+		}
+		
+		return true;
+	}
+
 	protected static Vector< ComparePair > findOverlappingTiles( ArrayList< ImageCollectionElement > elements, StitchingParameters params )
 	{		
 		for ( ImageCollectionElement element : elements )
@@ -216,18 +308,7 @@ class CollectionStitchingImgLib
 				ImageCollectionElement e1 = elements.get( i );
 				ImageCollectionElement e2 = elements.get( j );
 				
-				boolean overlapping = true;
-				
-				for ( int d = 0; d < params.dimensionality; ++d )
-				{
-					if ( !( ( e2.offset[ d ] >= e1.offset[ d ] && e2.offset[ d ] <= e1.offset[ d ] + e1.size[ d ] ) || 
-						    ( e2.offset[ d ] + e2.size[ d ] >= e1.offset[ d ] && e2.offset[ d ] + e2.size[ d ] <= e1.offset[ d ] + e1.size[ d ] ) ||
-						    ( e2.offset[ d ] <= e1.offset[ d ] && e2.offset[ d ] >= e1.offset[ d ] + e1.size[ d ] ) 
-					   )  )
-									overlapping = false;
-				}
-				
-				if ( overlapping )
+				if ( overlaps( e1, e2, params.dimensionality ) )
 				{
 					//ImagePlusTimePoint impA = new ImagePlusTimePoint( e1.open(), e1.getIndex(), 1, e1.getModel().copy(), e1 );
 					//ImagePlusTimePoint impB = new ImagePlusTimePoint( e2.open(), e2.getIndex(), 1, e2.getModel().copy(), e2 );
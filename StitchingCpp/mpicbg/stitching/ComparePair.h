@@ -27,7 +27,7 @@ import mpicbg.models.Model;
 class ComparePair 
 {
 	ImagePlusTimePoint impA, impB;
-	float crossCorrelation;
+	float crossCorrelation, phaseCorrelation;
 	boolean validOverlap;
 	
 	// the local shift of impB relative to impA 
@@ -55,6 +55,9 @@ class ComparePair
 	public void setCrossCorrelation( float r ) { this.crossCorrelation = r; }
 	public float getCrossCorrelation() { return crossCorrelation; }
 
+	public void setPhaseCorrelation( float phaseCorrelation ) { this.phaseCorrelation = phaseCorrelation; }
+	public float getPhaseCorrelation() { return phaseCorrelation; }
+
 	public void setRelativeShift( float[] relativeShift ) { this.relativeShift = relativeShift; }
 	public float[] getRelativeShift() { return relativeShift; }
 	
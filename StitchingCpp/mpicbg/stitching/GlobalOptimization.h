@@ -20,6 +20,8 @@
  * #L%
  */
 // package mpicbg.stitching;
+#include "header.h"
+#include "tools/trace.h"
 
 import ij.IJ;
 
@@ -46,6 +48,8 @@ class GlobalOptimization
 		TileConfigurationStitching tc;
 		do
 		{
+			TraceSpan span( "global optimization" );
+
 			redo = false;
 			ArrayList< Tile< ? > > tiles = new ArrayList< Tile< ? > >();
 			
@@ -163,8 +167,8 @@ class GlobalOptimization
 
 					ComparePair pair = ((PointMatchStitching)worstMatch).getPair();
 					
-					LOGINFO( "Identified link between " + pair.getImagePlus1().getTitle() + "[" + pair.getTile1().getTimePoint() + "] and " + 
-							pair.getImagePlus2().getTitle() + "[" + pair.getTile2().getTimePoint() + "] (R=" + pair.getCrossCorrelation() +") to be bad. Reoptimizing.");
+					LOGINFO( "Identified link between " + pair.getTile1().getTitle() + "[" + pair.getTile1().getTimePoint() + "] and " + 
+							pair.getTile2().getTitle() + "[" + pair.getTile2().getTimePoint() + "] (R=" + pair.getCrossCorrelation() +") to be bad. Reoptimizing.");
 					
 					((PointMatchStitching)worstMatch).getPair().setIsValidOverlap( false );
 					redo = true;
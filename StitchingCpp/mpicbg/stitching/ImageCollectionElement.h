@@ -20,6 +20,9 @@
  * #L%
  */
 // package mpicbg.stitching;
+#include "header.h"
+#include "tools/memoryledger.h"
+#include "tools/trace.h"
 
 //import ij.IJ;
 //import ij.ImagePlus;
@@ -47,6 +50,9 @@ class ImageCollectionElement
 	
 	//2d or 3d size if image
 	vector<int> size;
+
+	// bytes of the loaded image charged to MemoryPhase::tiles, 0 for a virtual one
+	long long loadedBytes = 0;
 	
 public:
 	ImageCollectionElement(File file, int index )
@@ -99,11 +105,17 @@ public:
 		{
 			return imp;
 		}
+
+		TraceSpan span( "open", "io" );
+
 		// TODO: Unify this image loading mechanism with the one in
 		// plugin/Stitching_Grid.java. Otherwise changes to how images
 		// are loaded must be made in multiple places in the code.
 		if ( imp != nullptr)
 			imp->close();
+
+		MemoryLedger::global().free( MemoryPhase::tiles, loadedBytes );
+		loadedBytes = 0;
 		
 		this->bVirtual = bVirtual;
 		
@@ -168,6 +180,13 @@ public:
 			}
 
 			this->imp = imp[ 0 ];
+
+			if ( !bVirtual )
+			{
+				loadedBytes = (long long)imp[ 0 ].getWidth() * imp[ 0 ].getHeight() * imp[ 0 ].getStackSize() * imp[ 0 ].getBytesPerPixel();
+				MemoryLedger::global().allocate( MemoryPhase::tiles, loadedBytes );
+			}
+
 			return this->imp;
 		} 
 		catch ( exception e ) 
@@ -179,7 +198,11 @@ public:
 
 	void close() 
 	{
-		imp->close();
+		if ( imp != nullptr )
+			imp->close();
 		imp = bVirtual;
+
+		MemoryLedger::global().free( MemoryPhase::tiles, loadedBytes );
+		loadedBytes = 0;
 	}
 };
@@ -51,8 +51,18 @@ class ImagePlusTimePoint : public Tile : public Comparable< ImagePlusTimePoint >
 	
 	public int getImpId() { return impId; }
 	public ImagePlus getImagePlus() { return imp; }
+	public void setImagePlus( ImagePlus imp ) { this.imp = imp; }
 	public int getTimePoint() { return timePoint; }
 	public ImageCollectionElement getElement() { return element; }
+	
+	/** @return the title of the image, or the name of the file of the element if the image is not open */
+	public String getTitle()
+	{
+		if ( imp == null && element != null && element.getFile() != null )
+			return element.getFile().getName();
+		
+		return imp.getTitle();
+	}
 
 	@Override
 	public int compareTo( ImagePlusTimePoint o ) 
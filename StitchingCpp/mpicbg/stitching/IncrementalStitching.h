@@ -0,0 +1,477 @@
+/*
+ * #%L
+ * Fiji distribution of ImageJ for the life sciences.
+ * %%
+ * Copyright (C) 2007 - 2022 Fiji developers.
+ * %%
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/gpl-2.0.html>.
+ * #L%
+ */
+// package mpicbg.stitching;
+#include "header.h"
+#include "tools/threadpool.h"
+#include "RegistrationJournal.h"
+#include "CollectionStitchingImgLib.h"
+#include "TileGrid.h"
+#include "mpicbg/stitching/fusion/Fusion.h"
+#include <unordered_set>
+
+import java.util.ArrayList;
+import java.util.Vector;
+
+import mpicbg.models.InvertibleBoundable;
+import mpicbg.models.Point;
+import mpicbg.models.Tile;
+import mpicbg.models.TranslationModel2D;
+import mpicbg.models.TranslationModel3D;
+
+/**
+ * Stitching of a mosaic that grows one tile at a time, e.g. during acquisition. The
+ * work per added tile does not depend on the size of the mosaic:
+ *
+ * - the overlapping tiles are looked up in a grid of buckets over the approximate
+ *   layout instead of testing all tiles,
+ * - only the pairs of the new tile are registered (and journaled), only the tiles of
+ *   these pairs are open meanwhile,
+ * - the new tile starts at the position its neighbors predict and only the new tile and
+ *   its direct neighbors are optimized, their neighbors are kept fixed, the rest of the
+ *   mosaic keeps the previous solution,
+ * - only the output chunks ({@link Fusion#fuseChunkFiles}) that the moved tiles covered
+ *   before or cover now are fused again, from the tiles that a second grid over the
+ *   current positions finds in these chunks, opened virtually.
+ *
+ * A full {@link CollectionStitchingImgLib#stitchCollection} of all tiles gives the
+ * globally optimal result once the acquisition is done.
+ */
+class IncrementalStitching
+{
+	StitchingParameters params;
+	String outputDirectory;
+
+	ArrayList< ImagePlusTimePoint > tiles = new ArrayList< ImagePlusTimePoint >();
+	Vector< ComparePair > pairs = new Vector< ComparePair >();
+
+	// pairs of each tile, indexed like tiles, and the tiles of each pair, indexed like pairs
+	vector< vector< int > > pairsOfTile;
+	vector< std::pair< int, int > > tilesOfPair;
+
+	// the tiles by their approximate layout and by their current position, the buckets are as
+	// large as the first tile
+	unique_ptr< TileGrid > layout, placed;
+
+	RegistrationJournal journal;
+
+	/**
+	 * @param outputDirectory - where the chunk files are written, empty to only register
+	 */
+	public IncrementalStitching( StitchingParameters params, String outputDirectory )
+	{
+		this.params = params;
+		this.outputDirectory = outputDirectory;
+
+		if ( !params.registrationJournal.empty() )
+			journal.open( params.registrationJournal );
+	}
+
+	public ArrayList< ImagePlusTimePoint > getTiles() { return tiles; }
+	public Vector< ComparePair > getPairs() { return pairs; }
+
+	/**
+	 * Registers a new tile against the tiles it overlaps, places it, updates the positions
+	 * of its neighbors and fuses the chunks that changed. Nothing changes if the tile
+	 * cannot be registered.
+	 *
+	 * @return the tile with its model (its image is closed again), null if it could not be
+	 * opened or registered
+	 */
+	public ImagePlusTimePoint addTile( ImageCollectionElement element )
+	{
+		long time = TimeHelper::milliseconds();
+		int n = params.dimensionality;
+
+		ImagePlus imp = element.open( params.bVirtual );
+
+		if ( imp == null )
+			return null;
+
+		if ( n == 2 )
+			element.setSize( { imp.getWidth(), imp.getHeight() } );
+		else
+			element.setSize( { imp.getWidth(), imp.getHeight(), imp.getNSlices() } );
+
+		String title = imp.getTitle();
+		ImagePlusTimePoint tile = new ImagePlusTimePoint( imp, element.getIndex(), 1, element.getModel(), element );
+		int index = tiles.size();
+
+		if ( layout == nullptr )
+		{
+			double[] bucketSize = new double[ n ];
+
+			for ( int d = 0; d < n; ++d )
+				bucketSize[ d ] = element.getDimension( d );
+
+			layout.reset( new TileGrid( n, bucketSize ) );
+			placed.reset( new TileGrid( n, bucketSize ) );
+		}
+
+		double[] min = new double[ n ];
+		double[] max = new double[ n ];
+
+		for ( int d = 0; d < n; ++d )
+		{
+			min[ d ] = element.getOffset( d );
+			max[ d ] = element.getOffset( d ) + element.getDimension( d );
+		}
+
+		// the pairs with all overlapping tiles, found in the buckets the new tile spans
+		Vector< ComparePair > newPairs = new Vector< ComparePair >();
+		vector< int > partners;
+
+		for ( int other : layout->find( min, max ) )
+		{
+			if ( CollectionStitchingImgLib.overlaps( tiles.get( other ).getElement(), element, n ) )
+			{
+				partners.push_back( other );
+				newPairs.add( new ComparePair( tiles.get( other ), tile ) );
+			}
+		}
+
+		// register the new pairs on the pool, the mosaic is only changed once all of them are done
+		ThreadPool& pool = ThreadPool::global();
+		ThreadPool::TaskGroup group;
+		atomic< bool > failed( false );
+
+		for ( int other : partners )
+			if ( !open( tiles.get( other ) ) )
+				failed = true;
+
+		for ( int k = 0; k < newPairs.size(); ++k )
+			pool.submit( group, [&, k]()
+			{
+				if ( !failed && !CollectionStitchingImgLib.computePair( newPairs.get( k ), params, journal ) )
+					failed = true;
+			});
+
+		group.wait();
+
+		for ( int other : partners )
+			close( tiles.get( other ) );
+
+		close( tile );
+
+		if ( failed )
+		{
+			LOGERR( "Registration of " + title + " failed." );
+			return null;
+		}
+
+		tiles.add( tile );
+		pairsOfTile.push_back( vector< int >() );
+		layout->set( index, min, max );
+
+		for ( int k = 0; k < newPairs.size(); ++k )
+		{
+			int p = pairs.size();
+
+			pairs.add( newPairs.get( k ) );
+			tilesOfPair.push_back( { partners[ k ], index } );
+			pairsOfTile[ index ].push_back( p );
+			pairsOfTile[ partners[ k ] ].push_back( p );
+		}
+
+		// which tiles move, and the area they cover before and after
+		vector< int > moved = neighborsOf( index );
+		moved.push_back( index );
+
+		double[] dirtyMin = new double[ n ];
+		double[] dirtyMax = new double[ n ];
+
+		for ( int d = 0; d < n; ++d )
+		{
+			dirtyMin[ d ] = Double.MAX_VALUE;
+			dirtyMax[ d ] = -Double.MAX_VALUE;
+		}
+
+		for ( int t : moved )
+			if ( t != index )
+				extend( dirtyMin, dirtyMax, tiles.get( t ) );
+
+		warmStart( index );
+		optimizeLocally( index, moved );
+
+		for ( int t : moved )
+		{
+			extend( dirtyMin, dirtyMax, tiles.get( t ) );
+			place( t );
+		}
+
+		LOGINFO( "Added " + title + ": " + newPairs.size() + " pairs, " + moved.size() + " tiles moved (" + ( TimeHelper::milliseconds() - time ) + " ms)" );
+
+		if ( !outputDirectory.empty() && !fuse( dirtyMin, dirtyMax ) )
+			LOGERR( "Fusing the chunks of " + title + " failed." );
+
+		return tile;
+	}
+
+	protected boolean open( ImagePlusTimePoint tile )
+	{
+		if ( tile.getImagePlus() == null )
+			tile.setImagePlus( tile.getElement().open( params.bVirtual ) );
+
+		return tile.getImagePlus() != null;
+	}
+
+	protected void close( ImagePlusTimePoint tile )
+	{
+		if ( tile.getImagePlus() != null )
+			tile.getElement().close();
+
+		tile.setImagePlus( null );
+	}
+
+	/** Lists a tile at its current position in the grid the fusion looks up tiles in */
+	protected void place( int index )
+	{
+		int n = params.dimensionality;
+		double[] min = new double[ n ];
+		double[] max = new double[ n ];
+
+		for ( int d = 0; d < n; ++d )
+		{
+			min[ d ] = Double.MAX_VALUE;
+			max[ d ] = -Double.MAX_VALUE;
+		}
+
+		extend( min, max, tiles.get( index ) );
+		placed->set( index, min, max );
+	}
+
+	/** @return the tiles that share a valid pair with a tile */
+	protected vector< int > neighborsOf( int index )
+	{
+		vector< int > neighbors;
+
+		for ( int p : pairsOfTile[ index ] )
+		{
+			if ( pairs.get( p ).getCrossCorrelation() < params.regThreshold )
+				continue;
+
+			neighbors.push_back( tilesOfPair[ p ].first == index ? tilesOfPair[ p ].second : tilesOfPair[ p ].first );
+		}
+
+		return neighbors;
+	}
+
+	/**
+	 * Puts the new tile where its best correlated neighbor says it is (the tiles of a pair are
+	 * related by t2 = t1 + shift), or at its approximate position if it has none.
+	 */
+	protected void warmStart( int index )
+	{
+		ImagePlusTimePoint tile = tiles.get( index );
+		int n = params.dimensionality;
+		double[] position = new double[ n ];
+		float best = -Float.MAX_VALUE;
+
+		for ( int d = 0; d < n; ++d )
+			position[ d ] = tile.getElement().getOffset( d );
+
+		for ( int p : pairsOfTile[ index ] )
+		{
+			ComparePair pair = pairs.get( p );
+
+			if ( pair.getCrossCorrelation() < params.regThreshold || pair.getCrossCorrelation() <= best )
+				continue;
+
+			best = pair.getCrossCorrelation();
+
+			// the new tile is always the second one of its pairs
+			double[] neighbor = new double[ n ];
+			((InvertibleBoundable)pair.getTile1().getModel()).applyInPlace( neighbor );
+
+			for ( int d = 0; d < n; ++d )
+				position[ d ] = neighbor[ d ] + pair.getRelativeShift()[ d ];
+		}
+
+		if ( n == 2 )
+			((TranslationModel2D)tile.getModel()).set( position[ 0 ], position[ 1 ] );
+		else
+			((TranslationModel3D)tile.getModel()).set( position[ 0 ], position[ 1 ], position[ 2 ] );
+	}
+
+	/**
+	 * Optimizes the new tile and its neighbors with all their valid pairs, tiles outside of
+	 * that window that they are connected to stay fixed. There is no prealignment, the
+	 * models start from the previous solution.
+	 */
+	protected void optimizeLocally( int index, vector< int > moved )
+	{
+		unordered_set< int > free( moved.begin(), moved.end() );
+		unordered_set< int > fixed;
+		ArrayList< Tile< ? > > window = new ArrayList< Tile< ? > >();
+
+		for ( int t : moved )
+			for ( int other : neighborsOf( t ) )
+				if ( !free.count( other ) )
+					fixed.insert( other );
+
+		for ( int t : free )
+			window.add( tiles.get( t ) );
+
+		for ( int t : fixed )
+			window.add( tiles.get( t ) );
+
+		for ( Tile< ? > t : window )
+		{
+			t.getConnectedTiles().clear();
+			t.getMatches().clear();
+		}
+
+		// every pair of the window once, a pair between two fixed tiles does not matter
+		unordered_set< int > added;
+
+		for ( int t : free )
+			for ( int p : pairsOfTile[ t ] )
+			{
+				ComparePair pair = pairs.get( p );
+				int t1 = tilesOfPair[ p ].first;
+				int t2 = tilesOfPair[ p ].second;
+
+				if ( pair.getCrossCorrelation() < params.regThreshold || !added.insert( p ).second || !( ( free.count( t1 ) || fixed.count( t1 ) ) && ( free.count( t2 ) || fixed.count( t2 ) ) ) )
+					continue;
+
+				addMatches( pair );
+			}
+
+		if ( fixed.empty() && free.size() < 2 )
+			return;
+
+		TileConfigurationStitching tc = new TileConfigurationStitching();
+		tc.addTiles( window );
+
+		if ( fixed.empty() )
+			tc.fixTile( tiles.get( moved.front() ) );
+		else
+			for ( int t : fixed )
+				tc.fixTile( tiles.get( t ) );
+
+		try
+		{
+			tc.optimize( 10, 1000, 200 );
+		}
+		catch ( Exception e )
+		{
+			LOGERR( "Cannot compute local optimization: " + e );
+		}
+	}
+
+	/** The same point matches as {@link GlobalOptimization#optimize} */
+	protected void addMatches( ComparePair pair )
+	{
+		Tile t1 = pair.getTile1();
+		Tile t2 = pair.getTile2();
+		float[] shift = pair.getRelativeShift();
+
+		Point p1, p2;
+
+		if ( params.dimensionality == 3 )
+		{
+			p1 = new Point( new double[]{ 0, 0, 0 } );
+			p2 = new Point( new double[]{ -shift[ 0 ], -shift[ 1 ], GlobalOptimization.ignoreZ ? 0 : -shift[ 2 ] } );
+		}
+		else
+		{
+			p1 = new Point( new double[]{ 0, 0 } );
+			p2 = new Point( new double[]{ -shift[ 0 ], -shift[ 1 ] } );
+		}
+
+		t1.addMatch( new PointMatchStitching( p1, p2, pair.getCrossCorrelation(), pair ) );
+		t2.addMatch( new PointMatchStitching( p2, p1, pair.getCrossCorrelation(), pair ) );
+		t1.addConnectedTile( t2 );
+		t2.addConnectedTile( t1 );
+	}
+
+	/** Grows [min, max] by the bounding box of a tile at its current position */
+	protected void extend( double[] min, double[] max, ImagePlusTimePoint tile )
+	{
+		int n = params.dimensionality;
+		double[] position = new double[ n ];
+		((InvertibleBoundable)tile.getModel()).applyInPlace( position );
+
+		for ( int d = 0; d < n; ++d )
+		{
+			min[ d ] = Math.min( min[ d ], position[ d ] );
+			max[ d ] = Math.max( max[ d ], position[ d ] + tile.getElement().getDimension( d ) );
+		}
+	}
+
+	/**
+	 * Fuses the chunks that intersect [dirtyMin, dirtyMax] from the tiles that intersect these
+	 * chunks, the tiles are opened virtually and closed again.
+	 */
+	protected boolean fuse( double[] dirtyMin, double[] dirtyMax )
+	{
+		int n = params.dimensionality;
+		int[] chunkExtent = new int[] { params.fusionChunkSize, params.fusionChunkSize, n == 2 ? 1 : params.fusionChunkDepth };
+		double[] chunksMin = new double[ n ];
+		double[] chunksMax = new double[ n ];
+
+		for ( int d = 0; d < n; ++d )
+		{
+			chunksMin[ d ] = Math.floor( dirtyMin[ d ] / chunkExtent[ d ] ) * chunkExtent[ d ];
+			chunksMax[ d ] = ( Math.floor( dirtyMax[ d ] / chunkExtent[ d ] ) + 1 ) * chunkExtent[ d ];
+		}
+
+		vector< int > covering = placed->find( chunksMin, chunksMax );
+		ArrayList< ImagePlus > images = new ArrayList< ImagePlus >();
+		ArrayList< InvertibleBoundable > models = new ArrayList< InvertibleBoundable >();
+		boolean written = true;
+
+		for ( int t : covering )
+		{
+			ImagePlusTimePoint tile = tiles.get( t );
+			ImagePlus imp = tile.getElement().open( true );
+
+			if ( imp == null )
+			{
+				written = false;
+				break;
+			}
+
+			images.add( imp );
+			models.add( (InvertibleBoundable)tile.getModel() );
+		}
+
+		if ( written )
+		{
+			ImagePlus first = images.get( 0 );
+
+			if ( first.getType() == ImagePlus.GRAY32 )
+				written = Fusion.fuseChunkFiles( FloatType(), images, models, n, params.subpixelAccuracy, params.fusionMethod, outputDirectory, false,
+						params.fusionChunkSize, params.fusionChunkDepth, dirtyMin, dirtyMax, params.tiffCompression, params.tiffPredictor );
+			else if ( first.getType() == ImagePlus.GRAY16 )
+				written = Fusion.fuseChunkFiles( UnsignedShortType(), images, models, n, params.subpixelAccuracy, params.fusionMethod, outputDirectory, false,
+						params.fusionChunkSize, params.fusionChunkDepth, dirtyMin, dirtyMax, params.tiffCompression, params.tiffPredictor );
+			else
+				written = Fusion.fuseChunkFiles( UnsignedByteType(), images, models, n, params.subpixelAccuracy, params.fusionMethod, outputDirectory, false,
+						params.fusionChunkSize, params.fusionChunkDepth, dirtyMin, dirtyMax, params.tiffCompression, params.tiffPredictor );
+		}
+
+		for ( int i = 0; i < images.size(); ++i )
+			tiles.get( covering[ i ] ).getElement().close();
+
+		return written;
+	}
+};
\ No newline at end of file
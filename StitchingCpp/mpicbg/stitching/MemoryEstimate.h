@@ -0,0 +1,183 @@
+/*
+ * #%L
+ * Fiji distribution of ImageJ for the life sciences.
+ * %%
+ * Copyright (C) 2007 - 2022 Fiji developers.
+ * %%
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/gpl-2.0.html>.
+ * #L%
+ */
+// package mpicbg.stitching;
+#include "header.h"
+#include "tools/memoryledger.h"
+#include "tools/threadpool.h"
+#include "ImageCollectionElement.h"
+#include "StitchingParameters.h"
+#include "mpicbg/stitching/fusion/Fusion.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <sstream>
+
+import java.util.ArrayList;
+
+/**
+ * The memory a run will need per {@link MemoryPhase}, predicted from the sizes and the
+ * approximate layout of the tiles before anything is loaded (the dry run of
+ * {@link Stitching_Grid}).
+ *
+ * The prediction is an upper bound of what the {@link MemoryLedger} tracks: every pair
+ * the registration runs at once is assumed to copy two rois as large as the largest tile,
+ * and the FFTs are padded to powers of two. Registration and fusion do not overlap in time, only
+ * the loaded tiles are held during both.
+ */
+class MemoryEstimate
+{
+public:
+	long long bytes[ (int)MemoryPhase::count ] = {};
+	long long peak = 0;
+
+	/**
+	 * @param elements - the tiles, opened (virtually) so their sizes are known, with their approximate offsets
+	 * @param numChannels - channels of every tile
+	 * @param numTimePoints - timepoints of every tile
+	 * @param bytesPerPixel - of the largest pixel type of the tiles, which is also the type of the fused image
+	 */
+	public static MemoryEstimate predict( ArrayList< ImageCollectionElement > elements, StitchingParameters params, int numChannels, int numTimePoints, int bytesPerPixel )
+	{
+		MemoryEstimate estimate;
+		int n = params.dimensionality;
+		int numThreads = ThreadPool::global().numThreads();
+
+		double[] min = new double[ n ];
+		double[] max = new double[ n ];
+		long long[] largest = new long long[ n ];
+
+		for ( int d = 0; d < n; ++d )
+		{
+			min[ d ] = Double.MAX_VALUE;
+			max[ d ] = -Double.MAX_VALUE;
+		}
+
+		for ( ImageCollectionElement element : elements )
+		{
+			long long pixels = 1;
+
+			for ( int d = 0; d < n; ++d )
+			{
+				pixels *= element.getDimension( d );
+				largest[ d ] = std::max( largest[ d ], (long long)element.getDimension( d ) );
+				min[ d ] = std::min( min[ d ], (double)element.getOffset( d ) );
+				max[ d ] = std::max( max[ d ], (double)element.getOffset( d ) + element.getDimension( d ) );
+			}
+
+			if ( !params.bVirtual )
+				estimate.bytes[ (int)MemoryPhase::tiles ] += pixels * numChannels * numTimePoints * bytesPerPixel;
+		}
+
+		// registration, one pair per pool thread at a time, a single pair if memory is to be saved
+		long long roiPixels = 1, fftPixels = 1;
+
+		for ( int d = 0; d < n; ++d )
+		{
+			roiPixels *= largest[ d ];
+			fftPixels *= nextPowerOfTwo( largest[ d ] );
+		}
+
+		int concurrentPairs = params.cpuMemChoice == 0 ? 1 : std::max( 1, std::min( numThreads, (int)elements.size() - 1 ) );
+
+		// two float rois; two padded float images, their complex spectra (half along x) and the float phase correlation matrix
+		estimate.bytes[ (int)MemoryPhase::pairRoi ] = concurrentPairs * 2 * roiPixels * 4;
+		estimate.bytes[ (int)MemoryPhase::fft ] = concurrentPairs * fftPixels * ( 2 * 4 + 2 * 4 + 4 );
+
+		// fusion, the size of the fused image is the bounding box of the layout
+		long long plane = 1, frame;
+
+		for ( int d = 0; d < 2; ++d )
+			plane *= (long long)std::ceil( max[ d ] - min[ d ] ) + ( params.subpixelAccuracy ? 1 : 0 );
+
+		plane *= bytesPerPixel;
+		frame = plane * numChannels * ( n == 3 ? (long long)std::ceil( max[ 2 ] - min[ 2 ] ) + ( params.subpixelAccuracy ? 1 : 0 ) : 1 );
+
+		if ( params.outputVariant == 0 )
+		{
+			// one timepoint is fused at a time, its planes move into the stack of all timepoints
+			estimate.bytes[ (int)MemoryPhase::fusionOutput ] = frame;
+			estimate.bytes[ (int)MemoryPhase::imageStack ] = frame * numTimePoints;
+		}
+		else if ( params.outputVariant == 1 )
+		{
+			// a 3d fusion keeps up to the write queue of slices in flight (see Fusion#writeBlock)
+			long long queueSize = Fusion.writeQueueSize > 0 ? Fusion.writeQueueSize : 2 * numThreads;
+			long long numSlices = n == 3 ? (long long)std::ceil( max[ 2 ] - min[ 2 ] ) + ( params.subpixelAccuracy ? 1 : 0 ) : 1;
+
+			estimate.bytes[ (int)MemoryPhase::fusionOutput ] = plane * std::min( queueSize, numSlices );
+		}
+		else if ( params.outputVariant == 3 )
+		{
+			long long budget = (long long)params.fusionMemoryBudget << 20;
+			long long inFlight = frame * std::min( numThreads, numTimePoints );
+
+			if ( budget > 0 )
+				inFlight = std::max( frame, std::min( budget / frame * frame, inFlight ) );
+
+			estimate.bytes[ (int)MemoryPhase::fusionOutput ] = inFlight;
+		}
+		else
+		{
+			// chunks, one per thread
+			long long chunk = (long long)params.fusionChunkSize * params.fusionChunkSize * ( n == 3 ? params.fusionChunkDepth : 1 );
+			estimate.bytes[ (int)MemoryPhase::fusionOutput ] = numThreads * chunk * numChannels * bytesPerPixel;
+		}
+
+		long long registration = estimate.bytes[ (int)MemoryPhase::pairRoi ] + estimate.bytes[ (int)MemoryPhase::fft ];
+		long long fusion = params.outputVariant == 0 ? estimate.bytes[ (int)MemoryPhase::imageStack ] : estimate.bytes[ (int)MemoryPhase::fusionOutput ];
+
+		estimate.peak = estimate.bytes[ (int)MemoryPhase::tiles ] + std::max( registration, fusion );
+
+		return estimate;
+	}
+
+	string toString()
+	{
+		std::ostringstream table;
+		char line[ 128 ];
+
+		snprintf( line, sizeof( line ), "%-16s %12s\n", "memory", "predicted MB" );
+		table << line;
+
+		for ( int p = 1; p < (int)MemoryPhase::count; ++p )
+		{
+			snprintf( line, sizeof( line ), "%-16s %12.1f\n", MemoryLedger::name( (MemoryPhase)p ), bytes[ p ] / 1048576.0 );
+			table << line;
+		}
+
+		snprintf( line, sizeof( line ), "%-16s %12.1f\n", "peak", peak / 1048576.0 );
+		table << line;
+
+		return table.str();
+	}
+
+protected:
+	static long long nextPowerOfTwo( long long size )
+	{
+		long long power = 1;
+
+		while ( power < size )
+			power <<= 1;
+
+		return power;
+	}
+};
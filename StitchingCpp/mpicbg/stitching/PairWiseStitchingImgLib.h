@@ -20,6 +20,9 @@
  * #L%
  */
 // package mpicbg.stitching;
+#include "header.h"
+#include "tools/memoryledger.h"
+#include "tools/trace.h"
 
 import fiji.stacks.Hyperstack_rearranger;
 import ij.IJ;
@@ -228,12 +231,20 @@ class PairWiseStitchingImgLib
 			phaseCorr.setKeepPhaseCorrelationMatrix( true );
 		
 		phaseCorr.setComputeFFTinParalell( true );
-		if ( !phaseCorr.process() )
+
 		{
-			LOGERR( "Could not compute phase correlation: " + phaseCorr.getErrorMessage() );
-			return null;
+			TraceSpan span( "fft" );
+			MemoryScope scope( MemoryPhase::fft );
+
+			if ( !phaseCorr.process() )
+			{
+				LOGERR( "Could not compute phase correlation: " + phaseCorr.getErrorMessage() );
+				return null;
+			}
 		}
 
+		TraceSpan span( "peak check" );
+
 		// result
 		PhaseCorrelationPeak pcp = phaseCorr.getShift();
 		float[] shift = new float[ img1.getNumDimensions() ];
@@ -289,6 +300,9 @@ class PairWiseStitchingImgLib
 	 */
 	public static < T : public RealType<T> > Image<T> getImage( ImagePlus imp, Roi roi, ImageFactory<T> imgFactory, int channel, int timepoint )
 	{
+		TraceSpan span( "roi extraction" );
+		MemoryScope scope( MemoryPhase::pairRoi );
+
 		// first test the roi
 		roi = getOnlyRectangularRoi( roi );
 		
@@ -542,6 +556,8 @@ class PairWiseStitchingImgLib
 	 */
 	public static Image<UnsignedByteType> getWrappedImageUnsignedByte( ImagePlus imp, int channel, int timepoint )
 	{
+		TraceSpan span( "roi extraction" );
+
 		if ( channel == 0 || imp.getType() != ImagePlus.GRAY8 )
 			return null;
 		return ImageJFunctions.wrapByte( Hyperstack_rearranger.getImageChunk( imp, channel, timepoint ) );
@@ -559,6 +575,8 @@ class PairWiseStitchingImgLib
 	 */
 	public static Image<UnsignedShortType> getWrappedImageUnsignedShort( ImagePlus imp, int channel, int timepoint )
 	{
+		TraceSpan span( "roi extraction" );
+
 		if ( channel == 0 || imp.getType() != ImagePlus.GRAY16 )
 			return null;
 		return ImageJFunctions.wrapShort( Hyperstack_rearranger.getImageChunk( imp, channel, timepoint ) );
@@ -576,6 +594,8 @@ class PairWiseStitchingImgLib
 	 */
 	public static Image<FloatType> getWrappedImageFloat( ImagePlus imp, int channel, int timepoint )
 	{
+		TraceSpan span( "roi extraction" );
+
 		if ( channel == 0 || imp.getType() != ImagePlus.GRAY32 )
 			return null;
 		return ImageJFunctions.wrapFloat( Hyperstack_rearranger.getImageChunk( imp, channel, timepoint ) );
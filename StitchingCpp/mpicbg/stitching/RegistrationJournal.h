@@ -0,0 +1,224 @@
+#pragma once
+
+#include "header.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+#include <sys/stat.h>
+
+/**
+ * An append-only file of pairwise registration results, so that a run that died
+ * (or a second run that only fuses differently) does not have to compute the phase
+ * correlations again.
+ *
+ * Each completed pair is written as one fixed-size record right away: the key of
+ * the pair, the relative shift, the cross correlation and the phase correlation,
+ * followed by a checksum. The key is a hash of everything the result depends on
+ * (see {@link #fileIdentity} and {@link #key}), so a changed tile or changed
+ * registration parameters simply miss the journal. A record that was cut short or
+ * does not match its checksum ends the journal when it is read; the next record
+ * is written over it and the pair is computed again.
+ */
+class RegistrationJournal {
+public:
+	struct Entry {
+		int numDimensions = 0;
+		float shift[3] = { 0, 0, 0 };
+		float crossCorrelation = 0;
+		float phaseCorrelation = 0;
+	};
+
+	RegistrationJournal() {}
+	RegistrationJournal(const RegistrationJournal&) = delete;
+	RegistrationJournal& operator=(const RegistrationJournal&) = delete;
+
+	~RegistrationJournal() { close(); }
+
+	/**
+	 * Reads all complete records of the journal and opens it for appending, the file
+	 * is created if it does not exist.
+	 *
+	 * @return false if the file can not be written
+	 */
+	bool open(const string& path)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		entries.clear();
+
+		long long valid = 0;
+		FILE* in = fopen(path.c_str(), "rb");
+
+		if (in != nullptr)
+		{
+			char magic[magicLength];
+
+			if (fread(magic, 1, magicLength, in) == magicLength && memcmp(magic, journalMagic(), magicLength) == 0)
+			{
+				valid = magicLength;
+				Record record;
+
+				while (fread(&record, sizeof(record), 1, in) == 1 && record.check == checksum(record))
+				{
+					entries[record.key] = toEntry(record);
+					valid += sizeof(record);
+				}
+			}
+
+			fclose(in);
+		}
+
+		if (valid == 0)
+		{
+			file = fopen(path.c_str(), "wb");
+
+			if (file != nullptr)
+				fwrite(journalMagic(), 1, magicLength, file);
+		}
+		else
+		{
+			// append behind the last valid record, over a torn one if there is any
+			file = fopen(path.c_str(), "r+b");
+
+			if (file != nullptr)
+				fseek(file, (long)valid, SEEK_SET);
+		}
+
+		if (file == nullptr)
+		{
+			LOGERR("Cannot write registration journal '" << path << "'.");
+			return false;
+		}
+
+		fflush(file);
+		return true;
+	}
+
+	void close()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		if (file != nullptr)
+			fclose(file);
+
+		file = nullptr;
+	}
+
+	bool isOpen() { std::lock_guard<std::mutex> lock(mutex); return file != nullptr; }
+
+	int size() { std::lock_guard<std::mutex> lock(mutex); return (int)entries.size(); }
+
+	bool lookup(uint64_t key, Entry& entry)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = entries.find(key);
+
+		if (it == entries.end())
+			return false;
+
+		entry = it->second;
+		return true;
+	}
+
+	/** Writes the record and flushes it, so it survives the process dying right after. */
+	void append(uint64_t key, const Entry& entry)
+	{
+		Record record;
+		record.key = key;
+		record.numDimensions = (uint32_t)entry.numDimensions;
+
+		for (int d = 0; d < 3; ++d)
+			record.shift[d] = entry.shift[d];
+
+		record.crossCorrelation = entry.crossCorrelation;
+		record.phaseCorrelation = entry.phaseCorrelation;
+		record.check = checksum(record);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		entries[key] = entry;
+
+		if (file != nullptr)
+		{
+			fwrite(&record, sizeof(record), 1, file);
+			fflush(file);
+		}
+	}
+
+	/**
+	 * @return the path, size and modification time of a file, which changes whenever the
+	 * file is replaced or rewritten
+	 */
+	static string fileIdentity(const string& path)
+	{
+		struct stat info;
+		std::ostringstream identity;
+		identity << path;
+
+		if (stat(path.c_str(), &info) == 0)
+			identity << '|' << (long long)info.st_size << '|' << (long long)info.st_mtime;
+
+		return identity.str();
+	}
+
+	/** 64 bit FNV-1a hash of the description of a pair */
+	static uint64_t key(const string& description)
+	{
+		uint64_t hash = 14695981039346656037ull;
+
+		for (unsigned char c : description)
+		{
+			hash ^= c;
+			hash *= 1099511628211ull;
+		}
+
+		return hash;
+	}
+
+private:
+	struct Record {
+		uint64_t key;
+		uint32_t numDimensions;
+		float shift[3];
+		float crossCorrelation;
+		float phaseCorrelation;
+		uint32_t check;
+		uint32_t reserved = 0;
+	};
+
+	static const size_t magicLength = 8;
+	static const char* journalMagic() { return "STJRNL01"; }
+
+	static uint32_t checksum(const Record& record)
+	{
+		const unsigned char* bytes = (const unsigned char*)&record;
+		uint32_t hash = 2166136261u;
+
+		for (size_t i = 0; i < offsetof(Record, check); ++i)
+		{
+			hash ^= bytes[i];
+			hash *= 16777619u;
+		}
+
+		return hash;
+	}
+
+	static Entry toEntry(const Record& record)
+	{
+		Entry entry;
+		entry.numDimensions = (int)record.numDimensions;
+
+		for (int d = 0; d < 3; ++d)
+			entry.shift[d] = record.shift[d];
+
+		entry.crossCorrelation = record.crossCorrelation;
+		entry.phaseCorrelation = record.phaseCorrelation;
+		return entry;
+	}
+
+	std::mutex mutex;
+	FILE* file = nullptr;
+	std::unordered_map<uint64_t, Entry> entries;
+};
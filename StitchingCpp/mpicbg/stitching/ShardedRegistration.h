@@ -0,0 +1,291 @@
+/*
+ * #%L
+ * Fiji distribution of ImageJ for the life sciences.
+ * %%
+ * Copyright (C) 2007 - 2022 Fiji developers.
+ * %%
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/gpl-2.0.html>.
+ * #L%
+ */
+// package mpicbg.stitching;
+#include "header.h"
+#include "tools/threadpool.h"
+#include "RegistrationJournal.h"
+#include "CollectionStitchingImgLib.h"
+#include "TileGrid.h"
+#include <algorithm>
+#include <cstdio>
+
+import java.io.File;
+import java.util.ArrayList;
+import java.util.Vector;
+
+/**
+ * Registration of a collection by several processes, on one node or on the nodes of
+ * a cluster allocation, which only share a directory.
+ *
+ * The pairs of the approximate layout are sorted along a Z-order curve of their
+ * centers and cut into numShards contiguous pieces, so a shard covers a compact
+ * region and reads few tiles that another shard reads as well. Every process derives
+ * the same shards from the same layout, nothing has to be distributed up front.
+ *
+ * A worker ({@link #runShard}) registers the pairs of its shard into the journal
+ * shard_#.registration (see {@link RegistrationJournal}) and then writes
+ * shard_#.done. A worker that is restarted (e.g. after being preempted) continues
+ * from its journal. The reducer ({@link #reduce}) waits for all done files, reads
+ * the results of all pairs from the journals and runs the {@link GlobalOptimization}.
+ */
+class ShardedRegistration
+{
+	/**
+	 * The pairs of overlapping tiles of the approximate layout, like
+	 * {@link CollectionStitchingImgLib#findOverlappingTiles}, but the candidates come from
+	 * a grid of buckets as large as the largest tile, so large collections do not test all
+	 * pairs. The tiles have no ImagePlus yet, each process opens only the ones it needs.
+	 */
+	public static Vector< ComparePair > findPairs( ArrayList< ImageCollectionElement > elements, StitchingParameters params )
+	{
+		int n = params.dimensionality;
+		double[] bucketSize = new double[ n ];
+
+		for ( ImageCollectionElement element : elements )
+			for ( int d = 0; d < n; ++d )
+				bucketSize[ d ] = Math.max( bucketSize[ d ], (double) element.getDimension( d ) );
+
+		ArrayList< ImagePlusTimePoint > tiles = new ArrayList< ImagePlusTimePoint >();
+		TileGrid grid( n, bucketSize );
+		Vector< ComparePair > pairs = new Vector< ComparePair >();
+
+		for ( int i = 0; i < elements.size(); ++i )
+		{
+			ImageCollectionElement element = elements.get( i );
+			tiles.add( new ImagePlusTimePoint( null, element.getIndex(), 1, element.getModel(), element ) );
+
+			double[] min = new double[ n ];
+			double[] max = new double[ n ];
+
+			for ( int d = 0; d < n; ++d )
+			{
+				min[ d ] = element.getOffset( d );
+				max[ d ] = element.getOffset( d ) + element.getDimension( d );
+			}
+
+			// ascending, the same order of tiles within a pair as findOverlappingTiles
+			for ( int j : grid.find( min, max ) )
+				if ( CollectionStitchingImgLib.overlaps( elements.get( j ), element, n ) )
+					pairs.add( new ComparePair( tiles.get( j ), tiles.get( i ) ) );
+
+			grid.set( i, min, max );
+		}
+
+		return pairs;
+	}
+
+	/**
+	 * @return the shard of each pair, shards are contiguous along a Z-order curve over the
+	 * centers of the pairs
+	 */
+	public static vector< int > partition( Vector< ComparePair > pairs, int numShards, int dimensionality )
+	{
+		vector< std::pair< unsigned long long, int > > order;
+
+		for ( int p = 0; p < pairs.size(); ++p )
+		{
+			ImageCollectionElement e1 = pairs.get( p ).getTile1().getElement();
+			ImageCollectionElement e2 = pairs.get( p ).getTile2().getElement();
+			unsigned int cell[ 3 ] = { 0, 0, 0 };
+
+			// the center in units of the first tile, shifted to be positive
+			for ( int d = 0; d < dimensionality; ++d )
+			{
+				double center = ( e1.getOffset( d ) + e2.getOffset( d ) + e2.getDimension( d ) ) / 2.0;
+				cell[ d ] = (unsigned int)( (long long) Math.floor( center / e1.getDimension( d ) ) + ( 1 << 20 ) ) & 0x1fffff;
+			}
+
+			order.push_back( { interleave( cell ), p } );
+		}
+
+		std::sort( order.begin(), order.end() );
+
+		vector< int > shard( pairs.size() );
+
+		for ( size_t i = 0; i < order.size(); ++i )
+			shard[ order[ i ].second ] = (int)( i * numShards / order.size() );
+
+		return shard;
+	}
+
+	/**
+	 * Registers the pairs of one shard into its journal and marks the shard as done.
+	 *
+	 * @return false if a pair could not be registered
+	 */
+	public static boolean runShard( ArrayList< ImageCollectionElement > elements, StitchingParameters params, String directory, int shard, int numShards )
+	{
+		long time = TimeHelper::milliseconds();
+
+		Vector< ComparePair > pairs = findPairs( elements, params );
+		vector< int > shardOf = partition( pairs, numShards, params.dimensionality );
+
+		vector< int > mine;
+
+		for ( int p = 0; p < pairs.size(); ++p )
+			if ( shardOf[ p ] == shard )
+				mine.push_back( p );
+
+		// open only the tiles this shard needs, a tile is shared by the pairs of the shard
+		for ( int p : mine )
+		{
+			ComparePair pair = pairs.get( p );
+
+			for ( ImagePlusTimePoint tile : new ImagePlusTimePoint[]{ pair.getTile1(), pair.getTile2() } )
+				if ( tile.getImagePlus() == null )
+					tile.setImagePlus( tile.getElement().open( params.bVirtual ) );
+		}
+
+		LOGINFO( "Shard " + shard + " of " + numShards + ": " + mine.size() + " of " + pairs.size() + " pairs." );
+
+		RegistrationJournal journal;
+
+		if ( !journal.open( journalFile( directory, shard ) ) )
+			return false;
+
+		ThreadPool& pool = ThreadPool::global();
+		ThreadPool::TaskGroup group;
+		atomic< bool > failed( false );
+
+		for ( int p : mine )
+			pool.submit( group, [&, p]()
+			{
+				if ( !failed && !CollectionStitchingImgLib.computePair( pairs.get( p ), params, journal ) )
+					failed = true;
+			});
+
+		group.wait();
+		journal.close();
+
+		for ( ImageCollectionElement element : elements )
+			element.close();
+
+		if ( failed )
+		{
+			LOGERR( "Shard " + shard + " failed." );
+			return false;
+		}
+
+		// written under another name and renamed, so the reducer never sees a partial file
+		String done = doneFile( directory, shard );
+		FILE* file = fopen( ( done + ".tmp" ).c_str(), "w" );
+
+		if ( file == nullptr || fprintf( file, "%d %d\n", (int) mine.size(), (int) pairs.size() ) < 0 || fclose( file ) != 0 || rename( ( done + ".tmp" ).c_str(), done.c_str() ) != 0 )
+		{
+			LOGERR( "Cannot write '" + done + "'." );
+			return false;
+		}
+
+		LOGINFO( "Finished shard " + shard + " (" + ( TimeHelper::milliseconds() - time ) + " ms)." );
+
+		return true;
+	}
+
+	/**
+	 * Waits until all shards are done, collects their results and computes the global
+	 * optimization.
+	 *
+	 * @param timeoutSeconds - how long to wait for missing shards, 0 means fail right away
+	 * @return the optimized tiles, their images are not opened, null if a shard is missing
+	 * or incomplete
+	 */
+	public static ArrayList< ImagePlusTimePoint > reduce( ArrayList< ImageCollectionElement > elements, StitchingParameters params, String directory, int numShards, int timeoutSeconds )
+	{
+		long time = TimeHelper::milliseconds();
+
+		for ( int shard = 0; shard < numShards; ++shard )
+		{
+			while ( !new File( doneFile( directory, shard ) ).exists() )
+			{
+				if ( ( TimeHelper::milliseconds() - time ) / 1000 >= timeoutSeconds )
+				{
+					LOGERR( "Shard " + shard + " of " + numShards + " is not done ('" + doneFile( directory, shard ) + "' is missing)." );
+					return null;
+				}
+
+				std::this_thread::sleep_for( std::chrono::seconds( 1 ) );
+			}
+		}
+
+		Vector< ComparePair > pairs = findPairs( elements, params );
+		vector< int > shardOf = partition( pairs, numShards, params.dimensionality );
+
+		if ( pairs.isEmpty() )
+		{
+			LOGERR( "No overlapping tiles could be found given the approximate layout." );
+			return null;
+		}
+
+		vector< unique_ptr< RegistrationJournal > > journals;
+
+		for ( int shard = 0; shard < numShards; ++shard )
+		{
+			journals.emplace_back( new RegistrationJournal() );
+
+			if ( !journals.back()->open( journalFile( directory, shard ) ) )
+				return null;
+		}
+
+		for ( int p = 0; p < pairs.size(); ++p )
+		{
+			ComparePair pair = pairs.get( p );
+			RegistrationJournal::Entry entry;
+
+			Roi roi1 = CollectionStitchingImgLib.getROI( pair.getTile1().getElement(), pair.getTile2().getElement() );
+			Roi roi2 = CollectionStitchingImgLib.getROI( pair.getTile2().getElement(), pair.getTile1().getElement() );
+
+			if ( !journals[ shardOf[ p ] ]->lookup( RegistrationJournal::key( CollectionStitchingImgLib.describePair( pair, roi1, roi2, params ) ), entry ) )
+			{
+				LOGERR( "Shard " + shardOf[ p ] + " has no result for " + pair.getTile1().getTitle() + " -> " + pair.getTile2().getTitle() +
+						", the layout or the parameters differ from the ones the shards were computed with." );
+				return null;
+			}
+
+			if ( params.dimensionality == 2 )
+				pair.setRelativeShift( new float[]{ entry.shift[ 0 ], entry.shift[ 1 ] } );
+			else
+				pair.setRelativeShift( new float[]{ entry.shift[ 0 ], entry.shift[ 1 ], entry.shift[ 2 ] } );
+
+			pair.setCrossCorrelation( entry.crossCorrelation );
+			pair.setPhaseCorrelation( entry.phaseCorrelation );
+		}
+
+		LOGINFO( "Collected " + pairs.size() + " pairs from " + numShards + " shards (" + ( TimeHelper::milliseconds() - time ) + " ms)." );
+
+		return GlobalOptimization.optimize( pairs, pairs.get( 0 ).getTile1(), params );
+	}
+
+	public static String journalFile( String directory, int shard ) { return new File( directory, "shard_" + shard + ".registration" ).getAbsolutePath(); }
+	public static String doneFile( String directory, int shard ) { return new File( directory, "shard_" + shard + ".done" ).getAbsolutePath(); }
+
+	/** Morton code of three 21 bit coordinates */
+	protected static unsigned long long interleave( const unsigned int* cell )
+	{
+		unsigned long long code = 0;
+
+		for ( int bit = 0; bit < 21; ++bit )
+			for ( int d = 0; d < 3; ++d )
+				code |= (unsigned long long)( ( cell[ d ] >> bit ) & 1 ) << ( 3 * bit + d );
+
+		return code;
+	}
+};
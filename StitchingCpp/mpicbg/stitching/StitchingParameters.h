@@ -21,16 +21,19 @@
  */
 #include "header.h"
 
-//import mpicbg.imglib.container.ContainerFactory;
-//import mpicbg.imglib.container.array.ArrayContainerFactory;
+#include "imglib1/ArrayContainerFactory.h"
 
 class StitchingParameters
 {
 	/**
-	 * If we cannot wrap, which factory do we use for computing the phase correlation
+	 * If we cannot wrap, which factory do we use for computing the phase correlation;
+	 * the array container by default, a single span iterates fastest. Very large
+	 * stacks can use a PlanarContainerFactory or CellContainerFactory instead.
+	 * The arrays come from the per-thread scratch arenas, the images of one pair
+	 * are reused by the next pair of the same size.
 	 */
 public:
-	static ContainerFactory phaseCorrelationFactory = new ArrayContainerFactory();
+	static ContainerFactory* phaseCorrelationFactory;
 
 	/**
 	 * If you want to force that the {@link ContainerFactory} above is always used set this to true
@@ -56,10 +59,74 @@ public:
 	int timeSelect;
 
 	int cpuMemChoice = 0;
-	// 0 == fuse&display, 1 == writeToDisk
+	// 0 == fuse&display, 1 == writeToDisk, 2 == stream into a tiled BigTIFF (resultDir/resultFile),
+	// 3 == one TIFF per timepoint (resultDir/img_t#.tif),
+	// 4 == one tiled TIFF per chunk (resultDir/chunk_x#_y#[_z#].tif), fused by fusionPartition of numFusionPartitions
 	int outputVariant = 0;
 	string outputDirectory = "";
 
+	/**
+	 * Size of the chunks for outputVariant 2, chunkSize x chunkSize pixels (also the TIFF tile size,
+	 * a multiple of 16) and chunkDepth slices for 3d. One chunk per thread is in memory at a time.
+	 */
+	int fusionChunkSize = 512;
+	int fusionChunkDepth = 16;
+
+	// reduced resolutions written with outputVariant 2, -1 == until a plane fits into one tile, 0 == none;
+	// at most as many as fusionChunkSize can be halved evenly (4 for 48, 5 for 96, 9 for 512)
+	int fusionPyramidLevels = -1;
+
+	// MB of fused timepoints in memory at once with outputVariant 3, 0 == one timepoint per thread
+	int fusionMemoryBudget = 0;
+
+	// the processes that share the fusion with outputVariant 4 and which one this is (see Fusion::fusePartition)
+	int numFusionPartitions = 1;
+	int fusionPartition = 0;
+
+	// compression of TIFF results: 1 == none, 5 == LZW, 8 == deflate, 50000 == zstd (see TiffCodec),
+	// deflate and zstd only if the build defines STITCHING_HAVE_ZLIB resp. STITCHING_HAVE_ZSTD
+	int tiffCompression = 1;
+	// difference neighboring samples before compressing, usually makes microscopy images a lot smaller
+	bool tiffPredictor = true;
+
+	/**
+	 * Fraction of the tiles that may overlap another tile after the global optimization
+	 * while the fusion still just copies the tiles (last one wins) instead of blending.
+	 * 0 means only fuse without blending if no two tiles overlap.
+	 */
+	double noOverlapFraction = 0;
+
+	/**
+	 * File the pairwise registration results are journaled to, completed pairs are read back
+	 * instead of being computed again (see RegistrationJournal). Empty means no journal,
+	 * Stitching_Grid fills in resultDir/resultFile.registration unless useRegistrationJournal
+	 * is false.
+	 */
+	string registrationJournal = "";
+	bool useRegistrationJournal = true;
+
+	/**
+	 * Sharded registration by several processes that share shardDirectory (see ShardedRegistration).
+	 * With numShards > 0 a process with shardIndex >= 0 only registers that shard, a process with
+	 * shardIndex == -1 waits up to shardTimeout seconds for all shards, optimizes and fuses.
+	 */
+	int numShards = 0;
+	int shardIndex = -1;
+	string shardDirectory = "";
+	int shardTimeout = 0;
+
+	/**
+	 * Chrome trace (chrome://tracing, Perfetto) the spans of the pipeline phases are written to,
+	 * a summary table of the phases is logged as well (see Trace). Empty means no tracing.
+	 */
+	string traceFile = "";
+
+	/**
+	 * Only open the tiles virtually, log the predicted memory of each phase (see MemoryEstimate)
+	 * and stop before any registration or fusion.
+	 */
+	bool dryRun = false;
+
 	double regThreshold = -2;
 	double relativeThreshold = 2.5;
 	double absoluteThreshold = 3.5;
@@ -69,3 +136,5 @@ public:
 	int seqRange = 1;
 
 };
+
+ContainerFactory* StitchingParameters::phaseCorrelationFactory = new ArrayContainerFactory( true );
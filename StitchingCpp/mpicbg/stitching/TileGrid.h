@@ -0,0 +1,137 @@
+/*
+ * #%L
+ * Fiji distribution of ImageJ for the life sciences.
+ * %%
+ * Copyright (C) 2007 - 2022 Fiji developers.
+ * %%
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/gpl-2.0.html>.
+ * #L%
+ */
+// package mpicbg.stitching;
+#include "header.h"
+#include <algorithm>
+#include <array>
+#include <unordered_map>
+
+/**
+ * Bounding boxes of tiles in the buckets of a regular grid, to find the tiles around a
+ * box without testing all of them. A tile is listed in every bucket its box spans and
+ * a lookup searches every bucket the box it is given spans, so tiles of any size are
+ * found. With buckets at least as large as the largest tile a box spans at most 2^n
+ * buckets.
+ */
+class TileGrid
+{
+	int dimensionality;
+	double[] bucketSize;
+
+	unordered_map< unsigned long long, vector< int > > buckets;
+
+	// the box of each tile, indexed by tile, empty if the tile is not in the grid
+	vector< array< double, 3 > > boxMin, boxMax;
+	vector< bool > listed;
+
+public:
+	TileGrid( int dimensionality, double[] bucketSize )
+	{
+		this->dimensionality = dimensionality;
+		this->bucketSize = bucketSize;
+	}
+
+	/** Adds a tile with the box [min, max], or moves it there if it is in the grid already */
+	void set( int tile, double[] min, double[] max )
+	{
+		if ( tile >= (int) listed.size() )
+		{
+			boxMin.resize( tile + 1 );
+			boxMax.resize( tile + 1 );
+			listed.resize( tile + 1, false );
+		}
+
+		if ( listed[ tile ] )
+			remove( tile );
+
+		for ( int d = 0; d < dimensionality; ++d )
+		{
+			boxMin[ tile ][ d ] = min[ d ];
+			boxMax[ tile ][ d ] = max[ d ];
+		}
+
+		listed[ tile ] = true;
+
+		forEachBucket( min, max, [&]( unsigned long long key ) { buckets[ key ].push_back( tile ); } );
+	}
+
+	void remove( int tile )
+	{
+		if ( tile >= (int) listed.size() || !listed[ tile ] )
+			return;
+
+		forEachBucket( boxMin[ tile ].data(), boxMax[ tile ].data(), [&]( unsigned long long key )
+		{
+			vector< int >& bucket = buckets[ key ];
+			bucket.erase( std::remove( bucket.begin(), bucket.end(), tile ), bucket.end() );
+
+			if ( bucket.empty() )
+				buckets.erase( key );
+		});
+
+		listed[ tile ] = false;
+	}
+
+	/** @return the tiles in the buckets that [min, max] spans, each once and in ascending order */
+	vector< int > find( double[] min, double[] max )
+	{
+		vector< int > tiles;
+
+		forEachBucket( min, max, [&]( unsigned long long key )
+		{
+			auto it = buckets.find( key );
+
+			if ( it != buckets.end() )
+				tiles.insert( tiles.end(), it->second.begin(), it->second.end() );
+		});
+
+		std::sort( tiles.begin(), tiles.end() );
+		tiles.erase( std::unique( tiles.begin(), tiles.end() ), tiles.end() );
+
+		return tiles;
+	}
+
+	/** @return the key of a bucket, 21 bits of each coordinate */
+	static unsigned long long key( int x, int y, int z )
+	{
+		return ( (unsigned long long)( z & 0x1fffff ) << 42 ) | ( (unsigned long long)( y & 0x1fffff ) << 21 ) | (unsigned long long)( x & 0x1fffff );
+	}
+
+protected:
+	template < typename F >
+	void forEachBucket( const double* min, const double* max, F f )
+	{
+		int first[ 3 ] = { 0, 0, 0 };
+		int last[ 3 ] = { 0, 0, 0 };
+
+		for ( int d = 0; d < dimensionality; ++d )
+		{
+			first[ d ] = (int) Math.floor( min[ d ] / bucketSize[ d ] );
+			last[ d ] = (int) Math.floor( max[ d ] / bucketSize[ d ] );
+		}
+
+		for ( int z = first[ 2 ]; z <= last[ 2 ]; ++z )
+			for ( int y = first[ 1 ]; y <= last[ 1 ]; ++y )
+				for ( int x = first[ 0 ]; x <= last[ 0 ]; ++x )
+					f( key( x, y, z ) );
+	}
+};
@@ -88,6 +88,20 @@ private:
 	}
 
 	
+	virtual double getWeight( int imageId, double localPosition[] ) override
+	{
+		// we are always inside the image, so we do not want 0.0
+		return max( 0.00001, computeWeight( localPosition, dimensions[ imageId ], border, percentScaling ) );
+	}
+
+	
+	virtual void addWeightedValue( double value, int imageId, double localPosition[], double weight ) override
+	{
+		weightSum += weight;
+		valueSum += value * weight;
+	}
+
+	
 	virtual double getValue() override
 	{ 
 		if ( weightSum == 0 )
@@ -98,6 +112,7 @@ private:
 	
 	virtual PixelFusion* copy() { return new BlendingPixelFusion( images ); }
 
+public:
 	/**
 	 * From SPIM Registration
 	 * 
@@ -48,6 +48,16 @@ class BlendingPixelFusionIgnoreZero : public BlendingPixelFusion
 		}
 	}
 
+	@Override
+	public void addWeightedValue( double value, int imageId, double[] localPosition, double weight ) 
+	{
+		if ( value != 0.0 )
+		{
+			weightSum += weight;
+			valueSum += value * weight;
+		}
+	}
+
 	@Override
 	public PixelFusion copy() { return new BlendingPixelFusionIgnoreZero( images ); }
 }
@@ -20,6 +20,20 @@
  * #L%
  */
 // package mpicbg.stitching.fusion;
+#include "header.h"
+#include "tools/threadpool.h"
+#include "tools/reorderbuffer.h"
+#include "tools/memorybudget.h"
+#include "tools/memoryledger.h"
+#include "tools/trace.h"
+#include "FusionBlockScheduler.h"
+#include "PlaneCopy.h"
+#include "TranslationInterpolator.h"
+#include "stitching/io/TiledTiffWriter.h"
+#include "stitching/io/TilePyramid.h"
+#include "stitching/io/TiffSaver.h"
+#include <array>
+#include <memory>
 
 import fiji.stacks.Hyperstack_rearranger;
 import ij.CompositeImage;
@@ -31,33 +45,32 @@ import ij.io.FileSaver;
 
 import java.io.File;
 import java.util.ArrayList;
+import java.util.Arrays;
 import java.util.Collections;
 import java.util.HashSet;
 import java.util.List;
 import java.util.Set;
 import java.util.Stack;
-import java.util.Vector;
-import java.util.concurrent.atomic.AtomicInteger;
 
 import mpicbg.imglib.cursor.LocalizableByDimCursor;
 import mpicbg.models.InvertibleBoundable;
 import mpicbg.models.NoninvertibleModelException;
-import net.imglib2.Cursor;
+import mpicbg.models.TranslationModel2D;
+import mpicbg.models.TranslationModel3D;
 import net.imglib2.RandomAccess;
 import net.imglib2.RandomAccessible;
 import net.imglib2.RealRandomAccess;
 import net.imglib2.exception.ImgLibException;
 import net.imglib2.img.Img;
 import net.imglib2.img.ImgFactory;
+import net.imglib2.img.array.ArrayImg;
 import net.imglib2.img.array.ArrayImgFactory;
 import net.imglib2.img.display.imagej.ImageJFunctions;
 import net.imglib2.img.imageplus.ImagePlusImg;
 import net.imglib2.img.imageplus.ImagePlusImgFactory;
+import net.imglib2.img.planar.PlanarImg;
 import net.imglib2.interpolation.InterpolatorFactory;
-import net.imglib2.interpolation.randomaccess.NLinearInterpolatorFactory;
 import net.imglib2.interpolation.randomaccess.NearestNeighborInterpolatorFactory;
-import net.imglib2.multithreading.Chunk;
-import net.imglib2.multithreading.SimpleMultiThreading;
 import net.imglib2.type.NativeType;
 import net.imglib2.type.numeric.RealType;
 import net.imglib2.type.numeric.integer.UnsignedByteType;
@@ -76,17 +89,31 @@ class Fusion
 {
 	public static long redrawDelay = 500;
 
+	/**
+	 * How many slices writeBlock keeps in flight (fused but not yet written), 0 means twice the number of pool threads
+	 */
+	public static int writeQueueSize = 0;
+
 	/**
 	 * 
 	 * @param targetType
 	 * @param images
 	 * @param models
 	 * @param dimensionality
-	 * @param subpixelResolution - if there is no subpixel resolution, we do not need to convert to float as no interpolation is necessary, we can compute everything with RealType
+	 * @param subpixelResolution - if there is subpixel resolution the images are linearly interpolated on their native samples, otherwise sampled at the nearest neighbor
 	 */
 	public static < T : public RealType< T > & NativeType< T > > ImagePlus fuse( T targetType, ArrayList< ImagePlus > images, ArrayList< InvertibleBoundable > models, 
 			int dimensionality, boolean subpixelResolution, int fusionType, String outputDirectory, boolean noOverlap, boolean ignoreZeroValues, boolean displayImages )
 	{
+		// there is no output if we write to disk
+		if ( outputDirectory != null )
+		{
+			if ( !fuseToDirectory( targetType, images, models, dimensionality, subpixelResolution, fusionType, outputDirectory, ignoreZeroValues ) )
+				LOGERR( "Fusion could not be written to " + outputDirectory );
+
+			return null;
+		}
+
 		// first we need to estimate the boundaries of the new image
 		double[] offset = new double[ dimensionality ];
 		int[] size = new int[ dimensionality ];
@@ -103,217 +130,1051 @@ class Fusion
 		ImgFactory<T> f = new ImagePlusImgFactory<T>();
 		
 		// the composite
-		ImageStack stack;
-		
-		// there is no output if we write to disk
-		if ( outputDirectory == null )
-			stack = new ImageStack( size[ 0 ], size[ 1 ] );
-		else
-			stack = null;
+		ImageStack stack = new ImageStack( size[ 0 ], size[ 1 ] );
+
+		// the models are the same for all timepoints, so is the decomposition into regions
+		List<ClassifiedRegion> tiles = null;
+
+		// bytes of one fused channel of one timepoint
+		long long imageBytes = (long long)targetType.getBitsPerPixel() / 8;
+		for ( int d = 0; d < size.length; ++d )
+			imageBytes *= size[ d ];
 
 		//"Overlay into composite image"
+		for ( int t = 1; t <= numTimePoints; ++t )
+		{
+			IJ.showStatus("Fusing time point: " + t + " of " + numTimePoints + ", " +
+				numChannels + " channel(s)...");
+
+			// create the 2d/3d target image and extract the complete blockdata of every channel,
+			// subpixel fusion interpolates the native samples directly
+			List< Img< T > > out = new ArrayList< Img< T > >();
+			List< ArrayList< ImageInterpolation< ? : public RealType< ? > > > > blockData = new ArrayList< ArrayList< ImageInterpolation< ? : public RealType< ? > > > >();
+			SampleVolume[][] volumes = subpixelResolution ? new SampleVolume[ numChannels ][] : null;
+
+			for ( int c = 1; c <= numChannels; ++c )
+			{
+				out.add( f.create( size, targetType ) );
+				MemoryLedger::global().allocate( MemoryPhase::fusionOutput, imageBytes );
+				blockData.add( createBlockData( images, c, t ) );
+
+				if ( subpixelResolution )
+					volumes[ c - 1 ] = createSampleVolumes( images, c, t );
+			}
+
+			// without interpolation non-overlapping images can just be copied
+			if ( noOverlap && !subpixelResolution )
+			{
+				for ( int c = 0; c < numChannels; ++c )
+					fuseBlockNoOverlap( out.get( c ), blockData.get( c ), offset, models, displayImages );
+			}
+			else
+			{
+				if ( tiles == null )
+					tiles = buildTileList( images.size(), dimensionality, models, blockData.get( 0 ), offset );
+
+				// init the fusion, all channels share the geometry of the first one
+				PixelFusion fusion = createFusion( fusionType, ignoreZeroValues, blockData.get( 0 ) );
+				fuseBlock( out, blockData, volumes, tiles, offset, models, fusion, displayImages );
+			}
+
+			// add to stack, interleaved as XYCZT right away so it never has to be reordered
+			try 
+			{
+				ImageStack[] channels = new ImageStack[ numChannels ];
+
+				for ( int c = 0; c < numChannels; ++c )
+					channels[ c ] = ((ImagePlusImg<?, ?>)out.get( c )).getImagePlus().getStack();
+
+				for ( int z = 1; z <= out.get( 0 ).dimension( 2 ); ++z )
+					for ( int c = 0; c < numChannels; ++c )
+						stack.addSlice( "", channels[ c ].getProcessor( z ) );
+
+				// the planes now belong to the stack, it is released by whoever closes the result
+				MemoryLedger::global().transfer( MemoryPhase::fusionOutput, MemoryPhase::imageStack, imageBytes * numChannels );
+			} 
+			catch (ImgLibException e) 
+			{
+				LOGERR( "Output image has no ImageJ type: " + e );
+			}
+		}
+
+		IJ.showStatus( "Fusion complete." );
+		
+		// reset the progress bar
+		IJ.showProgress( 1.01 );
+
+		ImagePlus result = new ImagePlus( "", stack );
+
+		// transfer calibration from first tile
+		result.setCalibration(images.get(0).getCalibration());
+		
+		// numchannels, z-slices, timepoints, the stack is XYCZT already
+		if ( dimensionality == 3 )
+		{
+			result.setDimensions( numChannels, size[ 2 ], numTimePoints );
+			return CompositeImageFixer.makeComposite( result, CompositeImage.COMPOSITE );
+		}
+
+		result.setDimensions( numChannels, 1, numTimePoints );
+		
+		if ( numChannels > 1 || numTimePoints > 1 )
+			return CompositeImageFixer.makeComposite( result, CompositeImage.COMPOSITE );
+		return result;
+	}
+
+	/**
+	 * Fuses every timepoint and channel slice by slice and writes each slice as
+	 * img_t#_z#_c# into outputDirectory, see {@link #writeBlock}.
+	 * 
+	 * @return false if a slice could not be fused or written, the remaining ones are skipped
+	 */
+	public static < T : public RealType< T > & NativeType< T > > boolean fuseToDirectory( T targetType, ArrayList< ImagePlus > images, ArrayList< InvertibleBoundable > models, 
+			int dimensionality, boolean subpixelResolution, int fusionType, String outputDirectory, boolean ignoreZeroValues )
+	{
+		double[] offset = new double[ dimensionality ];
+		int[] size = new int[ dimensionality ];
+		int numTimePoints = images.get( 0 ).getNFrames();
+		int numChannels = images.get( 0 ).getNChannels();
+		
+		estimateBounds( offset, size, images, models, dimensionality );
+		
+		if ( subpixelResolution )
+			for ( int d = 0; d < size.length; ++d )
+				++size[ d ];
+
+		ImgFactory<T> f = new ImagePlusImgFactory<T>();
+
 		for ( int t = 1; t <= numTimePoints; ++t )
 		{
 			for ( int c = 1; c <= numChannels; ++c )
 			{
 				IJ.showStatus("Fusing time point: " + t + " of " + numTimePoints + ", " +
 					"channel: " + c + " of " + numChannels + "...");
-				// create the 2d/3d target image for the current channel and timepoint 
-				Img< T > out;
-				
+
 				// we just create one slice if we write to disk
-				if ( outputDirectory == null )
-					out = f.create( size, targetType );
-				else
-					out = f.create( new int[] { size[ 0 ], size[ 1 ] }, targetType ); // just create a slice
+				Img< T > out = f.create( new int[] { size[ 0 ], size[ 1 ] }, targetType );
+				MemoryCharge charge( MemoryPhase::fusionOutput, (long long)size[ 0 ] * size[ 1 ] * targetType.getBitsPerPixel() / 8 );
+
+				ArrayList< ImageInterpolation< ? : public RealType< ? > > > blockData = createBlockData( images, c, t );
+				SampleVolume[] volumes = subpixelResolution ? createSampleVolumes( images, c, t ) : null;
+				PixelFusion fusion = createFusion( fusionType, ignoreZeroValues, blockData );
 
-				// init the fusion
-				PixelFusion fusion = null;
+				int numSlices;
 				
-				if ( fusionType == 1 )
-				{
-					if ( ignoreZeroValues )
-						fusion = new AveragePixelFusionIgnoreZero();
-					else
-						fusion = new AveragePixelFusion();
-				}
-				else if ( fusionType == 2 )
-				{
-					if ( ignoreZeroValues )
-						fusion = new MedianPixelFusionIgnoreZero();
-					else
-						fusion = new MedianPixelFusion();
-				}
-				else if ( fusionType == 3 )
-				{
-					if ( ignoreZeroValues )
-						fusion = new MaxPixelFusionIgnoreZero();
-					else
-						fusion = new MaxPixelFusion();
-				}
-				else if ( fusionType == 4 )
-				{
-					if ( ignoreZeroValues )
-						fusion = new MinPixelFusionIgnoreZero();
-					else
-						fusion = new MinPixelFusion();	
-				}
-				else if ( fusionType == 5 )
-				{
-					fusion = new OverlapFusion();
-				}
+				if ( dimensionality == 2 )
+					numSlices = 1;
+				else
+					numSlices = size[ 2 ];
 				
-				// extract the complete blockdata
+				if ( !writeBlock( out, numSlices, t, numTimePoints, c, numChannels, blockData, volumes, offset, models, fusion, outputDirectory ) )
+					return false;
+			}
+		}
+
+		IJ.showStatus( "Fusion complete." );
+		IJ.showProgress( 1.01 );
+
+		return true;
+	}
+
+	/**
+	 * Fuses a time series timepoint by timepoint and writes every timepoint as its own TIFF
+	 * (img_t#.tif, a CZ hyperstack) into outputDirectory as soon as it is fused, so the series
+	 * is never held in memory as a whole.
+	 * 
+	 * All timepoints share the models, so the decomposition into regions is computed once.
+	 * Timepoints are fused concurrently on the pool as long as their fused images fit into
+	 * the memory budget, each one with all its channels in one pass.
+	 * 
+	 * @param memoryBudget - bytes of fused timepoints that may be in memory at once, 0 means one per pool thread
+	 * @param compression - compression of the files, see {@link TiffCodec}
+	 * @param predictor - difference the samples before compressing
+	 * @return false if a timepoint could not be written
+	 */
+	public static < T : public RealType< T > & NativeType< T > > boolean fuseTimepoints( T targetType, ArrayList< ImagePlus > images, ArrayList< InvertibleBoundable > models, 
+			int dimensionality, boolean subpixelResolution, int fusionType, String outputDirectory, boolean noOverlap, boolean ignoreZeroValues, long long memoryBudget, int compression, boolean predictor )
+	{
+		double[] offset = new double[ dimensionality ];
+		int[] size = new int[ dimensionality ];
+		int numImages = images.size();
+		int numTimePoints = images.get( 0 ).getNFrames();
+		int numChannels = images.get( 0 ).getNChannels();
+
+		estimateBounds( offset, size, images, models, dimensionality );
+
+		if ( subpixelResolution )
+			for ( int d = 0; d < size.length; ++d )
+				++size[ d ];
+
+		int numSlices = dimensionality == 3 ? size[ 2 ] : 1;
+		long long bytesPerTimepoint = (long long) size[ 0 ] * size[ 1 ] * numSlices * numChannels * ( targetType.getBitsPerPixel() / 8 );
+
+		ThreadPool& pool = ThreadPool::global();
+
+		if ( memoryBudget <= 0 )
+			memoryBudget = bytesPerTimepoint * pool.numThreads();
+
+		// the geometry is the same for all timepoints and channels
+		List<ClassifiedRegion> tiles = buildTileList( numImages, dimensionality, models, createBlockData( images, 1, 1 ), offset );
+
+		ImgFactory<T> f = new ImagePlusImgFactory<T>();
+		MemoryBudget budget( memoryBudget );
+		atomic< int > done( 0 );
+		atomic< bool > failed( false );
+
+		LOGINFO( "Fusing " << numTimePoints << " timepoints, " << std::max( 1LL, std::min( (long long) numTimePoints, memoryBudget / bytesPerTimepoint ) ) << " at a time" );
+
+		ThreadPool::TaskGroup group;
+
+		for ( int t = 1; t <= numTimePoints && !failed; ++t )
+		{
+			// waits for finished timepoints to be written before starting the next
+			budget.reserve( bytesPerTimepoint );
+
+			pool.submit( group, [&, t]()
+			{
+				if ( !failed && !fuseTimepoint( targetType, f, images, models, size, offset, tiles, subpixelResolution, fusionType, noOverlap, ignoreZeroValues,
+						new File( outputDirectory, "img_t" + lz( t, numTimePoints ) + ".tif" ).getAbsolutePath(), t, compression, predictor ) )
+					failed = true;
+
+				budget.release( bytesPerTimepoint );
+
+				IJ.showStatus( "Fused time point " + ( ++done ) + " of " + numTimePoints );
+			});
+		}
+
+		group.wait();
+
+		IJ.showStatus( "Fusion complete." );
+
+		// reset the progress bar
+		IJ.showProgress( 1.01 );
+
+		return !failed;
+	}
+
+	/**
+	 * Fuses all channels of timepoint t and saves them as a CZ hyperstack. The channel
+	 * images are interleaved into the stack without copying any pixels.
+	 * 
+	 * @return false if the file could not be written
+	 */
+	private static < T : public RealType< T > & NativeType< T > > boolean fuseTimepoint( T targetType, ImgFactory<T> f, ArrayList< ImagePlus > images, ArrayList< InvertibleBoundable > models,
+			int[] size, double[] offset, List<ClassifiedRegion> tiles, boolean subpixelResolution, int fusionType, boolean noOverlap, boolean ignoreZeroValues,
+			String filename, int t, int compression, boolean predictor )
+	{
+		int numChannels = images.get( 0 ).getNChannels();
+
+		List< Img< T > > out = new ArrayList< Img< T > >();
+		List< ArrayList< ImageInterpolation< ? : public RealType< ? > > > > blockData = new ArrayList< ArrayList< ImageInterpolation< ? : public RealType< ? > > > >();
+		SampleVolume[][] volumes = subpixelResolution ? new SampleVolume[ numChannels ][] : null;
+
+		long long imageBytes = (long long)targetType.getBitsPerPixel() / 8 * numChannels;
+		for ( int d = 0; d < size.length; ++d )
+			imageBytes *= size[ d ];
+
+		// the stack of the timepoint shares the planes of the fused images
+		MemoryCharge charge( MemoryPhase::fusionOutput, imageBytes );
+
+		for ( int c = 1; c <= numChannels; ++c )
+		{
+			out.add( f.create( size, targetType ) );
+			blockData.add( createBlockData( images, c, t ) );
+
+			if ( subpixelResolution )
+				volumes[ c - 1 ] = createSampleVolumes( images, c, t );
+		}
+
+		if ( noOverlap && !subpixelResolution )
+		{
+			for ( int c = 0; c < numChannels; ++c )
+				fuseBlockNoOverlap( out.get( c ), blockData.get( c ), offset, models, false );
+		}
+		else
+		{
+			PixelFusion fusion = createFusion( fusionType, ignoreZeroValues, blockData.get( 0 ) );
+			fuseBlock( out, blockData, volumes, tiles, offset, models, fusion, false );
+		}
+
+		try
+		{
+			int numSlices = size.length == 3 ? size[ 2 ] : 1;
+			ImageStack stack = new ImageStack( size[ 0 ], size[ 1 ] );
+			ImageStack[] channels = new ImageStack[ numChannels ];
+
+			for ( int c = 0; c < numChannels; ++c )
+				channels[ c ] = ((ImagePlusImg<?, ?>)out.get( c )).getImagePlus().getStack();
+
+			// XYCZ, the processors are shared with the fused images
+			for ( int z = 1; z <= numSlices; ++z )
+				for ( int c = 0; c < numChannels; ++c )
+					stack.addSlice( "", channels[ c ].getProcessor( z ) );
+
+			ImagePlus imp = new ImagePlus( "", stack );
+			imp.setCalibration( images.get( 0 ).getCalibration() );
+			imp.setDimensions( numChannels, numSlices, 1 );
+			imp.setOpenAsHyperStack( numChannels > 1 );
+
+			if ( !TiffSaver::save( imp, filename, compression, predictor ) )
+			{
+				LOGERR( "Cannot write " + filename );
+				return false;
+			}
+		}
+		catch ( ImgLibException e )
+		{
+			LOGERR( "Output image has no ImageJ type: " + e );
+			return false;
+		}
+
+		return true;
+	}
+
+	/**
+	 * Fuses into a tiled BigTIFF chunk by chunk, so that neither the fused image nor its
+	 * stack has to fit into memory. The output is cut into chunks of chunkSize x chunkSize
+	 * pixels (and chunkDepth slices in 3d) that are fused in parallel on the pool. A chunk
+	 * only decomposes and samples the images that intersect it, and its slices are written
+	 * as TIFF tiles as soon as it is done. Pages are ordered XYCZT like an ImageJ hyperstack.
+	 * 
+	 * The reduced resolutions of a viewing pyramid (2x, 4x, ...) are computed from each
+	 * chunk right away and stored as SubIFDs of every page, so the fused image is never
+	 * read back.
+	 * 
+	 * @param outputFile - the tiled BigTIFF to write
+	 * @param chunkSize - width and height of a chunk, also the TIFF tile size (multiple of 16)
+	 * @param chunkDepth - slices per chunk, ignored in 2d
+	 * @param pyramidLevels - number of reduced resolutions, -1 means until a page fits into one tile
+	 * @param compression - compression of the tiles, see {@link TiffCodec}
+	 * @param predictor - difference the samples before compressing
+	 * @return false if the file could not be written
+	 */
+	public static < T : public RealType< T > & NativeType< T > > boolean fuseChunked( T targetType, ArrayList< ImagePlus > images, ArrayList< InvertibleBoundable > models, 
+			int dimensionality, boolean subpixelResolution, int fusionType, String outputFile, boolean ignoreZeroValues, int chunkSize, int chunkDepth, int pyramidLevels, int compression, boolean predictor )
+	{
+		// first we need to estimate the boundaries of the new image
+		double[] offset = new double[ dimensionality ];
+		int[] size = new int[ dimensionality ];
+		int numTimePoints = images.get( 0 ).getNFrames();
+		int numChannels = images.get( 0 ).getNChannels();
+		int numImages = images.size();
+		
+		estimateBounds( offset, size, images, models, dimensionality );
+		
+		if ( subpixelResolution )
+			for ( int d = 0; d < size.length; ++d )
+				++size[ d ];
+
+		int numSlices = dimensionality == 3 ? size[ 2 ] : 1;
+
+		if ( dimensionality == 2 )
+			chunkDepth = 1;
+
+		int numPages = numChannels * numSlices * numTimePoints;
+
+		// no level is smaller than a single tile
+		int numLevels = TilePyramid::levelsFor( size[ 0 ], size[ 1 ], chunkSize, chunkSize );
+
+		if ( pyramidLevels >= 0 )
+			numLevels = Math.min( numLevels, 1 + pyramidLevels );
+
+		TiledTiffWriter writer( outputFile, size[ 0 ], size[ 1 ], numPages, chunkSize, chunkSize,
+				targetType.getBitsPerPixel(), targetType instanceof FloatType, numLevels );
+
+		// tiles are compressed by the workers that fused them
+		writer.setCompression( compression, predictor );
+
+		writer.setDescription( "ImageJ=1.53t\nimages=" + numPages + "\nchannels=" + numChannels + "\nslices=" + numSlices +
+				"\nframes=" + numTimePoints + "\nhyperstack=true\nmode=composite\n" );
+
+		if ( !writer.open() )
+			return false;
+
+		TilePyramid pyramid( writer );
+
+		// the bounding box of each image in output coordinates, rounded like in buildTileList
+		int[][] min = new int[ numImages ][ dimensionality ];
+		int[][] max = new int[ numImages ][ dimensionality ];
+
+		for ( int i = 0; i < numImages; ++i )
+		{
+			double[] pos = new double[ dimensionality ];
+			models.get( i ).applyInPlace( pos );
+
+			int[] dim = new int[] { images.get( i ).getWidth(), images.get( i ).getHeight(), images.get( i ).getNSlices() };
+
+			for ( int d = 0; d < dimensionality; ++d )
+			{
+				min[ i ][ d ] = (int) Math.ceil( pos[ d ] - offset[ d ] );
+				max[ i ][ d ] = (int) Math.floor( pos[ d ] - offset[ d ] + dim[ d ] - 1 );
+			}
+		}
+
+		int[] numChunks = new int[] { ( size[ 0 ] + chunkSize - 1 ) / chunkSize, ( size[ 1 ] + chunkSize - 1 ) / chunkSize, ( numSlices + chunkDepth - 1 ) / chunkDepth };
+		long long totalChunks = (long long) numChunks[ 0 ] * numChunks[ 1 ] * numChunks[ 2 ];
+
+		ThreadPool& pool = ThreadPool::global();
+		ImgFactory< T > f = new ArrayImgFactory< T >();
+		atomic< bool > failed( false );
+
+		for ( int t = 1; t <= numTimePoints && !failed; ++t )
+		{
+			IJ.showStatus("Fusing time point: " + t + " of " + numTimePoints + ", " +
+				numChannels + " channel(s) (" + totalChunks + " chunks)...");
+			IJ.showProgress( 0 );
+
+			// all channels of a chunk are fused in one pass
+			List< ArrayList< ImageInterpolation< ? : public RealType< ? > > > > blockData = new ArrayList< ArrayList< ImageInterpolation< ? : public RealType< ? > > > >();
+			SampleVolume[][] volumes = subpixelResolution ? new SampleVolume[ numChannels ][] : null;
+
+			for ( int c = 1; c <= numChannels; ++c )
+			{
+				blockData.add( createBlockData( images, c, t ) );
+
 				if ( subpixelResolution )
+					volumes[ c - 1 ] = createSampleVolumes( images, c, t );
+			}
+
+			PixelFusion fusion = createFusion( fusionType, ignoreZeroValues, blockData.get( 0 ) );
+
+			// one processor per worker, pointed at whichever chunk the worker fuses
+			TileProcessor<T>[] processors = new TileProcessor[ pool.numThreads() ];
+			ImagePlus[] fusionImp = new ImagePlus[ 1 ];
+			atomic<long long> count( 0 );
+			double numPositions = (double) size[ 0 ] * size[ 1 ] * numSlices;
+
+			for ( int i = 0; i < processors.length; ++i )
+				processors[ i ] = new TileProcessor<T>( i, blockData, volumes, numImages, dimensionality, fusion, models, fusionImp, count, numPositions );
+
+			ThreadPool::TaskGroup group;
+
+			for ( long long chunk = 0; chunk < totalChunks; ++chunk )
+			{
+				pool.submit( group, [&, chunk]()
 				{
-					ArrayList< ImageInterpolation< FloatType > > blockData = new ArrayList< ImageInterpolation< FloatType > >();
-
-					// for linear interpolation we want to mirror, otherwise we get black areas at the first and last pixel of each image
-					InterpolatorFactory< FloatType, RandomAccessible< FloatType > > interpolatorFactory = new NLinearInterpolatorFactory< FloatType >();// new OutOfBoundsStrategyMirrorFactory<FloatType>() );
-					
-					for ( ImagePlus imp : images )
-						blockData.add( new ImageInterpolation<FloatType>( ImageJFunctions.convertFloat( Hyperstack_rearranger.getImageChunk( imp, c, t ) ), interpolatorFactory, true ) );
-					
-					// init blending with the images
-					if ( fusionType == 0 )
-					{
-						if ( ignoreZeroValues )
-							fusion = new BlendingPixelFusionIgnoreZero( blockData );
-						else
-							fusion = new BlendingPixelFusion( blockData );
-					}
-					
-					if ( outputDirectory == null )
-					{
-						fuseBlock( out, blockData, offset, models, fusion, displayImages );
-					}
-					else
+					if ( failed )
+						return;
+
+					if ( !fuseChunk( chunk, numChunks, chunkSize, chunkDepth, size, numSlices, offset, min, max,
+							processors[ ThreadPool::workerIndex() ], f, targetType, blockData.get( 0 ), models, pyramid, t, numChannels ) )
+						failed = true;
+				});
+			}
+
+			group.wait();
+		}
+
+		bool closed;
+
+		{
+			TraceSpan span( "save", "io" );
+			closed = writer.close();
+		}
+
+		IJ.showStatus( "Fusion complete." );
+		
+		// reset the progress bar
+		IJ.showProgress( 1.01 );
+
+		return closed && !failed;
+	}
+
+	/**
+	 * Fuses only the chunks of a fixed, unbounded chunk grid that intersect the box
+	 * [dirtyMin, dirtyMax] (in global coordinates) and writes each of them to its own
+	 * tiled TIFF chunk_x#_y#[_z#].tif in the output directory, all channels, slices of the
+	 * chunk and timepoints as pages. The grid is anchored at the origin of the global
+	 * coordinate system, so the chunks of a mosaic stay where they are when it grows and
+	 * adding a tile only rewrites the chunks it touches. Chunks no image intersects are
+	 * not written.
+	 * 
+	 * @return false if a chunk could not be written
+	 */
+	public static < T : public RealType< T > & NativeType< T > > boolean fuseChunkFiles( T targetType, ArrayList< ImagePlus > images, ArrayList< InvertibleBoundable > models, 
+			int dimensionality, boolean subpixelResolution, int fusionType, String outputDirectory, boolean ignoreZeroValues, int chunkSize, int chunkDepth,
+			double[] dirtyMin, double[] dirtyMax, int compression, boolean predictor )
+	{
+		if ( dimensionality == 2 )
+			chunkDepth = 1;
+
+		int[] chunkExtent = new int[] { chunkSize, chunkSize, chunkDepth };
+		int[] firstChunk = new int[ 3 ];
+		int[] lastChunk = new int[ 3 ];
+
+		for ( int d = 0; d < dimensionality; ++d )
+		{
+			firstChunk[ d ] = (int) Math.floor( dirtyMin[ d ] / chunkExtent[ d ] );
+			lastChunk[ d ] = (int) Math.floor( dirtyMax[ d ] / chunkExtent[ d ] );
+		}
+
+		vector< array< int, 3 > > chunks;
+
+		for ( int cz = firstChunk[ 2 ]; cz <= lastChunk[ 2 ]; ++cz )
+			for ( int cy = firstChunk[ 1 ]; cy <= lastChunk[ 1 ]; ++cy )
+				for ( int cx = firstChunk[ 0 ]; cx <= lastChunk[ 0 ]; ++cx )
+					chunks.push_back( { cx, cy, cz } );
+
+		return fuseChunkFiles( targetType, images, models, dimensionality, subpixelResolution, fusionType, outputDirectory, ignoreZeroValues,
+				chunkExtent, chunks, compression, predictor );
+	}
+
+	/**
+	 * Fuses the chunks of candidates that any image intersects into their chunk files. The
+	 * images are selected once for all chunks and the setup of each timepoint (interpolators,
+	 * sample volumes, processors) is built once; the chunks are then written a few per worker
+	 * at a time, so the number of open files stays bounded.
+	 */
+	private static < T : public RealType< T > & NativeType< T > > boolean fuseChunkFiles( T targetType, ArrayList< ImagePlus > allImages, ArrayList< InvertibleBoundable > allModels, 
+			int dimensionality, boolean subpixelResolution, int fusionType, String outputDirectory, boolean ignoreZeroValues, int[] chunkExtent,
+			vector< array< int, 3 > > candidates, int compression, boolean predictor )
+	{
+		int chunkSize = chunkExtent[ 0 ];
+		int chunkDepth = chunkExtent[ 2 ];
+
+		// the images that intersect any of the chunks, and the chunks that any image intersects
+		ArrayList< ImagePlus > images = new ArrayList< ImagePlus >();
+		ArrayList< InvertibleBoundable > models = new ArrayList< InvertibleBoundable >();
+		vector< bool > covered( candidates.size(), false );
+
+		for ( int i = 0; i < allImages.size(); ++i )
+		{
+			double[] pos = new double[ dimensionality ];
+			allModels.get( i ).applyInPlace( pos );
+
+			int[] dim = new int[] { allImages.get( i ).getWidth(), allImages.get( i ).getHeight(), allImages.get( i ).getNSlices() };
+			boolean used = false;
+
+			for ( size_t k = 0; k < candidates.size(); ++k )
+			{
+				boolean intersects = true;
+
+				for ( int d = 0; d < dimensionality; ++d )
+					intersects = intersects && pos[ d ] + dim[ d ] > candidates[ k ][ d ] * chunkExtent[ d ] && pos[ d ] < ( candidates[ k ][ d ] + 1 ) * chunkExtent[ d ];
+
+				if ( intersects )
+					covered[ k ] = used = true;
+			}
+
+			if ( used )
+			{
+				images.add( allImages.get( i ) );
+				models.add( allModels.get( i ) );
+			}
+		}
+
+		vector< array< int, 3 > > chunks;
+
+		for ( size_t k = 0; k < candidates.size(); ++k )
+			if ( covered[ k ] )
+				chunks.push_back( candidates[ k ] );
+
+		if ( chunks.empty() )
+			return true;
+
+		int numImages = images.size();
+		int numTimePoints = images.get( 0 ).getNFrames();
+		int numChannels = images.get( 0 ).getNChannels();
+		int numPages = numChannels * chunkDepth * numTimePoints;
+
+		// the bounding box of each image in global coordinates, rounded like in buildTileList
+		int[][] min = new int[ numImages ][ dimensionality ];
+		int[][] max = new int[ numImages ][ dimensionality ];
+
+		for ( int i = 0; i < numImages; ++i )
+		{
+			double[] pos = new double[ dimensionality ];
+			models.get( i ).applyInPlace( pos );
+
+			int[] dim = new int[] { images.get( i ).getWidth(), images.get( i ).getHeight(), images.get( i ).getNSlices() };
+
+			for ( int d = 0; d < dimensionality; ++d )
+			{
+				min[ i ][ d ] = (int) Math.ceil( pos[ d ] );
+				max[ i ][ d ] = (int) Math.floor( pos[ d ] + dim[ d ] - 1 );
+			}
+		}
+
+		ThreadPool& pool = ThreadPool::global();
+		ImgFactory< T > f = new ArrayImgFactory< T >();
+		atomic< bool > failed( false );
+
+		ImagePlus[] fusionImp = new ImagePlus[ 1 ];
+		atomic<long long> count( 0 );
+		double numPositions = (double) chunks.size() * chunkSize * chunkSize * chunkDepth * numTimePoints;
+
+		// the setup of each timepoint, shared by all batches
+		vector< List< ArrayList< ImageInterpolation< ? : public RealType< ? > > > > > blockData( numTimePoints );
+		vector< SampleVolume[][] > volumes( numTimePoints );
+		vector< TileProcessor<T>[] > processors( numTimePoints );
+
+		for ( int t = 1; t <= numTimePoints; ++t )
+		{
+			blockData[ t - 1 ] = new ArrayList< ArrayList< ImageInterpolation< ? : public RealType< ? > > > >();
+			volumes[ t - 1 ] = subpixelResolution ? new SampleVolume[ numChannels ][] : null;
+
+			for ( int c = 1; c <= numChannels; ++c )
+			{
+				blockData[ t - 1 ].add( createBlockData( images, c, t ) );
+
+				if ( subpixelResolution )
+					volumes[ t - 1 ][ c - 1 ] = createSampleVolumes( images, c, t );
+			}
+
+			PixelFusion fusion = createFusion( fusionType, ignoreZeroValues, blockData[ t - 1 ].get( 0 ) );
+			processors[ t - 1 ] = new TileProcessor[ pool.numThreads() ];
+
+			for ( int i = 0; i < processors[ t - 1 ].length; ++i )
+				processors[ t - 1 ][ i ] = new TileProcessor<T>( i, blockData[ t - 1 ], volumes[ t - 1 ], numImages, dimensionality, fusion, models, fusionImp, count, numPositions );
+		}
+
+		// a few chunks per worker at a time
+		size_t batchSize = 4 * pool.numThreads();
+
+		for ( size_t first = 0; first < chunks.size() && !failed; first += batchSize )
+		{
+			size_t last = Math.min( chunks.size(), first + batchSize );
+
+			// one writer per chunk, all timepoints go into the same file
+			vector< unique_ptr< TiledTiffWriter > > writers;
+			vector< unique_ptr< TilePyramid > > pyramids;
+
+			for ( size_t k = first; k < last; ++k )
+			{
+				writers.emplace_back( new TiledTiffWriter( new File( outputDirectory, chunkFileName( chunks[ k ], dimensionality ) ).getAbsolutePath(), chunkSize, chunkSize, numPages,
+						chunkSize, chunkSize, targetType.getBitsPerPixel(), targetType instanceof FloatType, 1 ) );
+				writers.back()->setCompression( compression, predictor );
+				writers.back()->setDescription( "ImageJ=1.53t\nimages=" + numPages + "\nchannels=" + numChannels + "\nslices=" + chunkDepth +
+						"\nframes=" + numTimePoints + "\nhyperstack=true\nmode=composite\n" );
+
+				if ( !writers.back()->open() )
+					return false;
+
+				pyramids.emplace_back( new TilePyramid( *writers.back() ) );
+			}
+
+			for ( int t = 1; t <= numTimePoints && !failed; ++t )
+			{
+				ThreadPool::TaskGroup group;
+
+				for ( size_t k = first; k < last; ++k )
+				{
+					pool.submit( group, [&, k, t]()
 					{
-						int numSlices;
-						
-						if ( dimensionality == 2 )
-							numSlices = 1;
-						else
-							numSlices = size[ 2 ];
-						
-						writeBlock( out, numSlices, t, numTimePoints, c, numChannels, blockData, offset, models, fusion, outputDirectory );
-					}
+						if ( failed )
+							return;
+
+						// a chunk file is a single chunk of an image that starts at the chunk
+						int[] numChunks = new int[] { 1, 1, 1 };
+						int[] size = new int[] { chunkSize, chunkSize, chunkDepth };
+						double[] offset = new double[ dimensionality ];
+						int[][] chunkMin = new int[ numImages ][ dimensionality ];
+						int[][] chunkMax = new int[ numImages ][ dimensionality ];
+
+						for ( int d = 0; d < dimensionality; ++d )
+						{
+							offset[ d ] = (double) chunks[ k ][ d ] * chunkExtent[ d ];
+
+							for ( int i = 0; i < numImages; ++i )
+							{
+								chunkMin[ i ][ d ] = min[ i ][ d ] - (int) offset[ d ];
+								chunkMax[ i ][ d ] = max[ i ][ d ] - (int) offset[ d ];
+							}
+						}
+
+						if ( !fuseChunk( 0, numChunks, chunkSize, chunkDepth, size, chunkDepth, offset, chunkMin, chunkMax,
+								processors[ t - 1 ][ ThreadPool::workerIndex() ], f, targetType, blockData[ t - 1 ].get( 0 ), models, *pyramids[ k - first ], t, numChannels ) )
+							failed = true;
+					});
 				}
-				else
-				{
-					// can be a mixture of different RealTypes
-					ArrayList< ImageInterpolation< ? : public RealType< ? > > > blockData = new ArrayList< ImageInterpolation< ? : public RealType< ? > > >();
 
-					InterpolatorFactory< FloatType, RandomAccessible< FloatType > > interpolatorFactoryFloat = new NearestNeighborInterpolatorFactory< FloatType >();// new OutOfBoundsStrategyValueFactory<FloatType>() );
-					InterpolatorFactory< UnsignedShortType, RandomAccessible< UnsignedShortType > > interpolatorFactoryShort = new NearestNeighborInterpolatorFactory< UnsignedShortType >();// new OutOfBoundsStrategyValueFactory<UnsignedShortType>() );
-					InterpolatorFactory< UnsignedByteType, RandomAccessible< UnsignedByteType > > interpolatorFactoryByte = new NearestNeighborInterpolatorFactory< UnsignedByteType >();// new OutOfBoundsStrategyValueFactory<UnsignedByteType>() );
+				group.wait();
+			}
+
+			for ( auto& writer : writers )
+				if ( !writer->close() )
+					failed = true;
+		}
+
+		return !failed;
+	}
+
+	/** @return chunk_x#_y#.tif or chunk_x#_y#_z#.tif */
+	public static String chunkFileName( const array< int, 3 >& chunk, int dimensionality )
+	{
+		return "chunk_x" + chunk[ 0 ] + "_y" + chunk[ 1 ] + ( dimensionality == 3 ? "_z" + chunk[ 2 ] : "" ) + ".tif";
+	}
+
+	/**
+	 * One worker of a fusion that is spread over several processes (or nodes) that share the
+	 * output directory. The chunks of the bounding box of the mosaic are numbered row by row
+	 * (slab by slab in 3d) and cut into numPartitions contiguous ranges of rows; worker
+	 * partition fuses the chunk files of its range with {@link #fuseChunkFiles} and then
+	 * writes fusion_#.done. The ranges are disjoint, no two workers ever write the same
+	 * file, and all workers derive them from the same models.
+	 * 
+	 * The worker of partition 0 also writes chunks.txt which describes the grid: chunk size
+	 * and depth, the first and last chunk in each dimension and the number of partitions.
+	 * 
+	 * @return false if a chunk could not be written
+	 */
+	public static < T : public RealType< T > & NativeType< T > > boolean fusePartition( T targetType, ArrayList< ImagePlus > images, ArrayList< InvertibleBoundable > models, 
+			int dimensionality, boolean subpixelResolution, int fusionType, String outputDirectory, boolean ignoreZeroValues, int chunkSize, int chunkDepth,
+			int partition, int numPartitions, int compression, boolean predictor )
+	{
+		if ( numPartitions <= 0 || partition < 0 || partition >= numPartitions )
+		{
+			LOGERR( "Fusion partition " + partition + " of " + numPartitions + " does not exist." );
+			return false;
+		}
+
+		double[] offset = new double[ dimensionality ];
+		int[] size = new int[ dimensionality ];
+
+		estimateBounds( offset, size, images, models, dimensionality );
+
+		if ( dimensionality == 2 )
+			chunkDepth = 1;
+
+		int[] chunkExtent = new int[] { chunkSize, chunkSize, chunkDepth };
+		int[] firstChunk = new int[] { 0, 0, 0 };
+		int[] lastChunk = new int[] { 0, 0, 0 };
+
+		for ( int d = 0; d < dimensionality; ++d )
+		{
+			firstChunk[ d ] = (int) Math.floor( offset[ d ] / chunkExtent[ d ] );
+			lastChunk[ d ] = (int) Math.floor( ( offset[ d ] + size[ d ] - 1 ) / chunkExtent[ d ] );
+		}
+
+		// rows of chunks (y and z), split evenly
+		long long numRows = (long long)( lastChunk[ 1 ] - firstChunk[ 1 ] + 1 ) * ( lastChunk[ 2 ] - firstChunk[ 2 ] + 1 );
+		long long firstRow = numRows * partition / numPartitions;
+		long long lastRow = numRows * ( partition + 1 ) / numPartitions;
+
+		if ( partition == 0 )
+		{
+			FILE* file = fopen( new File( outputDirectory, "chunks.txt" ).getAbsolutePath().c_str(), "w" );
+
+			if ( file == nullptr )
+			{
+				LOGERR( "Cannot write the chunk index to " + outputDirectory );
+				return false;
+			}
+
+			fprintf( file, "chunkSize=%d\nchunkDepth=%d\nfirst=%d,%d,%d\nlast=%d,%d,%d\npartitions=%d\n",
+					chunkSize, chunkDepth, firstChunk[ 0 ], firstChunk[ 1 ], firstChunk[ 2 ], lastChunk[ 0 ], lastChunk[ 1 ], lastChunk[ 2 ], numPartitions );
+			fclose( file );
+		}
+
+		LOGINFO( "Fusion partition " + partition + " of " + numPartitions + ": chunk rows " + firstRow + " to " + ( lastRow - 1 ) + " of " + numRows );
+
+		long time = TimeHelper::milliseconds();
+		int numRowsY = lastChunk[ 1 ] - firstChunk[ 1 ] + 1;
+
+		// the chunks of all rows of the partition, fused with one setup
+		vector< array< int, 3 > > chunks;
+
+		for ( long long row = firstRow; row < lastRow; ++row )
+		{
+			int cy = firstChunk[ 1 ] + (int)( row % numRowsY );
+			int cz = firstChunk[ 2 ] + (int)( row / numRowsY );
+
+			for ( int cx = firstChunk[ 0 ]; cx <= lastChunk[ 0 ]; ++cx )
+				chunks.push_back( { cx, cy, cz } );
+		}
+
+		if ( !fuseChunkFiles( targetType, images, models, dimensionality, subpixelResolution, fusionType, outputDirectory, ignoreZeroValues,
+				chunkExtent, chunks, compression, predictor ) )
+			return false;
+
+		// written under another name and renamed, so nobody sees a partial file
+		String done = new File( outputDirectory, "fusion_" + partition + ".done" ).getAbsolutePath();
+		FILE* file = fopen( ( done + ".tmp" ).c_str(), "w" );
+
+		if ( file == nullptr || fprintf( file, "%lld %lld\n", firstRow, lastRow ) < 0 || fclose( file ) != 0 || rename( ( done + ".tmp" ).c_str(), done.c_str() ) != 0 )
+		{
+			LOGERR( "Cannot write '" + done + "'." );
+			return false;
+		}
+
+		LOGINFO( "Finished fusion partition " + partition + " (" + ( TimeHelper::milliseconds() - time ) + " ms)" );
+
+		return true;
+	}
+
+	/**
+	 * Fuses one chunk of all channels with the {@link TileProcessor} of the calling worker
+	 * and writes its slices as tiles of all levels. Chunks that no image intersects are only
+	 * accounted for in the pyramid, the writer fills them with zeros.
+	 * 
+	 * @return false if a tile could not be written
+	 */
+	private static < T : public RealType< T > & NativeType< T > > boolean fuseChunk( long long chunk, int[] numChunks, int chunkSize, int chunkDepth,
+			int[] size, int numSlices, double[] offset, int[][] min, int[][] max, TileProcessor< T > processor, ImgFactory< T > f, T targetType,
+			ArrayList< ? : public ImageInterpolation< ? : public RealType< ? > > > input, ArrayList< InvertibleBoundable > transform,
+			TilePyramid& pyramid, int t, int numChannels )
+	{
+		int numDimensions = offset.length;
+		int tileX = (int) ( chunk % numChunks[ 0 ] );
+		int tileY = (int) ( ( chunk / numChunks[ 0 ] ) % numChunks[ 1 ] );
+		int firstSlice = (int) ( chunk / ( (long long) numChunks[ 0 ] * numChunks[ 1 ] ) ) * chunkDepth;
+		int depth = Math.min( chunkDepth, numSlices - firstSlice );
+
+		// the part of the output covered by this chunk
+		int[] chunkMin = new int[] { tileX * chunkSize, tileY * chunkSize, firstSlice };
+		int[] chunkExtent = new int[] { Math.min( chunkSize, size[ 0 ] - chunkMin[ 0 ] ), Math.min( chunkSize, size[ 1 ] - chunkMin[ 1 ] ), depth };
+
+		List<Integer> overlapping = new ArrayList<Integer>();
+
+		for ( int i = 0; i < min.length; ++i )
+		{
+			boolean intersects = true;
+
+			for ( int d = 0; d < numDimensions; ++d )
+				intersects = intersects && max[ i ][ d ] >= chunkMin[ d ] && min[ i ][ d ] < chunkMin[ d ] + chunkExtent[ d ];
+
+			if ( intersects )
+				overlapping.add( i );
+		}
+
+		if ( overlapping.isEmpty() )
+		{
+			for ( int z = 0; z < depth; ++z )
+				for ( int c = 0; c < numChannels; ++c )
+					if ( !pyramid.add( ( ( t - 1 ) * numSlices + firstSlice + z ) * numChannels + c, tileX, tileY, nullptr ) )
+						return false;
+
+			return true;
+		}
+
+		double[] chunkOffset = new double[ numDimensions ];
+
+		for ( int d = 0; d < numDimensions; ++d )
+			chunkOffset[ d ] = offset[ d ] + chunkMin[ d ];
+
+		List<ClassifiedRegion> tiles = clipRegions(
+				buildTileList( overlapping, numDimensions, transform, input, chunkOffset ), chunkExtent );
+
+		// chunks at the border are padded to the full tile size
+		List< Img< T > > out = new ArrayList< Img< T > >();
+
+		for ( int c = 0; c < numChannels; ++c )
+		{
+			if ( numDimensions == 3 )
+				out.add( f.create( new int[] { chunkSize, chunkSize, depth }, targetType ) );
+			else
+				out.add( f.create( new int[] { chunkSize, chunkSize }, targetType ) );
+		}
+
+		// the whole chunk is one task already, so its regions are not split any further
+		processor.setOutput( out, chunkOffset, tiles );
+		vector< FusionBlock > blocks = FusionBlockScheduler::blocks( tiles );
+		processor.process( blocks );
+
+		size_t planeBytes = (size_t) chunkSize * chunkSize * ( targetType.getBitsPerPixel() / 8 );
+
+		for ( int z = 0; z < depth; ++z )
+		{
+			for ( int c = 0; c < numChannels; ++c )
+			{
+				const char* data = (const char*) ((ArrayImg< T, ? >) out.get( c )).update( null ).getCurrentStorageArray();
+
+				// XYCZT like an ImageJ hyperstack
+				int page = ( ( t - 1 ) * numSlices + firstSlice + z ) * numChannels + c;
+
+				if ( !pyramid.add( page, tileX, tileY, data + z * planeBytes ) )
+					return false;
+			}
+		}
+
+		return true;
+	}
+
+	/**
+	 * Wraps channel c of timepoint t of every image for the fusion as they are (can be a mixture
+	 * of different RealTypes), sampled at the nearest neighbor. Subpixel fusion interpolates the
+	 * same pixels through {@link #createSampleVolumes}, so there is no float copy of any image.
+	 */
+	private static ArrayList< ImageInterpolation< ? : public RealType< ? > > > createBlockData( ArrayList< ImagePlus > images, int c, int t )
+	{
+		ArrayList< ImageInterpolation< ? : public RealType< ? > > > blockData = new ArrayList< ImageInterpolation< ? : public RealType< ? > > >();
+
+		InterpolatorFactory< FloatType, RandomAccessible< FloatType > > interpolatorFactoryFloat = new NearestNeighborInterpolatorFactory< FloatType >();// new OutOfBoundsStrategyValueFactory<FloatType>() );
+		InterpolatorFactory< UnsignedShortType, RandomAccessible< UnsignedShortType > > interpolatorFactoryShort = new NearestNeighborInterpolatorFactory< UnsignedShortType >();// new OutOfBoundsStrategyValueFactory<UnsignedShortType>() );
+		InterpolatorFactory< UnsignedByteType, RandomAccessible< UnsignedByteType > > interpolatorFactoryByte = new NearestNeighborInterpolatorFactory< UnsignedByteType >();// new OutOfBoundsStrategyValueFactory<UnsignedByteType>() );
+
+		for ( ImagePlus imp : images )
+		{
+			if ( imp.getType() == ImagePlus.GRAY32 )
+				blockData.add( new ImageInterpolation<FloatType>( ImageJFunctions.wrapFloat( Hyperstack_rearranger.getImageChunk( imp, c, t ) ), interpolatorFactoryFloat, false ) );
+			else if ( imp.getType() == ImagePlus.GRAY16 )
+				blockData.add( new ImageInterpolation<UnsignedShortType>( ImageJFunctions.wrapShort( Hyperstack_rearranger.getImageChunk( imp, c, t ) ), interpolatorFactoryShort, false ) );
+			else
+				blockData.add( new ImageInterpolation<UnsignedByteType>( ImageJFunctions.wrapByte( Hyperstack_rearranger.getImageChunk( imp, c, t ) ), interpolatorFactoryByte, false ) );
+		}
+
+		return blockData;
+	}
+
+	/**
+	 * @return true if all models are translations, subpixel fusion can then interpolate
+	 * whole rows with a {@link TranslationInterpolator} instead of pixel by pixel
+	 */
+	private static boolean isTranslationOnly( ArrayList< InvertibleBoundable > models )
+	{
+		for ( InvertibleBoundable model : models )
+			if ( !( model instanceof TranslationModel2D ) && !( model instanceof TranslationModel3D ) )
+				return false;
+
+		return true;
+	}
+
+	/**
+	 * The native planes of channel c of timepoint t of every image for linear interpolation.
+	 * The planes of an image in memory are used as they are. A virtual stack reads a new
+	 * array on every getPixels, so its planes are read once into a {@link PixelVolume}
+	 * that the SampleVolume owns for as long as the fusion uses it.
+	 */
+	private static SampleVolume[] createSampleVolumes( ArrayList< ImagePlus > images, int c, int t )
+	{
+		SampleVolume[] volumes = new SampleVolume[ images.size() ];
+
+		for ( int i = 0; i < images.size(); ++i )
+		{
+			ImagePlus imp = Hyperstack_rearranger.getImageChunk( images.get( i ), c, t );
+
+			if ( imp.getStack().isVirtual() )
+			{
+				if ( imp.getType() == ImagePlus.GRAY32 )
+					volumes[ i ] = SampleVolume::of( loadPixels< float >( imp ) );
+				else if ( imp.getType() == ImagePlus.GRAY16 )
+					volumes[ i ] = SampleVolume::of( loadPixels< uint16_t >( imp ) );
+				else
+					volumes[ i ] = SampleVolume::of( loadPixels< uint8_t >( imp ) );
 
-					for ( ImagePlus imp : images )
-					{
-						if ( imp.getType() == ImagePlus.GRAY32 )
-							blockData.add( new ImageInterpolation<FloatType>( ImageJFunctions.wrapFloat( Hyperstack_rearranger.getImageChunk( imp, c, t ) ), interpolatorFactoryFloat, false ) );
-						else if ( imp.getType() == ImagePlus.GRAY16 )
-							blockData.add( new ImageInterpolation<UnsignedShortType>( ImageJFunctions.wrapShort( Hyperstack_rearranger.getImageChunk( imp, c, t ) ), interpolatorFactoryShort, false ) );
-						else
-							blockData.add( new ImageInterpolation<UnsignedByteType>( ImageJFunctions.wrapByte( Hyperstack_rearranger.getImageChunk( imp, c, t ) ), interpolatorFactoryByte, false ) );
-					}
-					
-					// init blending with the images
-					if ( fusionType == 0 )
-					{
-						if ( ignoreZeroValues )
-							fusion = new BlendingPixelFusionIgnoreZero( blockData );
-						else
-							fusion = new BlendingPixelFusion( blockData );					
-					}
-					
-					if ( outputDirectory == null )
-					{
-						if ( noOverlap )
-							fuseBlockNoOverlap( out, blockData, offset, models, displayImages );
-						else
-							fuseBlock( out, blockData, offset, models, fusion, displayImages );
-					}
-					else
-					{
-						int numSlices;
-						
-						if ( dimensionality == 2 )
-							numSlices = 1;
-						else
-							numSlices = size[ 2 ];
-						
-						writeBlock( out, numSlices, t, numTimePoints, c, numChannels, blockData, offset, models, fusion, outputDirectory );
-					}
-				}
-				
-				// add to stack
-				try 
-				{
-					if ( stack != null )
-					{
-						ImagePlus outImp = ((ImagePlusImg<?, ?>)out).getImagePlus();
-						for ( int z = 1; z <= out.dimension( 2 ); ++z )
-							stack.addSlice( "", outImp.getStack().getProcessor( z ) );
-					}
-				} 
-				catch (ImgLibException e) 
-				{
-					LOGERR( "Output image has no ImageJ type: " + e );
-				}				
+				continue;
 			}
+
+			SampleVolume& volume = volumes[ i ];
+
+			if ( imp.getType() == ImagePlus.GRAY32 )
+				volume.format = PlaneCopy::FLOAT32;
+			else if ( imp.getType() == ImagePlus.GRAY16 )
+				volume.format = PlaneCopy::UINT16;
+			else
+				volume.format = PlaneCopy::UINT8;
+
+			volume.width = imp.getWidth();
+			volume.height = imp.getHeight();
+			volume.depth = imp.getStackSize();
+			volume.rowStride = volume.width;
+
+			for ( int z = 1; z <= volume.depth; ++z )
+				volume.planes.push_back( imp.getStack().getPixels( z ) );
 		}
 
-		IJ.showStatus( "Fusion complete." );
-		
-		// reset the progress bar
-		IJ.showProgress( 1.01 );
+		return volumes;
+	}
 
-		// has been written to disk ...
-		if ( stack == null )
-			return null;
-		
-		//convertXYZCT ...
-		ImagePlus result = new ImagePlus( "", stack );
+	/** Reads every plane of a single channel, single frame image once, into rows that start 64-byte aligned */
+	private static <S> PixelVolume< S > loadPixels( ImagePlus imp )
+	{
+		PixelVolume< S > pixels( imp.getWidth(), imp.getHeight(), 1, imp.getStackSize(), 1, true );
+		PixelView< S > view = pixels.view();
 
-		// transfer calibration from first tile
-		result.setCalibration(images.get(0).getCalibration());
-		
-		// numchannels, z-slices, timepoints (but right now the order is still XYZCT)
-		if ( dimensionality == 3 )
+		for ( int z = 0; z < view.depth; ++z )
 		{
-			result.setDimensions( size[ 2 ], numChannels, numTimePoints );
-			result = OverlayFusion.switchZCinXYCZT( result );
-			return CompositeImageFixer.makeComposite( result, CompositeImage.COMPOSITE );
+			const S* plane = (const S*) imp.getStack().getPixels( z + 1 );
+
+			for ( int y = 0; y < view.height; ++y )
+				std::copy( plane + (size_t) y * view.width, plane + (size_t) ( y + 1 ) * view.width, view.row( y, 0, z, 0 ) );
 		}
 
-		result.setDimensions( numChannels, 1, numTimePoints );
-		
-		if ( numChannels > 1 || numTimePoints > 1 )
-			return CompositeImageFixer.makeComposite( result, CompositeImage.COMPOSITE );
-		return result;
+		return pixels;
 	}
-	
+
 	/**
-	 * Fuse one slice/volume (one channel)
+	 * @param fusionType - 0 == blending, 1 == average, 2 == median, 3 == max, 4 == min, 5 == overlap
+	 * @param blockData - the images, blending needs their sizes
+	 */
+	private static PixelFusion createFusion( int fusionType, boolean ignoreZeroValues, ArrayList< ? : public ImageInterpolation< ? : public RealType< ? > > > blockData )
+	{
+		if ( fusionType == 0 )
+		{
+			if ( ignoreZeroValues )
+				return new BlendingPixelFusionIgnoreZero( blockData );
+			else
+				return new BlendingPixelFusion( blockData );
+		}
+		else if ( fusionType == 1 )
+		{
+			if ( ignoreZeroValues )
+				return new AveragePixelFusionIgnoreZero();
+			else
+				return new AveragePixelFusion();
+		}
+		else if ( fusionType == 2 )
+		{
+			if ( ignoreZeroValues )
+				return new MedianPixelFusionIgnoreZero();
+			else
+				return new MedianPixelFusion();
+		}
+		else if ( fusionType == 3 )
+		{
+			if ( ignoreZeroValues )
+				return new MaxPixelFusionIgnoreZero();
+			else
+				return new MaxPixelFusion();
+		}
+		else if ( fusionType == 4 )
+		{
+			if ( ignoreZeroValues )
+				return new MinPixelFusionIgnoreZero();
+			else
+				return new MinPixelFusion();	
+		}
+		else if ( fusionType == 5 )
+		{
+			return new OverlapFusion();
+		}
+
+		return null;
+	}
+
+	/**
+	 * Fuse one slice/volume of all channels of a timepoint in one pass, the regions, source
+	 * positions and blending weights are computed once for all channels
 	 * 
-	 * @param output - same the type of the ImagePlus input
-	 * @param input - FloatType, because of Interpolation that needs to be done
+	 * @param output - one per channel, same the type of the ImagePlus input
+	 * @param input - the images of each channel sampled at the nearest neighbor
+	 * @param volumes - the native images of each channel if they are linearly interpolated, otherwise null (nearest neighbor)
 	 * @param transform - the transformation
 	 */
-	protected static <T : public RealType<T>> void fuseBlock( Img<T> output, ArrayList< ? : public ImageInterpolation< ? : public RealType< ? > > > input, double[] offset, 
+	protected static <T : public RealType<T>> void fuseBlock( List< Img<T> > output, List< ArrayList< ? : public ImageInterpolation< ? : public RealType< ? > > > > input, SampleVolume[][] volumes, double[] offset, 
 			ArrayList< InvertibleBoundable > transform, PixelFusion fusion, boolean displayFusion )
 	{
-		int numDimensions = output.numDimensions();
-		int numImages = input.size();
-		long size = output.dimension( 0 );
+		// the geometry is the same for all channels
+		List<ClassifiedRegion> tiles =
+			buildTileList(input.get(0).size(), output.get(0).numDimensions(), transform, input.get(0), offset);
 
-		for (int d = 1; d < output.numDimensions(); ++d) {
-			size *= output.dimension(d);
-		}
+		fuseBlock( output, input, volumes, tiles, offset, transform, fusion, displayFusion );
+	}
 
-		List<ClassifiedRegion> tiles =
-			buildTileList(numImages, numDimensions, transform, input, offset);
+	/**
+	 * Same as above with the regions of the output computed before, e.g. once for all
+	 * timepoints that share the models
+	 */
+	protected static <T : public RealType<T>> void fuseBlock( List< Img<T> > output, List< ArrayList< ? : public ImageInterpolation< ? : public RealType< ? > > > > input, SampleVolume[][] volumes, 
+			List<ClassifiedRegion> tiles, double[] offset, ArrayList< InvertibleBoundable > transform, PixelFusion fusion, boolean displayFusion )
+	{
+		int numDimensions = output.get(0).numDimensions();
+		int numImages = input.get(0).size();
+		long size = output.get(0).dimension( 0 );
+
+		for (int d = 1; d < numDimensions; ++d) {
+			size *= output.get(0).dimension(d);
+		}
 
 		IJ.showProgress( 0 );
 
@@ -321,7 +1182,7 @@ class Fusion
 
 		if (displayFusion) {
 			try {
-				fusionImp[0] = ((ImagePlusImg<?, ?>) output).getImagePlus();
+				fusionImp[0] = ((ImagePlusImg<?, ?>) output.get(0)).getImagePlus();
 				fusionImp[0].setTitle("fusing...");
 				fusionImp[0].show();
 			}
@@ -330,57 +1191,34 @@ class Fusion
 			}
 		}
 
-    Thread[] threads = SimpleMultiThreading.newThreads();
-		TileProcessor<T>[] processors = new TileProcessor[threads.length];
-		List<ArrayList<RealRandomAccess<? : public RealType<?>>>> interpolators =
-				new ArrayList<ArrayList<RealRandomAccess<? : public RealType<?>>>>();
-		long positionsPerThread = size / threads.length;
+		// All regions are fused as tasks on the persistent pool. Small regions
+		// (e.g. the thin strips where tiles overlap) are batched into one task,
+		// large ones are cut into cache-sized 2d blocks, so there is neither a
+		// thread creation nor a join barrier per region.
+		ThreadPool& pool = ThreadPool::global();
+		vector< vector< FusionBlock > > tasks = FusionBlockScheduler::schedule(tiles);
 
-		// These fields need to be used within each thread, but modified from
-    // the outer loop. Thus the use of arrays/vectors.
-		int[] count = new int[1]; // positions processed
-		ClassifiedRegion[] currentTile = new ClassifiedRegion[1]; // current region being processed
-		Vector<Chunk> threadChunks = new Vector<Chunk>(); // work divisions for current region
-		int[] loopDim = new int[1]; // Dimension to split up work on
+		// One TileProcessor per worker, each with its own interpolators, fusion
+		// and output access. A worker only ever uses its own processor.
+		TileProcessor<T>[] processors = new TileProcessor[pool.numThreads()];
+		atomic<long long> count(0); // positions processed
 
-		// Initialize the TileProcessors. These will be reused by each thread.
-		for (int i = 0; i < threads.length; ++i) {
+		for (int i = 0; i < processors.length; ++i) {
 			processors[i] =
-				new TileProcessor<T>(i, interpolators, input, threadChunks, numImages,
-					output, fusion, currentTile, transform, fusionImp, count,
-					positionsPerThread, offset, loopDim);
+				new TileProcessor<T>(i, input, volumes, numImages, output, fusion, tiles,
+					transform, fusionImp, count, size, offset);
 		}
 
-		// Process each tile
-		for (int tileIndex = 0; tileIndex < tiles.size(); tileIndex++) {
-			currentTile[0] = tiles.get(tileIndex);
+		ThreadPool::TaskGroup group;
 
-			// Initialize each thread for this tile
-			for (int threadID = 0; threadID < threads.length; ++threadID) {
-				threads[threadID] = new Thread(processors[threadID]);
-			}
-
-			// Decide which dimension to use to split up work for each thread.
-			// We want to pick the largest dimension as this gives us the best chance
-			// of evenly dividing work when using multiple threads
-			int dimensionSize = -1;
-			for (int d=0; d<currentTile[0].size(); d++) {
-				int tmpSize = currentTile[0].get(d).max() - currentTile[0].get(d).min() + 1;
-				if (tmpSize > dimensionSize) {
-					dimensionSize = tmpSize;
-					loopDim[0] = d;
-				}
-			}
-
-			// Specify the loop ranges for each thread
-			threadChunks.clear();
-			threadChunks.addAll(SimpleMultiThreading.divideIntoChunks(dimensionSize,
-				threads.length));
-
-			// Start the work for this tile
-			SimpleMultiThreading.startAndJoin(threads);
+		for (vector< FusionBlock >& task : tasks) {
+			pool.submit(group, [&processors, &task]() {
+				processors[ThreadPool::workerIndex()].process(task);
+			});
 		}
 
+		group.wait();
+
 		if (fusionImp[0] != null) fusionImp[0].hide();
 	}
 
@@ -395,9 +1233,27 @@ class Fusion
 		int numDimensions, ArrayList<InvertibleBoundable> transform,
 		ArrayList<? : public ImageInterpolation<? : public RealType<?>>> input, double[] offset)
 	{
+		List<Integer> images = new ArrayList<Integer>();
+
+		for ( int i = 0; i < numImages; ++i )
+			images.add( i );
+
+		return buildTileList(images, numDimensions, transform, input, offset);
+	}
+
+	/**
+	 * Same as above, but only for the given subset of the images (e.g. the ones
+	 * intersecting a chunk of the output).
+	 */
+	private static List<ClassifiedRegion> buildTileList(List<Integer> images,
+		int numDimensions, ArrayList<InvertibleBoundable> transform,
+		ArrayList<? : public ImageInterpolation<? : public RealType<?>>> input, double[] offset)
+	{
+		TraceSpan span( "region build" );
+
 		Stack<ClassifiedRegion> rawTiles = new Stack<ClassifiedRegion>();
 
-		for ( int i = 0; i < numImages; ++i ){
+		for ( int i : images ){
 				double[] min = new double[ numDimensions ];
 				transform.get(i).applyInPlace(min);
 				ClassifiedRegion shape = new ClassifiedRegion(numDimensions);
@@ -455,6 +1311,33 @@ class Fusion
 		return new ArrayList<ClassifiedRegion>(placedTiles);
 	}
 
+	/**
+	 * Restricts the regions to the box [0, extent) in every dimension, regions
+	 * outside of it are dropped.
+	 */
+	private static List<ClassifiedRegion> clipRegions(List<ClassifiedRegion> regions, int[] extent)
+	{
+		List<ClassifiedRegion> clipped = new ArrayList<ClassifiedRegion>();
+
+		for (ClassifiedRegion r : regions) {
+			ClassifiedRegion region = new ClassifiedRegion(r.size());
+			region.addAllClasses(r);
+			boolean inside = true;
+
+			for (int d = 0; inside && d < r.size(); d++) {
+				int min = Math.max(r.get(d).min(), 0);
+				int max = Math.min(r.get(d).max(), extent[d] - 1);
+				inside = min <= max;
+				region.set(new Interval(min, max), d);
+			}
+
+			if (inside) {
+				clipped.add(region);
+			}
+		}
+		return clipped;
+	}
+
 	/**
 	 * Takes two overlapping regions and deconstructs them into a set of non-overlapping regions.
 	 * Each resulting region gains the classification(s) of its parent(s). Parents are differentiated
@@ -534,154 +1417,257 @@ class Fusion
 
 	/**
 	 * Helper class to perform tile processing (iteration through a region, fusion
-	 * of input pixels, and population of output pixels). Array fields allow one
-	 * to be created per thread, then have values modified externally.
+	 * of input pixels, and population of output pixels). One is created per pool
+	 * worker and fuses the {@link FusionBlock}s of all tasks this worker picks up.
+	 * 
+	 * All channels of a timepoint are fused in the same pass: the channels share
+	 * the geometry, so the source positions and blending weights of a pixel are
+	 * computed once and applied to every channel.
 	 */
-	private static class TileProcessor<T : public RealType<T>> : public Runnable {
+	private static class TileProcessor<T : public RealType<T>> {
 
-			private int loopOffset;
-			private int loopSize;
-			private int[] loopDim;
-
-			private Vector<Chunk> threadChunks;
-			private int threadNumber; // thread id
-			private ClassifiedRegion[] currentTile;
+			private int workerNumber; // worker id
+			private List<ClassifiedRegion> tiles;
 			private ArrayList<InvertibleBoundable> transform;
 			private ImagePlus[] fusionImp;
-			private int[] count;
-			private double positionsPerThread;
+			private atomic<long long>& count;
+			private double numPositions;
 			private double[] offset;
 			private long[] lastDraw = new long[1];
-			private ArrayList<RealRandomAccess<? : public RealType<?>>> in;
+			private int numChannels;
+			private ArrayList<ArrayList<RealRandomAccess<? : public RealType<?>>>> in; // per channel
 			private double[][] inPos;
-			private PixelFusion myFusion;
-			private RandomAccess<T> out;
-
-		public TileProcessor(int threadNumber,
-			List<ArrayList<RealRandomAccess<? : public RealType<?>>>> interpolators,
-			ArrayList<? : public ImageInterpolation<? : public RealType<?>>> input,
-			Vector<Chunk> threadChunks, int numImages, Img<T> output,
-			PixelFusion fusion, ClassifiedRegion[] currentTile,
+			private double[] weights; // of each image at the current position, the same for all channels
+			private PixelFusion[] myFusion; // per channel
+			private RandomAccess<T>[] out; // per channel
+			private FusionBlock block; // block being processed
+
+			// only for linear interpolation, samplers only if all images are translated
+			private SampleVolume[][] volumes; // per channel
+			private double[][] translations;
+			private TranslationInterpolator[][] samplers; // per channel
+			private vector< vector<float> > rows; // per channel and image of the region
+			private vector<float> scratch;
+
+		public TileProcessor(int workerNumber,
+			List<ArrayList<? : public ImageInterpolation<? : public RealType<?>>>> input,
+			SampleVolume[][] volumes, int numImages, List<Img<T>> output, PixelFusion fusion,
+			List<ClassifiedRegion> tiles, ArrayList<InvertibleBoundable> transform,
+			ImagePlus[] fusionImp, atomic<long long>& count, double numPositions,
+			double[] offset)
+		{
+			this(workerNumber, input, volumes, numImages, output.get(0).numDimensions(), fusion,
+				transform, fusionImp, count, numPositions);
+			setOutput(output, offset, tiles);
+		}
+
+		/**
+		 * Creates a processor without output, {@link #setOutput} has to be
+		 * called before processing.
+		 * 
+		 * @param input - the images of each channel
+		 * @param volumes - if not null, the images of each channel are linearly
+		 * interpolated from these native samples, row by row if they are only
+		 * translated
+		 * @param fusion - copied for every channel
+		 */
+		public TileProcessor(int workerNumber,
+			List<ArrayList<? : public ImageInterpolation<? : public RealType<?>>>> input,
+			SampleVolume[][] volumes, int numImages, int numDimensions, PixelFusion fusion,
 			ArrayList<InvertibleBoundable> transform, ImagePlus[] fusionImp,
-			int[] count, double positionsPerThread, double[] offset, int[] loopDim)
+			atomic<long long>& count, double numPositions)
 		{
-			this.threadNumber = threadNumber;
-			this.threadChunks = threadChunks;
-			this.currentTile = currentTile;
+			this.workerNumber = workerNumber;
 			this.transform = transform;
 			this.fusionImp = fusionImp;
 			this.count = count;
-			this.positionsPerThread = positionsPerThread;
-			this.offset = offset;
-			this.loopDim = loopDim;
-
-			in = getThreadInterpolators(interpolators, threadNumber, input, numImages);
-			inPos = new double[numImages][output.numDimensions()];
-			myFusion = fusion.copy();
-			out = output.randomAccess();
-		}
-
-			@Override
-			public void run() {
-
-				// get chunk of pixels to process
-				Chunk myChunk = threadChunks.get(threadNumber);
-				loopOffset = (int) myChunk.getStartPosition();
-				loopSize = (int) myChunk.getLoopSize();
-
-				try {
-					// Process each tile index assigned to this thread
-					// For each position in this tile, fuse its pixels across the
-					// appropriate images
-					// NB: recursion is necessary because there are an arbitrary
-					// number of dimensions in the tile
-					processTile(currentTile[0], 0, myFusion, transform, in, out, inPos,
-						threadNumber, count, lastDraw, fusionImp[0]);
-				}
-				catch (NoninvertibleModelException e) {
-					LOGERR("Cannot invert model, qutting.");
-					return;
+			this.numPositions = numPositions;
+			this.volumes = volumes;
+			this.numChannels = input.size();
+
+			in = new ArrayList<ArrayList<RealRandomAccess<? : public RealType<?>>>>();
+			myFusion = new PixelFusion[numChannels];
+
+			for (int c = 0; c < numChannels; ++c) {
+				ArrayList<RealRandomAccess<? : public RealType<?>>> channelIn = new ArrayList<RealRandomAccess<? : public RealType<?>>>();
+
+				for (int i = 0; i < numImages; ++i) {
+					channelIn.add(input.get(c).get(i).createInterpolator());
 				}
 
+				in.add(channelIn);
+				myFusion[c] = fusion.copy();
+			}
+
+			inPos = new double[numImages][numDimensions];
+			weights = new double[numImages];
+
+			if (volumes != null && isTranslationOnly(transform)) {
+				translations = new double[numImages][numDimensions];
+				samplers = new TranslationInterpolator[numChannels][numImages];
+
+				for (int i = 0; i < numImages; ++i) {
+					transform.get(i).applyInPlace(translations[i]);
+				}
 			}
+		}
 
-			/**
-		 * Helper method to lazily initialize the input image interpolators,
-		 * creating one list per thread.
+		/**
+		 * Points the processor at other outputs, e.g. the next chunk. The
+		 * interpolators and the fusion are kept.
+		 * 
+		 * @param output - one per channel
+		 * @param offset - position of the output's origin in the global coordinates
+		 * @param tiles - the regions of the output, blocks refer to them by index
 		 */
-			private
-				ArrayList<RealRandomAccess<? : public RealType<?>>>
-				getThreadInterpolators(
-					List<ArrayList<RealRandomAccess<? : public RealType<?>>>> interpolators,
-					int threadNumber,
-					ArrayList<? : public ImageInterpolation<? : public RealType<?>>> input,
-					int numImages)
-			{
-				ArrayList<RealRandomAccess<? : public RealType<?>>> in = null;
-				if (threadNumber >= interpolators.size()) {
-					in = new ArrayList<RealRandomAccess<? : public RealType<?>>>();
-					for (int i = 0; i < numImages; ++i) {
-						in.add(input.get(i).createInterpolator());
+		public void setOutput(List<Img<T>> output, double[] offset, List<ClassifiedRegion> tiles) {
+			this.out = new RandomAccess[numChannels];
+			this.offset = offset;
+			this.tiles = tiles;
+
+			for (int c = 0; c < numChannels; ++c) {
+				out[c] = output.get(c).randomAccess();
+			}
+
+			// the fractional shift of each image relative to this output
+			if (samplers != null) {
+				for (int i = 0; i < translations.length; ++i) {
+					double[] shift = new double[offset.length];
+
+					for (int d = 0; d < offset.length; ++d) {
+						shift[d] = translations[i][d] - offset[d];
+					}
+
+					for (int c = 0; c < numChannels; ++c) {
+						samplers[c][i] = TranslationInterpolator(&volumes[c][i], shift, offset.length);
 					}
-					interpolators.add(in);
 				}
-				else {
-					in = interpolators.get(threadNumber);
+			}
+		}
+
+		/**
+		 * Fuses all blocks of one task. For each position in a block, fuse its
+		 * pixels across the images of the region the block belongs to.
+		 */
+		public void process(vector< FusionBlock >& blocks) {
+			try {
+				for (FusionBlock& b : blocks) {
+					TraceSpan span("fuse region", "fusion");
+					block = b;
+					ClassifiedRegion r = tiles.get(b.region);
+
+					if (samplers != null) {
+						processRows(r, r.classArray());
+					}
+					else {
+						// NB: recursion is necessary because there are an arbitrary
+						// number of dimensions in the tile
+						processTile(r, r.classArray(), 0);
+					}
+
+					long long done = count += b.size();
+
+					// Display progress if on worker 0
+					if (workerNumber == 0) {
+						lastDraw[0] = drawFusion(lastDraw[0], fusionImp[0]);
+						IJ.showProgress(done / numPositions);
+					}
 				}
-				return in;
 			}
+			catch (NoninvertibleModelException e) {
+				LOGERR("Cannot invert model, qutting.");
+				return;
+			}
+		}
 
-			/**
-			 * Intermediate helper method to delegate to
-			 * {@link #processTile(ClassifiedRegion, int[], int, PixelFusion, ArrayList, ArrayList, LocalizableByDimCursor, float[], int[], int, int[], long[], ImagePlus)}
-			 */
-		private void processTile(ClassifiedRegion r, int depth,
-			PixelFusion myFusion, ArrayList<InvertibleBoundable> transform,
-			ArrayList<RealRandomAccess<? : public RealType<?>>> in,
-			RandomAccess<T> out, double[][] inPos,
-			int threadNumber, int[] count, long[] lastDraw, ImagePlus fusionImp)
-			throws NoninvertibleModelException
-		{
-			processTile(r, r.classArray(), depth, myFusion, transform, in, out,
-				inPos, threadNumber, count, lastDraw, fusionImp);
+		/**
+		 * Row by row version of {@link #processTile} for translated images: the
+		 * rows of all images and channels of the region are interpolated at once,
+		 * then fused pixel by pixel.
+		 */
+		private void processRows(ClassifiedRegion r, int[] images) {
+			int minX = block.min[0];
+			int n = block.max[0] - minX + 1;
+			boolean is3d = r.size() == 3;
+			int minZ = is3d ? block.min[2] : 0;
+			int maxZ = is3d ? block.max[2] : 0;
+
+			if (rows.size() < numChannels * images.length) {
+				rows.resize(numChannels * images.length);
+			}
+
+			for (int i = 0; i < numChannels * images.length; i++) {
+				rows[i].resize(n);
+			}
+
+			for (int z = minZ; z <= maxZ; ++z) {
+				for (int y = block.min[1]; y <= block.max[1]; ++y) {
+					for (int c = 0; c < numChannels; ++c) {
+						for (int index = 0; index < images.length; index++) {
+							samplers[c][images[index]].sampleRow(minX, y, z, n, rows[c * images.length + index].data(), scratch);
+						}
+
+						out[c].setPosition(minX, 0);
+						out[c].setPosition(y, 1);
+						if (is3d) {
+							out[c].setPosition(z, 2);
+						}
+					}
+
+					for (int x = 0; x < n; ++x) {
+						for (int index = 0; index < images.length; index++) {
+							int image = images[index];
+							// the position in the image, e.g. blending depends on it
+							inPos[image][0] = minX + x + offset[0] - translations[image][0];
+							inPos[image][1] = y + offset[1] - translations[image][1];
+							if (is3d) {
+								inPos[image][2] = z + offset[2] - translations[image][2];
+							}
+							weights[image] = myFusion[0].getWeight(image, inPos[image]);
+						}
+
+						for (int c = 0; c < numChannels; ++c) {
+							myFusion[c].clear();
+
+							for (int index = 0; index < images.length; index++) {
+								int image = images[index];
+								myFusion[c].addWeightedValue(rows[c * images.length + index][x], image, inPos[image], weights[image]);
+							}
+
+							out[c].get().setReal(myFusion[c].getValue());
+
+							if (x + 1 < n) {
+								out[c].fwd(0);
+							}
+						}
+					}
+				}
+			}
 		}
 
 		/**
-		 * Helper method to fuse all the positions of a given
-		 * {@link ClassifiedRegion}. Since we do not know the dimensionality of the
-		 * region, we recurse over each position of each dimension. The tail step of
-		 * each descent iterates over all the images (classes) of the given region,
-		 * fusing the pixel values at the current position of each associated image.
-		 * This value is then set in the output.
+		 * Helper method to fuse all the positions of the current
+		 * {@link FusionBlock} of a {@link ClassifiedRegion}. Since we do not know
+		 * the dimensionality of the region, we recurse over each position of each
+		 * dimension. The tail step of each descent iterates over all the images
+		 * (classes) of the given region, fusing the pixel values at the current
+		 * position of each associated image. This value is then set in the output
+		 * of every channel.
 		 */
-		private void processTile(ClassifiedRegion r, int[] images, int depth,
-			PixelFusion myFusion, ArrayList<InvertibleBoundable> transform,
-			ArrayList<RealRandomAccess<? : public RealType<?>>> in,
-			RandomAccess<T> out, double[][] inPos,
-			int threadNumber, int[] count, long[] lastDraw, ImagePlus fusionImp)
+		private void processTile(ClassifiedRegion r, int[] images, int depth)
 			throws NoninvertibleModelException
 		{
 			// NB: there are two process tile methods, one for in-memory fusion
 			// and one for writing to disk. They are slightly different, but
 			// if one is updated the other should be as well!
 			if (depth < r.size()) {
-				Interval d = r.get(depth);
-
-				// The intervals of the given region define the bounds of
-				// iteration
-				// So we are recursively defining a nested iteration order to
-				// cover each position of the region
-				int start = d.min();
-				int end = d.max();
-
-				// If this is the dimension being split up for multi-threading we
-				// need to update the iteration bounds.
-				if (depth == loopDim[0]) {
-					start += loopOffset;
-					end = start + loopSize - 1;
-				}
+				// The block (a part of the intervals of the given region) defines
+				// the bounds of iteration. So we are recursively defining a nested
+				// iteration order to cover each position of the block
+				int start = block.min[depth];
+				int end = block.max[depth];
 
-				out.setPosition(start, depth);
+				out[0].setPosition(start, depth);
 
 				// NB: can't make this loop inclusive since we don't want the out.fwd
 				// call to go out of bounds, and we can't setPosition (-1) or we
@@ -689,24 +1675,19 @@ class Fusion
 				// do a straight read after the loop.
 				for (int i = start; i < end; i++) {
 					// Recurse to the next depth (dimension)
-					processTile(r, images, depth + 1, myFusion, transform, in, out,
-						inPos, threadNumber, count, lastDraw, fusionImp);
+					processTile(r, images, depth + 1);
 					// move forward
-					out.fwd(depth);
+					out[0].fwd(depth);
 				}
 
 				// Need to read the position.
-				processTile(r, images, depth + 1, myFusion, transform, in, out,
-					inPos, threadNumber, count, lastDraw, fusionImp);
+				processTile(r, images, depth + 1);
 				return;
 			}
 
-			// compute fusion for this position
-			myFusion.clear();
-
 			// Loop over the images in this region
 			for (int d = 0; d < r.size(); d++) {
-				double value = out.getDoublePosition(d) + offset[d];
+				double value = out[0].getDoublePosition(d) + offset[d];
 
 				for (int index = 0; index < images.length; index++) {
 					// Get the positions for the current image
@@ -714,27 +1695,28 @@ class Fusion
 				}
 			}
 
-			// Get the value at each input position
+			// Transform to get the input positions, they are the same for all channels
 			for (int index = 0; index < images.length; index++) {
 				int image = images[index];
-				// Transform to get input position
 				transform.get(image).applyInverseInPlace(inPos[image]);
-				in.get(image).setPosition(inPos[image]);
-				// fuse
-				myFusion.addValue(in.get(image).get().getRealFloat(), image, inPos[image]);
+				weights[image] = myFusion[0].getWeight(image, inPos[image]);
 			}
 
-			// set value
-			out.get().setReal(myFusion.getValue());
+			for (int c = 0; c < numChannels; ++c) {
+				// compute fusion for this position
+				myFusion[c].clear();
+
+				for (int index = 0; index < images.length; index++) {
+					int image = images[index];
+					// fuse
+					myFusion[c].addWeightedValue(sample(volumes == null ? null : volumes[c], in.get(c), image, inPos[image]), image, inPos[image], weights[image]);
+				}
 
-			// Display progress if on thread 0
-			if (threadNumber == 0) {
-				count[0]++;
-				// just every 10000'th pixel
-				if (count[0] % 10000 == 0) {
-					lastDraw[0] = drawFusion(lastDraw[0], fusionImp);
-					IJ.showProgress(count[0] / positionsPerThread);
+				// set value
+				if (c > 0) {
+					out[c].setPosition(out[0]);
 				}
+				out[c].get().setReal(myFusion[c].getValue());
 			}
 		}
 	}
@@ -801,10 +1783,13 @@ class Fusion
 	}
 
 	/**
-	 * Fuse one slice/volume (one channel)
+	 * Fuse one slice/volume (one channel) if no two images overlap
+	 * 
+	 * Every image is copied to its rounded position, plane by plane and row by row
+	 * with bulk memory moves. The images are distributed over the pool threads.
 	 * 
 	 * @param output - same the type of the ImagePlus input
-	 * @param input - FloatType, because of Interpolation that needs to be done
+	 * @param input - the images as wrapped by ImageJ (planar), not interpolated
 	 * @param transform - the transformation
 	 */
 	protected static <T : public RealType<T>> void fuseBlockNoOverlap( Img<T> output, ArrayList< ? : public ImageInterpolation< ? : public RealType< ? > > > input, double[] offset, 
@@ -812,149 +1797,230 @@ class Fusion
 	{
 		int numDimensions = output.numDimensions();
 		int numImages = input.size();
-				
-		// run multithreaded
-		AtomicInteger ai = new AtomicInteger(0);					
-        Thread[] threads = SimpleMultiThreading.newThreads( numImages );
-        
-        for (int ithread = 0; ithread < threads.length; ++ithread)
-            threads[ithread] = new Thread( new Runnable()
-            {
-                @Override
-                public void run()
-                {
-                	// Thread ID
-                	int myImage = ai.getAndIncrement();
-                	
-                	// only the first thread does preview and update the status bar
-                	// this requires no synchronized stuff
-            		long lastDraw = 0;
-            		ImagePlus fusionImp = null;
-
-                	if ( displayFusion && myImage == 0 )
-                	{
-                		try
-            			{
-            				fusionImp = ((ImagePlusImg<?, ?>) output).getImagePlus();
-            				fusionImp.setTitle( "fusing..." );
-            				fusionImp.show();
-            			}
-            			catch ( ImgLibException e )
-            			{
-            				LOGERR( "Output image has no ImageJ type: " + e );
-            			}                		
-                	}
-
-                	Img< ? : public RealType<?> > image = input.get( myImage ).getImg();
-                	int[] translation = new int[ numDimensions ];
-                	
-                	InvertibleBoundable t = transform.get( myImage );
-            		double[] tmp = new double[ numDimensions ];
-            		t.applyInPlace( tmp );
- 
-            		for ( int d = 0; d < numDimensions; ++d )
-            			translation[ d ] = (int) Math.round( tmp[ d ] );
-
-            		Cursor< ? : public RealType<?> > cursor = image.localizingCursor();
-            		RandomAccess< ? : public RealType<?> > randomAccess = output.randomAccess();
-            		int[] pos = new int[ numDimensions ];
-            		
-            		int j = 0;
-            		while ( cursor.hasNext() )
-            		{
-            			cursor.fwd();
-            			cursor.localize( pos );
-            			
-        				// just thread 0
-        				if ( myImage == 0 )
-        				{
-        					// just every 10000'th pixel
-        					if ( j++ % 10000 == 0 )
-        					{
-                				lastDraw = drawFusion( lastDraw, fusionImp );
-        						IJ.showProgress( (double)j / (double)image.size() );
-        					}
-        				}
-          				
-                		for ( int d = 0; d < numDimensions; ++d )
-                		{
-                			pos[ d ] += translation[ d ];
-                			pos[ d ] -= offset[ d ];
-                		}
-                		
-                		randomAccess.setPosition( pos );
-                		randomAccess.get().setReal( cursor.get().getRealFloat() );
-            		}
-            		
-    				if ( fusionImp != null )
-    					fusionImp.hide();
-                 }
-            });
-        
-        SimpleMultiThreading.startAndJoin( threads );        
+
+		// only the first worker does preview and update the status bar
+		long[] lastDraw = new long[ 1 ];
+		ImagePlus fusionImp = null;
+
+		if ( displayFusion )
+		{
+			try
+			{
+				fusionImp = ((ImagePlusImg<?, ?>) output).getImagePlus();
+				fusionImp.setTitle( "fusing..." );
+				fusionImp.show();
+			}
+			catch ( ImgLibException e )
+			{
+				LOGERR( "Output image has no ImageJ type: " + e );
+			}
+		}
+
+		PlanarImg< T, ? > out = (PlanarImg< T, ? >) output;
+		PlaneCopy::Format outFormat = planeFormat( output.firstElement() );
+		int outDepth = numDimensions == 3 ? (int) output.dimension( 2 ) : 1;
+		atomic<long long> count( 0 ); // images copied
+
+		ThreadPool::global().parallelFor( 0, numImages, 1, [&]( long long from, long long to )
+		{
+			for ( int i = (int) from; i < to; ++i )
+			{
+				Img< ? : public RealType<?> > image = input.get( i ).getImg();
+				PlanarImg< ?, ? > in = (PlanarImg< ?, ? >) image;
+				PlaneCopy::Format inFormat = planeFormat( image.firstElement() );
+
+				// the rounded position of the image in the output
+				double[] tmp = new double[ numDimensions ];
+				transform.get( i ).applyInPlace( tmp );
+
+				int[] translation = new int[ 3 ];
+
+				for ( int d = 0; d < numDimensions; ++d )
+					translation[ d ] = (int) Math.round( tmp[ d ] - offset[ d ] );
+
+				int depth = numDimensions == 3 ? (int) image.dimension( 2 ) : 1;
+
+				for ( int z = 0; z < depth; ++z )
+				{
+					int outZ = z + translation[ 2 ];
+
+					if ( outZ < 0 || outZ >= outDepth )
+						continue;
+
+					PlaneCopy::copy( in.getPlane( z ).getCurrentStorageArray(), inFormat, (int) image.dimension( 0 ), (int) image.dimension( 1 ),
+							out.getPlane( outZ ).getCurrentStorageArray(), outFormat, (int) output.dimension( 0 ), (int) output.dimension( 1 ),
+							translation[ 0 ], translation[ 1 ] );
+				}
+
+				long long done = ++count;
+
+				if ( ThreadPool::workerIndex() <= 0 )
+				{
+					lastDraw[ 0 ] = drawFusion( lastDraw[ 0 ], fusionImp );
+					IJ.showProgress( (double) done / (double) numImages );
+				}
+			}
+		});
+
+		if ( fusionImp != null )
+			fusionImp.hide();
+	}
+
+	/**
+	 * @return the sample format of the planes of an ImageJ image of the given type
+	 */
+	private static PlaneCopy::Format planeFormat( RealType< ? > type )
+	{
+		if ( type instanceof FloatType )
+			return PlaneCopy::FLOAT32;
+		else if ( type instanceof UnsignedShortType )
+			return PlaneCopy::UINT16;
+		else
+			return PlaneCopy::UINT8;
 	}
 
 	/**
 	 * Fuse one slice/volume (one channel)
 	 * 
+	 * Slices are fused in parallel on the pool, each into its own slice image. A
+	 * dedicated writer thread saves them in order while the next slices are being
+	 * fused; at most {@link #writeQueueSize} slices are in flight at any time.
+	 * 
 	 * @param outputSlice - same the type of the ImagePlus input, just one slice which will be written to the output directory
-	 * @param input - FloatType, because of Interpolation that needs to be done
+	 * @param input - the images sampled at the nearest neighbor
+	 * @param volumes - the native images if they are linearly interpolated, otherwise null
 	 * @param transform - the transformation
+	 * @return false if a slice could not be fused or saved, the slices after it are not written
 	 */
-	protected static <T : public RealType<T>> void writeBlock( Img<T> outputSlice, int numSlices, int t, int numTimePoints, int c, int numChannels, 
-			ArrayList< ? : public ImageInterpolation< ? : public RealType< ? > > > input, double[] offset, 
+	protected static <T : public RealType<T>> boolean writeBlock( Img<T> outputSlice, int numSlices, int t, int numTimePoints, int c, int numChannels, 
+			ArrayList< ? : public ImageInterpolation< ? : public RealType< ? > > > input, SampleVolume[] volumes, double[] offset, 
 			ArrayList< InvertibleBoundable > transform, PixelFusion fusion, String outputDirectory )
 	{
 		int numImages = input.size();
 		int numDimensions = offset.length;
 
+		// a 2d fusion is a single slice, all workers can fuse it region by region
+		if ( numDimensions == outputSlice.numDimensions() )
+		{
+			fuseBlock( Arrays.asList( outputSlice ), Arrays.asList( input ), volumes == null ? null : new SampleVolume[][] { volumes }, offset, transform, fusion, false );
+			return saveSlice( outputSlice, outputDirectory, 0, numSlices, t, numTimePoints, c, numChannels );
+		}
+
 		List<ClassifiedRegion> tiles =
 				buildTileList(numImages, numDimensions, transform, input, offset);
 		
-		ArrayList<RealRandomAccess<? : public RealType<?>>> in = new ArrayList<RealRandomAccess<? : public RealType<?>>>();
-		
-		for ( int i = 0; i < numImages; ++i )
-			in.add( input.get( i ).createInterpolator() );
-		
-		PixelFusion myFusion = fusion.copy();
-		
-		try 
+		ThreadPool& pool = ThreadPool::global();
+
+		// interpolators and fusion of each worker
+		ArrayList<ArrayList<RealRandomAccess<? : public RealType<?>>>> in = new ArrayList<ArrayList<RealRandomAccess<? : public RealType<?>>>>();
+		PixelFusion[] myFusion = new PixelFusion[ pool.numThreads() ];
+
+		for ( int w = 0; w < pool.numThreads(); ++w )
+		{
+			ArrayList<RealRandomAccess<? : public RealType<?>>> workerIn = new ArrayList<RealRandomAccess<? : public RealType<?>>>();
+
+			for ( int i = 0; i < numImages; ++i )
+				workerIn.add( input.get( i ).createInterpolator() );
+
+			in.add( workerIn );
+			myFusion[ w ] = fusion.copy();
+		}
+
+		// fused slices wait here until all slices before them are written
+		int queueSize = writeQueueSize > 0 ? writeQueueSize : 2 * pool.numThreads();
+		ReorderBuffer< Img<T> > fused( numSlices, queueSize );
+		atomic< int > written( 0 );
+
+		thread writer( [&]()
 		{
-			long sliceSize = outputSlice.size();
-			for ( int slice = 0; slice < numSlices; ++slice )
+			Img<T> slice;
+
+			for ( int z = 0; fused.take( slice ); ++z )
 			{
-				IJ.showStatus("Fusing time point: " + t + " of " + numTimePoints + ", " +
-						"channel: " + c + " of " + numChannels + ", slice: " + (slice + 1) + " of " +
+				IJ.showStatus("Writing time point: " + t + " of " + numTimePoints + ", " +
+						"channel: " + c + " of " + numChannels + ", slice: " + (z + 1) + " of " +
 						numSlices + "...");
 
-				RandomAccess<T> out = outputSlice.randomAccess();
-				double[][] inPos = new double[ numImages ][ numDimensions ];
-				int[] count = new int[1];
+				if ( !saveSlice( slice, outputDirectory, z, numSlices, t, numTimePoints, c, numChannels ) )
+					fused.abort();
+				else
+					++written;
+
+				IJ.showProgress( (double)( z + 1 ) / (double)numSlices );
+			}
+		});
+
+		IJ.showProgress(0);
 
-				IJ.showProgress(0);
-				
-				// just like fuseBlock but pin to the current slice #
-				for (long tileIndex=0; tileIndex<tiles.size(); tileIndex++) {
-					ClassifiedRegion currentTile = tiles.get((int) tileIndex);
-					writeTile(currentTile, 0, slice, myFusion, transform, offset, in, out, inPos, count, sliceSize, numSlices);
+		ThreadPool::TaskGroup group;
+
+		for ( int slice = 0; slice < numSlices && fused.acquire( slice ); ++slice )
+		{
+			pool.submit( group, [&, slice]()
+			{
+				int w = ThreadPool::workerIndex();
+
+				// a slice that is never put would block the writer and, once the buffer is full, this loop
+				try
+				{
+					Img<T> sliceImg = outputSlice.factory().create( outputSlice, outputSlice.firstElement() );
+					RandomAccess<T> out = sliceImg.randomAccess();
+					double[][] inPos = new double[ numImages ][ numDimensions ];
+
+					// just like fuseBlock but pin to the current slice #
+					for ( ClassifiedRegion& currentTile : tiles )
+						if ( currentTile.get( numDimensions - 1 ).contains( slice ) == 0 )
+							writeTile( currentTile, 0, slice, myFusion[ w ], transform, offset, volumes, in.get( w ), out, inPos );
+
+					fused.put( slice, sliceImg );
 				}
-				
-				
-				// write the slice
-				ImagePlus outImp = ((ImagePlusImg<?,?>)outputSlice).getImagePlus();
-				FileSaver fs = new FileSaver( outImp );
-				fs.saveAsTiff( new File( outputDirectory, "img_t" + lz( t, numTimePoints ) + "_z" + lz( slice+1, numSlices ) + "_c" + lz( c, numChannels ) ).getAbsolutePath() );
+				catch ( ... )
+				{
+					fused.abort();
+					throw;
 				}
+			});
+		}
+
+		try 
+		{
+			group.wait();
 		} 
 		catch ( NoninvertibleModelException e ) 
 		{
 			LOGERR( "Cannot invert model, qutting." );
-			return;
+			fused.abort();
+		}
+		catch ( ... )
+		{
+			fused.abort();
+			writer.join();
+			throw;
+		}
+
+		writer.join();
+
+		// the writer stops at the first slice that fails or when the fusion was aborted
+		return written == numSlices;
+	}
+
+	/**
+	 * Writes one fused slice as img_t#_z#_c# into the output directory
+	 * 
+	 * @return false if the slice could not be written
+	 */
+	private static <T : public RealType<T>> boolean saveSlice( Img<T> slice, String outputDirectory, int z, int numSlices, int t, int numTimePoints, int c, int numChannels )
+	{
+		try 
+		{
+			ImagePlus outImp = ((ImagePlusImg<?,?>)slice).getImagePlus();
+			FileSaver fs = new FileSaver( outImp );
+			return fs.saveAsTiff( new File( outputDirectory, "img_t" + lz( t, numTimePoints ) + "_z" + lz( z+1, numSlices ) + "_c" + lz( c, numChannels ) ).getAbsolutePath() );
 		} 
 		catch ( ImgLibException e ) 
 		{
 			LOGERR( "Output image has no ImageJ type: " + e );
-			return;
+			return false;
 		}
 	}
 
@@ -969,9 +2035,8 @@ class Fusion
 	private static <T : public RealType<T>> void writeTile(ClassifiedRegion r,
 		int depth, int slice, PixelFusion myFusion,
 		ArrayList<InvertibleBoundable> transform, double[] offset,
-		ArrayList<RealRandomAccess<? : public RealType<?>>> in,
-		RandomAccess<T> out, double[][] inPos, int[] count,
-		long sliceSize, int numSlices)
+		SampleVolume[] volumes, ArrayList<RealRandomAccess<? : public RealType<?>>> in,
+		RandomAccess<T> out, double[][] inPos)
 		throws NoninvertibleModelException
 	{
 		//NB: there are two process tile methods, one for in-memory fusion
@@ -992,13 +2057,11 @@ class Fusion
 				// The position array will be used to set the in and out positions.
 				// It specifies where we are in the output image
 				// Recurse to the next depth (dimension)
-				writeTile(r, depth+1, slice, myFusion, transform, offset, in, out, inPos,
-					count, sliceSize, numSlices );
+				writeTile(r, depth+1, slice, myFusion, transform, offset, volumes, in, out, inPos);
 				out.fwd(depth);
 			}
 
-			writeTile(r, depth+1, slice, myFusion, transform, offset, in, out, inPos,
-				count, sliceSize, numSlices );
+			writeTile(r, depth+1, slice, myFusion, transform, offset, volumes, in, out, inPos);
 			return;
 		}
 
@@ -1031,23 +2094,28 @@ class Fusion
 			int image = images[index];
 			// Transform to get input position
 			transform.get(image).applyInverseInPlace(inPos[image]);
-			in.get(image).setPosition(inPos[image]);
 			// fuse
-			myFusion.addValue(in.get(image).get().getRealFloat(), image, inPos[image]);
+			myFusion.addValue(sample(volumes, in, image, inPos[image]), image, inPos[image]);
 		}
 
 		// set value
 		out.get().setReal(myFusion.getValue());
+	}
 
-		// set value
-		out.get().setReal(myFusion.getValue());
-
-		// Update progress if necessary
-		count[0]++;
-		if (count[0] % 10000 == 0) {
-			IJ.showProgress( (double)( count[0] + ( slice * sliceSize ) ) / (double)( numSlices * sliceSize ) );
+	/**
+	 * @return the value of an image at a position of the image, linearly interpolated
+	 * from its native samples if there are volumes, otherwise from the interpolator
+	 */
+	private static float sample(SampleVolume[] volumes,
+		ArrayList<RealRandomAccess<? : public RealType<?>>> in, int image,
+		double[] position)
+	{
+		if (volumes != null) {
+			return volumes[image].interpolate(position, position.length);
 		}
 
+		in.get(image).setPosition(position);
+		return in.get(image).get().getRealFloat();
 	}
 
 	private static String lz( int num, int max )
@@ -0,0 +1,140 @@
+#pragma once
+
+#include "header.h"
+#include "ClassifiedRegion.h"
+
+/**
+ * A box inside one {@link ClassifiedRegion}, the unit of work of the fusion.
+ * min/max are inclusive output coordinates, like the {@link Interval}s of the region.
+ */
+struct FusionBlock
+{
+	static const int MAX_DIMENSIONS = 3;
+
+	int region;
+	int numDimensions;
+	int min[MAX_DIMENSIONS];
+	int max[MAX_DIMENSIONS];
+
+	long long size() const
+	{
+		long long s = 1;
+		for (int d = 0; d < numDimensions; ++d)
+			s *= max[d] - min[d] + 1;
+		return s;
+	}
+};
+
+/**
+ * Turns the non-overlapping {@link ClassifiedRegion}s of a fusion into tasks for the
+ * {@link ThreadPool}. Regions smaller than a batch (mostly the thin strips where tiles
+ * overlap) are packed together into one task, regions larger than a block are cut into
+ * 2d blocks of rows that fit into the cache, 3d regions additionally per plane.
+ */
+class FusionBlockScheduler
+{
+public:
+	/** pixels after which a batch of small regions becomes its own task */
+	static const long long defaultBatchSize = 16384;
+
+	/** width and height of the 2d blocks large regions are split into */
+	static const int defaultBlockWidth = 512;
+	static const int defaultBlockHeight = 32;
+
+	/**
+	 * @param regions - the regions as computed by Fusion.buildTileList
+	 * @return the tasks, each one a list of blocks that is processed by one worker
+	 */
+	static vector< vector< FusionBlock > > schedule(const vector< ClassifiedRegion >& regions,
+		long long batchSize = defaultBatchSize, int blockWidth = defaultBlockWidth, int blockHeight = defaultBlockHeight)
+	{
+		vector< vector< FusionBlock > > tasks;
+		vector< FusionBlock > batch;
+		long long batchPixels = 0;
+
+		for (int i = 0; i < (int)regions.size(); ++i)
+		{
+			FusionBlock whole = fullBlock(regions[i], i);
+			long long pixels = whole.size();
+
+			if (pixels <= batchSize)
+			{
+				batch.push_back(whole);
+				batchPixels += pixels;
+
+				if (batchPixels >= batchSize)
+				{
+					tasks.push_back(std::move(batch));
+					batch.clear();
+					batchPixels = 0;
+				}
+			}
+			else
+			{
+				split(whole, blockWidth, blockHeight, tasks);
+			}
+		}
+
+		if (!batch.empty())
+			tasks.push_back(std::move(batch));
+
+		return tasks;
+	}
+
+	/**
+	 * One block per region, for callers that already parallelize at a coarser
+	 * level (e.g. per output chunk).
+	 */
+	static vector< FusionBlock > blocks(const vector< ClassifiedRegion >& regions)
+	{
+		vector< FusionBlock > result;
+		result.reserve(regions.size());
+
+		for (int i = 0; i < (int)regions.size(); ++i)
+			result.push_back(fullBlock(regions[i], i));
+
+		return result;
+	}
+
+protected:
+	static FusionBlock fullBlock(const ClassifiedRegion& region, int index)
+	{
+		FusionBlock block;
+		block.region = index;
+		block.numDimensions = region.size();
+
+		for (int d = 0; d < block.numDimensions; ++d)
+		{
+			block.min[d] = region.get(d).min();
+			block.max[d] = region.get(d).max();
+		}
+
+		return block;
+	}
+
+	/**
+	 * Cuts a region into blockWidth x blockHeight pieces in x/y and single planes in z,
+	 * every piece becomes one task.
+	 */
+	static void split(const FusionBlock& whole, int blockWidth, int blockHeight, vector< vector< FusionBlock > >& tasks)
+	{
+		int minZ = whole.numDimensions > 2 ? whole.min[2] : 0;
+		int maxZ = whole.numDimensions > 2 ? whole.max[2] : 0;
+
+		for (int z = minZ; z <= maxZ; ++z)
+			for (int y = whole.min[1]; y <= whole.max[1]; y += blockHeight)
+				for (int x = whole.min[0]; x <= whole.max[0]; x += blockWidth)
+				{
+					FusionBlock block = whole;
+					block.min[0] = x;
+					block.max[0] = std::min(whole.max[0], x + blockWidth - 1);
+					block.min[1] = y;
+					block.max[1] = std::min(whole.max[1], y + blockHeight - 1);
+
+					if (whole.numDimensions > 2)
+						block.min[2] = block.max[2] = z;
+
+					tasks.push_back(vector< FusionBlock >{ block });
+				}
+	}
+};
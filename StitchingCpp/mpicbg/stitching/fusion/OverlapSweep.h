@@ -0,0 +1,75 @@
+#pragma once
+
+#include "header.h"
+#include <algorithm>
+
+/**
+ * Finds the tiles whose bounding boxes overlap another tile with a sweep along x:
+ * the boxes are visited by increasing min x, and each one is only tested against
+ * the boxes whose x interval is still open. For grids and sparse acquisitions this
+ * is close to O(n log n) instead of testing all pairs.
+ *
+ * Boxes are half-open, [min, max), so tiles that only touch do not overlap.
+ */
+class OverlapSweep
+{
+public:
+	/**
+	 * @param min, max - min and (exclusive) max of each box, all with the same number of dimensions
+	 * @return for each box whether it overlaps at least one other box
+	 */
+	static vector<bool> overlapping(const vector< vector<double> >& min, const vector< vector<double> >& max)
+	{
+		int numBoxes = (int)min.size();
+		vector<bool> result(numBoxes, false);
+
+		vector<int> order(numBoxes);
+		for (int i = 0; i < numBoxes; ++i)
+			order[i] = i;
+
+		std::sort(order.begin(), order.end(), [&](int a, int b) { return min[a][0] < min[b][0]; });
+
+		vector<int> active;
+
+		for (int i : order)
+		{
+			// boxes that end before this one starts can not overlap any later box either
+			active.erase(std::remove_if(active.begin(), active.end(), [&](int a) { return max[a][0] <= min[i][0]; }), active.end());
+
+			for (int a : active)
+			{
+				if (intersects(min[a], max[a], min[i], max[i]))
+				{
+					result[a] = true;
+					result[i] = true;
+				}
+			}
+
+			active.push_back(i);
+		}
+
+		return result;
+	}
+
+	/**
+	 * @return the fraction [0, 1] of the boxes that overlap at least one other box
+	 */
+	static double overlappingFraction(const vector< vector<double> >& min, const vector< vector<double> >& max)
+	{
+		if (min.empty())
+			return 0;
+
+		vector<bool> overlaps = overlapping(min, max);
+		return (double)std::count(overlaps.begin(), overlaps.end(), true) / (double)overlaps.size();
+	}
+
+protected:
+	static bool intersects(const vector<double>& minA, const vector<double>& maxA, const vector<double>& minB, const vector<double>& maxB)
+	{
+		for (size_t d = 0; d < minA.size(); ++d)
+			if (minA[d] >= maxB[d] || minB[d] >= maxA[d])
+				return false;
+
+		return true;
+	}
+};
@@ -20,22 +20,23 @@
  * #L%
  */
 // package mpicbg.stitching.fusion;
+#include "header.h"
+#include "tools/threadpool.h"
+#include "stitching/utils/HyperstackOrder.h"
 
 import fiji.stacks.Hyperstack_rearranger;
 import ij.CompositeImage;
 import ij.IJ;
 import ij.ImagePlus;
 import ij.ImageStack;
-import ij.process.ImageProcessor;
 
 import java.util.ArrayList;
-import java.util.Vector;
-import java.util.concurrent.atomic.AtomicInteger;
+import java.util.Collections;
 
 import mpicbg.models.InvertibleBoundable;
 import mpicbg.models.InvertibleCoordinateTransform;
 import mpicbg.models.NoninvertibleModelException;
-import net.imglib2.Cursor;
+import net.imglib2.RandomAccess;
 import net.imglib2.RandomAccessible;
 import net.imglib2.RealRandomAccess;
 import net.imglib2.RealRandomAccessible;
@@ -47,8 +48,6 @@ import net.imglib2.img.imageplus.ImagePlusImg;
 import net.imglib2.img.imageplus.ImagePlusImgFactory;
 import net.imglib2.interpolation.InterpolatorFactory;
 import net.imglib2.interpolation.randomaccess.NLinearInterpolatorFactory;
-import net.imglib2.multithreading.Chunk;
-import net.imglib2.multithreading.SimpleMultiThreading;
 import net.imglib2.type.NativeType;
 import net.imglib2.type.numeric.RealType;
 import net.imglib2.type.numeric.real.FloatType;
@@ -58,6 +57,11 @@ import stitching.utils.Log;
 
 class OverlayFusion 
 {
+	/**
+	 * Rows of the output fused by one task of {@link #fuseChannel}
+	 */
+	public static int rowsPerTask = 16;
+
 	protected static < T : public RealType< T > & NativeType< T > > CompositeImage createOverlay( T targetType, ImagePlus imp1, ImagePlus imp2, InvertibleBoundable finalModel1, InvertibleBoundable finalModel2, int dimensionality ) 
 	{
 		ArrayList< ImagePlus > images = new ArrayList<ImagePlus>();
@@ -98,36 +102,46 @@ class OverlayFusion
 		// the composite
 		ImageStack stack = new ImageStack( size[ 0 ], size[ 1 ] );
 
+		int numChannels = imp.getNChannels();
+		Img< T >[] fused = new Img[ numImages * numChannels ];
+
+		// all frames and channels are independent, they are fused as tasks on the pool
+		// (and each of them row by row), so the pool stays busy across frames
+		ThreadPool::TaskGroup group;
+
 		for ( int t = 1; t <= numImages; ++t )
 		{
-			for ( int c = 1; c <= imp.getNChannels(); ++c )
+			for ( int c = 1; c <= numChannels; ++c )
 			{
-				Img<T> out = f.create( size, targetType );
-				Img< FloatType > in = ImageJFunctions.convertFloat( Hyperstack_rearranger.getImageChunk( imp, c, t ) );
-
-				fuseChannel( out, Views.interpolate( Views.extendZero( in ), new NLinearInterpolatorFactory< FloatType >() ), offset, models.get( t - 1 ) );
-
-				try
-				{
-					ImagePlus outImp = ((ImagePlusImg<?,?>)out).getImagePlus();
-					for ( int z = 1; z <= out.dimension( 2 ); ++z )
-						stack.addSlice( imp.getTitle(), outImp.getStack().getProcessor( z ) );
-				} 
-				catch (ImgLibException e) 
+				ThreadPool::global().submit( group, [&, t, c]()
 				{
-					LOGERR( "Output image has no ImageJ type: " + e );
-				}				
+					Img<T> out = f.create( size, targetType );
+					Img< FloatType > in = ImageJFunctions.convertFloat( Hyperstack_rearranger.getImageChunk( imp, c, t ) );
+
+					fuseChannel( out, Views.interpolate( Views.extendZero( in ), new NLinearInterpolatorFactory< FloatType >() ), offset, models.get( t - 1 ) );
+					fused[ ( t - 1 ) * numChannels + ( c - 1 ) ] = out;
+				});
 			}
 		}
+
+		group.wait();
+
+		for ( int t = 1; t <= numImages; ++t )
+		{
+			ArrayList< Img< T > > outs = new ArrayList< Img< T > >();
+
+			for ( int c = 1; c <= numChannels; ++c )
+				outs.add( fused[ ( t - 1 ) * numChannels + ( c - 1 ) ] );
+
+			addSlicesXYCZ( stack, outs, imp.getTitle() );
+		}
 		
-		//convertXYZCT ...
 		ImagePlus result = new ImagePlus( "registered " + imp.getTitle(), stack );
 		
-		// numchannels, z-slices, timepoints (but right now the order is still XYZCT)
+		// numchannels, z-slices, timepoints, the stack is XYCZT already
 		if ( dimensionality == 3 )
 		{
-			result.setDimensions( size[ 2 ], imp.getNChannels(), imp.getNFrames() );
-			result = OverlayFusion.switchZCinXYCZT( result );
+			result.setDimensions( imp.getNChannels(), size[ 2 ], imp.getNFrames() );
 			return CompositeImageFixer.makeComposite( result, CompositeImage.COMPOSITE );
 		}
 		result.setDimensions( imp.getNChannels(), 1, imp.getNFrames() );
@@ -160,7 +174,8 @@ class OverlayFusion
 		// the composite
 		ImageStack stack = new ImageStack( size[ 0 ], size[ 1 ] );
 		
-		int numChannels = 0;
+		ArrayList< Img< T > > outs = new ArrayList< Img< T > >();
+		ArrayList< String > labels = new ArrayList< String >();
 		
 		//loop over all images
 		for ( int i = 0; i < images.size(); ++i )
@@ -174,30 +189,23 @@ class OverlayFusion
 				Img< FloatType > in = ImageJFunctions.convertFloat( Hyperstack_rearranger.getImageChunk( imp, c, timepoint ) );
 				
 				fuseChannel( out, Views.interpolate( Views.extendZero( in ), factory), offset, models.get( i + (timepoint - 1) * numImages ) );
-				try 
-				{
-					ImagePlus outImp = ((ImagePlusImg<?,?>)out).getImagePlus();
-					for ( int z = 1; z <= out.dimension( 2 ); ++z )
-						stack.addSlice( imp.getTitle(), outImp.getStack().getProcessor( z ) );
-				} 
-				catch (ImgLibException e) 
-				{
-					LOGERR( "Output image has no ImageJ type: " + e );
-				}
-				
-				// count all channels
-				++numChannels;
+
+				// every channel of every image is a channel of the overlay
+				outs.add( out );
+				labels.add( imp.getTitle() );
 			}
 		}
 
-		//convertXYZCT ...
+		int numChannels = outs.size();
+
+		addSlicesXYCZ( stack, outs, labels );
+
 		ImagePlus result = new ImagePlus( "overlay " + images.get( 0 ).getTitle() + " ... " + images.get( numImages - 1 ).getTitle(), stack );
 		
-		// numchannels, z-slices, timepoints (but right now the order is still XYZCT)
+		// numchannels, z-slices, timepoints, the stack is XYCZT already
 		if ( dimensionality == 3 )
 		{
-			result.setDimensions( size[ 2 ], numChannels, 1 );
-			result = OverlayFusion.switchZCinXYCZT( result );
+			result.setDimensions( numChannels, size[ 2 ], 1 );
 		}
 		else
 		{
@@ -207,9 +215,43 @@ class OverlayFusion
 		return CompositeImageFixer.makeComposite( result, CompositeImage.COMPOSITE );
 	}
 		
+	/**
+	 * Adds the slices of the fused channels of one timepoint to a stack in XYCZ order,
+	 * the processors are shared with the fused images
+	 */
+	private static < T : public RealType< T > > void addSlicesXYCZ( ImageStack stack, ArrayList< Img< T > > channels, ArrayList< String > labels )
+	{
+		try 
+		{
+			ImageStack[] stacks = new ImageStack[ channels.size() ];
+
+			for ( int c = 0; c < channels.size(); ++c )
+				stacks[ c ] = ((ImagePlusImg<?,?>)channels.get( c )).getImagePlus().getStack();
+
+			for ( int z = 1; z <= stacks[ 0 ].getSize(); ++z )
+				for ( int c = 0; c < channels.size(); ++c )
+					stack.addSlice( labels.get( c ), stacks[ c ].getProcessor( z ) );
+		} 
+		catch (ImgLibException e) 
+		{
+			LOGERR( "Output image has no ImageJ type: " + e );
+		}
+	}
+
+	private static < T : public RealType< T > > void addSlicesXYCZ( ImageStack stack, ArrayList< Img< T > > channels, String label )
+	{
+		addSlicesXYCZ( stack, channels, new ArrayList< String >( Collections.nCopies( channels.size(), label ) ) );
+	}
+
 	/**
 	 * Fuse one slice/volume (one channel)
 	 * 
+	 * The output is processed row by row on the pool, rows of consecutive lines (and
+	 * slices) are handed out in pieces of about {@link #rowsPerTask} rows. The models are
+	 * affine, so the source positions of a row are the inverse of its first pixel plus a
+	 * constant step; the transform is inverted three times per row (start, end and a
+	 * check in the middle) instead of once per pixel.
+	 * 
 	 * @param output - same the type of the ImagePlus input
 	 * @param input - FloatType, because of Interpolation that needs to be done
 	 * @param transform - the transformation
@@ -217,103 +259,112 @@ class OverlayFusion
 	protected static <T : public RealType<T>> void fuseChannel( Img<T> output, RealRandomAccessible<FloatType> input, double[] offset, InvertibleCoordinateTransform transform )
 	{
 		int dims = output.numDimensions();
-		long imageSize = output.dimension( 0 );
-		
-		for ( int d = 1; d < output.numDimensions(); ++d )
-			imageSize *= output.dimension( d );
-
-		// run multithreaded
-		AtomicInteger ai = new AtomicInteger(0);					
-        Thread[] threads = SimpleMultiThreading.newThreads();
-
-        Vector<Chunk> threadChunks = SimpleMultiThreading.divideIntoChunks( imageSize, threads.length );
-        
-        for (int ithread = 0; ithread < threads.length; ++ithread)
-            threads[ithread] = new Thread(new Runnable()
-            {
-                @Override
-                public void run()
-                {
-                	// Thread ID
-                	int myNumber = ai.getAndIncrement();
-        
-                	// get chunk of pixels to process
-                	Chunk myChunk = threadChunks.get( myNumber );
-                	long startPos = myChunk.getStartPosition();
-                	long loopSize = myChunk.getLoopSize();
-                	
-            		Cursor<T> out = output.localizingCursor();
-            		RealRandomAccess<FloatType> in = input.realRandomAccess();
-            		
-            		double[] tmp = new double[ input.numDimensions() ];
-            		
-            		try 
-            		{
-                		// move to the starting position of the current thread
-            			out.jumpFwd( startPos );
-            			
-                		// do as many pixels as wanted by this thread
-                        for ( long j = 0; j < loopSize; ++j )
-                        {
-            				out.fwd();
-            				
-            				for ( int d = 0; d < dims; ++d )
-            					tmp[ d ] = out.getDoublePosition( d ) + offset[ d ];
-            				
-            				transform.applyInverseInPlace( tmp );
-            	
-            				in.setPosition( tmp );
-            				out.get().setReal( in.get().get() );
-            			}
-            		} 
-            		catch (NoninvertibleModelException e) 
-            		{
-            			LOGERR( "Cannot invert model, qutting." );
-            			return;
-            		}
-
-                }
-            });
-        
-        SimpleMultiThreading.startAndJoin( threads );
-		
-        /*
-		LocalizableCursor<T> out = output.createLocalizableCursor();
-		Interpolator<FloatType> in = input.createInterpolator( factory );
-		
-		float[] tmp = new float[ input.getNumDimensions() ];
-		
-		try 
+		int width = (int) output.dimension( 0 );
+		int height = (int) output.dimension( 1 );
+		long numRows = height * ( dims == 3 ? output.dimension( 2 ) : 1 );
+
+		ThreadPool::global().parallelFor( 0, numRows, rowsPerTask, [&]( long long from, long long to )
 		{
-			while ( out.hasNext() )
+			RandomAccess<T> out = output.randomAccess();
+			RealRandomAccess<FloatType> in = input.realRandomAccess();
+
+			double[] start = new double[ dims ];
+			double[] step = new double[ dims ];
+			double[] tmp = new double[ dims ];
+
+			try 
 			{
-				out.fwd();
-				
-				for ( int d = 0; d < dims; ++d )
-					tmp[ d ] = out.getPosition( d ) + offset[ d ];
-				
-				transform.applyInverseInPlace( tmp );
-	
-				in.setPosition( tmp );			
-				out.getType().setReal( in.getType().get() );
+				for ( long long row = from; row < to; ++row )
+				{
+					int y = (int) ( row % height );
+					int z = (int) ( row / height );
+
+					out.setPosition( 0, 0 );
+					out.setPosition( y, 1 );
+					if ( dims == 3 )
+						out.setPosition( z, 2 );
+
+					boolean linear = rowTransform( transform, offset, y, z, width, start, step, tmp );
+
+					for ( int x = 0; x < width; ++x )
+					{
+						if ( linear )
+						{
+							for ( int d = 0; d < dims; ++d )
+								tmp[ d ] = start[ d ] + x * step[ d ];
+						}
+						else
+						{
+							// not affine, e.g. a non-linear transform: invert every pixel
+							tmp[ 0 ] = x + offset[ 0 ];
+							tmp[ 1 ] = y + offset[ 1 ];
+							if ( dims == 3 )
+								tmp[ 2 ] = z + offset[ 2 ];
+
+							transform.applyInverseInPlace( tmp );
+						}
+
+						in.setPosition( tmp );
+						out.get().setReal( in.get().get() );
+
+						if ( x + 1 < width )
+							out.fwd( 0 );
+					}
+				}
+			} 
+			catch (NoninvertibleModelException e) 
+			{
+				LOGERR( "Cannot invert model, qutting." );
+				return;
 			}
-		} 
-		catch (NoninvertibleModelException e) 
-		{
-			LOGERR( "Cannot invert model, qutting." );
-			return;
-		}
-		*/
+		});
+	}
+
+	/**
+	 * Source position of the first pixel of a row and the step between its pixels
+	 * 
+	 * @return false if the transform is not linear along the row (the end of the row
+	 * does not match), then every pixel has to be inverted
+	 */
+	private static boolean rowTransform( InvertibleCoordinateTransform transform, double[] offset, int y, int z, int width,
+			double[] start, double[] step, double[] tmp ) throws NoninvertibleModelException
+	{
+		int dims = start.length;
+
+		for ( int d = 0; d < dims; ++d )
+			start[ d ] = ( d == 0 ? 0 : d == 1 ? y : z ) + offset[ d ];
+
+		System.arraycopy( start, 0, tmp, 0, dims );
+		tmp[ 0 ] += Math.max( 1, width - 1 );
+
+		transform.applyInverseInPlace( start );
+		transform.applyInverseInPlace( tmp );
+
+		for ( int d = 0; d < dims; ++d )
+			step[ d ] = ( tmp[ d ] - start[ d ] ) / Math.max( 1, width - 1 );
+
+		// check the middle of the row
+		int middle = width / 2;
+
+		for ( int d = 0; d < dims; ++d )
+			tmp[ d ] = ( d == 0 ? middle : d == 1 ? y : z ) + offset[ d ];
+
+		transform.applyInverseInPlace( tmp );
+
+		for ( int d = 0; d < dims; ++d )
+			if ( Math.abs( tmp[ d ] - ( start[ d ] + middle * step[ d ] ) ) > 1e-6 )
+				return false;
+
+		return true;
 	}
 
-			
 	/**
 	 * Rearranges an ImageJ XYCZT Hyperstack into XYZCT without wasting memory for processing 3d images as a chunk,
 	 * if it is already XYZCT it will shuffle it back to XYCZT
 	 * 
 	 * @param imp - the input {@link ImagePlus}
-	 * @return - an {@link ImagePlus} which can be the same instance if the image is XYZT, XYZ, XYT or XY - otherwise a new instance
-	 * containing the same processors but in the new order XYZCT
+	 * @return - an {@link ImagePlus} which can be the same instance if the image is XYZT, XYZ, XYT or XY - otherwise a composite
+	 * of the same stack, whose slices were reordered to XYZCT in place
 	 */
 	public static ImagePlus switchZCinXYCZT( ImagePlus imp )
 	{
@@ -342,30 +393,22 @@ class OverlayFusion
 			return imp;
 		}
 		
-		// now we have to rearrange
-		ImageStack stack = new ImageStack( imp.getWidth(), imp.getHeight() );
+		// now we have to rearrange, in place: only the slice references move
+		ImageStack stack = imp.getStack();
+		vector<int> target( stack.getSize() );
 		
 		for ( int t = 1; t <= numTimepoints; ++t )
-		{
 			for ( int c = 1; c <= numChannels; ++c )
-			{
 				for ( int z = 1; z <= numZStacks; ++z )
-				{
-					int index = imp.getStackIndex( c, z, t );
-					ImageProcessor ip = imp.getStack().getProcessor( index );
-					stack.addSlice( imp.getStack().getSliceLabel( index ), ip );
-				}
-			}
-		}
-				
-		ImagePlus result = new ImagePlus( newTitle, stack );
+					target[ imp.getStackIndex( c, z, t ) - 1 ] = HyperstackOrder::xyzct( c, z, t, numChannels, numZStacks );
+
+		HyperstackOrder::permute( stack, target );
+
+		imp.setStack( newTitle, stack );
 		// numchannels, z-slices, timepoints 
 		// but of course now reversed...
-		result.setDimensions( numZStacks, numChannels, numTimepoints );
-		result.getCalibration().pixelWidth = imp.getCalibration().pixelWidth;
-		result.getCalibration().pixelHeight = imp.getCalibration().pixelHeight;
-		result.getCalibration().pixelDepth = imp.getCalibration().pixelDepth;
-		CompositeImage composite = CompositeImageFixer.makeComposite( result );
+		imp.setDimensions( numZStacks, numChannels, numTimepoints );
+		CompositeImage composite = CompositeImageFixer.makeComposite( imp );
 		
 		return composite;
 	}
@@ -375,8 +418,8 @@ class OverlayFusion
 	 * if it is already XYCTZ it will shuffle it back to XYCZT
 	 * 
 	 * @param imp - the input {@link ImagePlus}
-	 * @return - an {@link ImagePlus} which can be the same instance if the image is XYC, XYZ, XYT or XY - otherwise a new instance
-	 * containing the same processors but in the new order XYZCT
+	 * @return - an {@link ImagePlus} which can be the same instance if the image is XYC, XYZ, XYT or XY - otherwise a composite
+	 * of the same stack, whose slices were reordered to XYCTZ in place
 	 */
 	public static ImagePlus switchZTinXYCZT( ImagePlus imp )
 	{
@@ -405,30 +448,22 @@ class OverlayFusion
 			return imp;
 		}
 		
-		// now we have to rearrange
-		ImageStack stack = new ImageStack( imp.getWidth(), imp.getHeight() );
+		// now we have to rearrange, in place: only the slice references move
+		ImageStack stack = imp.getStack();
+		vector<int> target( stack.getSize() );
 		
 		for ( int z = 1; z <= numZStacks; ++z )
-		{
 			for ( int t = 1; t <= numTimepoints; ++t )
-			{
 				for ( int c = 1; c <= numChannels; ++c )
-				{
-					int index = imp.getStackIndex( c, z, t );
-					ImageProcessor ip = imp.getStack().getProcessor( index );
-					stack.addSlice( imp.getStack().getSliceLabel( index ), ip );
-				}
-			}
-		}
-		
-		ImagePlus result = new ImagePlus( newTitle, stack );
+					target[ imp.getStackIndex( c, z, t ) - 1 ] = HyperstackOrder::xyctz( c, z, t, numChannels, numTimepoints );
+
+		HyperstackOrder::permute( stack, target );
+
+		imp.setStack( newTitle, stack );
 		// numchannels, z-slices, timepoints 
 		// but of course now reversed...
-		result.setDimensions( numChannels, numTimepoints, numZStacks );
-		result.getCalibration().pixelWidth = imp.getCalibration().pixelWidth;
-		result.getCalibration().pixelHeight = imp.getCalibration().pixelHeight;
-		result.getCalibration().pixelDepth = imp.getCalibration().pixelDepth;
-		CompositeImage composite = CompositeImageFixer.makeComposite(  result );
+		imp.setDimensions( numChannels, numTimepoints, numZStacks );
+		CompositeImage composite = CompositeImageFixer.makeComposite(  imp );
 		
 		return composite;
 	}
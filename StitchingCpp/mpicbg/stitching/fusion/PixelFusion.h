@@ -38,6 +38,20 @@ public:
 	 */
 	virtual void addValue(double value, int imageId, double localPosition[]) = 0;
 
+	/**
+	 * the weight an image gets at a position, the same for all channels of a pixel,
+	 * so it is only computed once when several channels are fused together
+	 *
+	 * @param imageId - from which input image as defined by the id
+	 * @param localPosition - the position inside the input image in local coordinates of the input image
+	 */
+	virtual double getWeight(int /*imageId*/, double /*localPosition*/[]) { return 1; }
+
+	/**
+	 * same as addValue, but with a weight computed by getWeight before
+	 */
+	virtual void addWeightedValue(double value, int imageId, double localPosition[], double /*weight*/) { addValue(value, imageId, localPosition); }
+
 	/**
 	 *  return the result for the current pixel
 	 *
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "header.h"
+#include <cstring>
+#include <cstdint>
+
+/**
+ * Copies a 2d plane of samples into a larger plane at an integer offset, row by
+ * row with bulk memory moves. Used by the fusion when tiles do not overlap and
+ * every output pixel comes from exactly one input pixel.
+ *
+ * Source and target may have different sample formats; the fusion target type is
+ * never narrower than an input, so converting is a plain widening cast.
+ */
+class PlaneCopy
+{
+public:
+	enum Format { UINT8, UINT16, FLOAT32 };
+
+	/**
+	 * @param offsetX, offsetY - position of the source's first pixel in the target, the
+	 * parts of the source outside of the target are skipped
+	 */
+	static void copy(const void* source, Format sourceFormat, int sourceWidth, int sourceHeight,
+		void* target, Format targetFormat, int targetWidth, int targetHeight, int offsetX, int offsetY)
+	{
+		switch (sourceFormat)
+		{
+		case UINT8:
+			copy((const uint8_t*)source, sourceWidth, sourceHeight, target, targetFormat, targetWidth, targetHeight, offsetX, offsetY);
+			break;
+		case UINT16:
+			copy((const uint16_t*)source, sourceWidth, sourceHeight, target, targetFormat, targetWidth, targetHeight, offsetX, offsetY);
+			break;
+		case FLOAT32:
+			copy((const float*)source, sourceWidth, sourceHeight, target, targetFormat, targetWidth, targetHeight, offsetX, offsetY);
+			break;
+		}
+	}
+
+protected:
+	template<class S>
+	static void copy(const S* source, int sourceWidth, int sourceHeight,
+		void* target, Format targetFormat, int targetWidth, int targetHeight, int offsetX, int offsetY)
+	{
+		switch (targetFormat)
+		{
+		case UINT8:
+			copy(source, sourceWidth, sourceHeight, (uint8_t*)target, targetWidth, targetHeight, offsetX, offsetY);
+			break;
+		case UINT16:
+			copy(source, sourceWidth, sourceHeight, (uint16_t*)target, targetWidth, targetHeight, offsetX, offsetY);
+			break;
+		case FLOAT32:
+			copy(source, sourceWidth, sourceHeight, (float*)target, targetWidth, targetHeight, offsetX, offsetY);
+			break;
+		}
+	}
+
+	template<class S, class T>
+	static void copy(const S* source, int sourceWidth, int sourceHeight,
+		T* target, int targetWidth, int targetHeight, int offsetX, int offsetY)
+	{
+		// the part of the source that lands inside the target
+		int minX = std::max(0, -offsetX);
+		int maxX = std::min(sourceWidth, targetWidth - offsetX);
+		int minY = std::max(0, -offsetY);
+		int maxY = std::min(sourceHeight, targetHeight - offsetY);
+
+		if (minX >= maxX)
+			return;
+
+		for (int y = minY; y < maxY; ++y)
+			copyRow(source + (size_t)y * sourceWidth + minX,
+				target + (size_t)(y + offsetY) * targetWidth + offsetX + minX, maxX - minX);
+	}
+
+	template<class S, class T>
+	static void copyRow(const S* source, T* target, int n)
+	{
+		for (int x = 0; x < n; ++x)
+			target[x] = (T)source[x];
+	}
+
+	template<class T>
+	static void copyRow(const T* source, T* target, int n)
+	{
+		std::memcpy(target, source, (size_t)n * sizeof(T));
+	}
+};
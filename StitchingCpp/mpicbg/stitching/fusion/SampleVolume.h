@@ -0,0 +1,127 @@
+#pragma once
+
+#include "header.h"
+#include "PlaneCopy.h"
+#include "tools/pixelvolume.h"
+#include <cmath>
+#include <cstdint>
+#include <memory>
+
+/**
+ * The native samples of one image as ImageJ stores them, one array per plane.
+ *
+ * Subpixel fusion interpolates directly on these 8, 16 or 32 bit samples and only
+ * the interpolated values are float, so no float copy of the image is needed.
+ * Outside the image the samples are mirrored like Views.extendMirrorSingle.
+ *
+ * The planes are either the arrays of an ImagePlus or the planes of a {@link PixelVolume}
+ * the volume keeps alive, rows are rowStride samples apart.
+ */
+struct SampleVolume
+{
+	PlaneCopy::Format format;
+	int width, height, depth;
+	ptrdiff_t rowStride;
+	vector<const void*> planes;
+	std::shared_ptr<const void> owner;
+
+	/** a volume of one channel of one frame of the pixels, which must be contiguous in x */
+	template<class T>
+	static SampleVolume of(PixelView<const T> pixels)
+	{
+		SampleVolume volume;
+		volume.format = formatOf((const T*)nullptr);
+		volume.width = pixels.width;
+		volume.height = pixels.height;
+		volume.depth = pixels.depth;
+		volume.rowStride = pixels.strideY;
+
+		for (int z = 0; z < pixels.depth; ++z)
+			volume.planes.push_back(pixels.row(0, 0, z, 0));
+
+		return volume;
+	}
+
+	/** a volume that owns its pixels, moved out of the caller */
+	template<class T>
+	static SampleVolume of(PixelVolume<T>&& pixels)
+	{
+		auto shared = std::make_shared< PixelVolume<T> >(std::move(pixels));
+		const PixelVolume<T>& owned = *shared;
+
+		SampleVolume volume = of(owned.view());
+		volume.owner = shared;
+
+		return volume;
+	}
+
+	/** the sample at (x, y, z), which must be inside the image */
+	float get(int x, int y, int z) const
+	{
+		size_t i = (size_t)y * rowStride + x;
+
+		switch (format)
+		{
+		case PlaneCopy::UINT8:
+			return ((const uint8_t*)planes[z])[i];
+		case PlaneCopy::UINT16:
+			return ((const uint16_t*)planes[z])[i];
+		default:
+			return ((const float*)planes[z])[i];
+		}
+	}
+
+	/**
+	 * Linear interpolation (bilinear in 2d, trilinear in 3d) at a real position,
+	 * like an NLinearInterpolator on the mirrored image.
+	 */
+	float interpolate(const double* position, int numDimensions) const
+	{
+		int x0 = (int)std::floor(position[0]);
+		int y0 = (int)std::floor(position[1]);
+		float wx = (float)(position[0] - x0);
+		float wy = (float)(position[1] - y0);
+
+		int x[2] = { mirror(x0, width), mirror(x0 + 1, width) };
+		int y[2] = { mirror(y0, height), mirror(y0 + 1, height) };
+
+		if (numDimensions < 3)
+			return plane(x, y, 0, wx, wy);
+
+		int z0 = (int)std::floor(position[2]);
+		float wz = (float)(position[2] - z0);
+
+		float lower = plane(x, y, mirror(z0, depth), wx, wy);
+		float upper = plane(x, y, mirror(z0 + 1, depth), wx, wy);
+
+		return lower + wz * (upper - lower);
+	}
+
+	/** Views.extendMirrorSingle: -1 -> 1, size -> size - 2 */
+	static int mirror(int i, int size)
+	{
+		if (size == 1)
+			return 0;
+
+		int period = 2 * size - 2;
+		i %= period;
+
+		if (i < 0)
+			i += period;
+
+		return i < size ? i : period - i;
+	}
+
+protected:
+	static PlaneCopy::Format formatOf(const uint8_t*) { return PlaneCopy::UINT8; }
+	static PlaneCopy::Format formatOf(const uint16_t*) { return PlaneCopy::UINT16; }
+	static PlaneCopy::Format formatOf(const float*) { return PlaneCopy::FLOAT32; }
+
+	float plane(const int* x, const int* y, int z, float wx, float wy) const
+	{
+		float top = get(x[0], y[0], z) + wx * (get(x[1], y[0], z) - get(x[0], y[0], z));
+		float bottom = get(x[0], y[1], z) + wx * (get(x[1], y[1], z) - get(x[0], y[1], z));
+
+		return top + wy * (bottom - top);
+	}
+};
@@ -0,0 +1,191 @@
+#pragma once
+
+#include "header.h"
+#include "SampleVolume.h"
+#include <cmath>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define STITCHING_SSE2
+#endif
+
+/**
+ * Linear interpolation (bilinear in 2d, trilinear in 3d) of an image that is only
+ * translated.
+ *
+ * For a translation the fractional part of the sampling position is the same for
+ * every output pixel, so the weights are computed once per image. A row of output
+ * pixels is sampled by first blending the (two or four) source rows it falls
+ * between and then blending horizontally, both on whole rows with SIMD. The source
+ * is read in its native 8, 16 or 32 bit type; outside the image it is mirrored like
+ * Views.extendMirrorSingle, just like {@link ImageInterpolation} does.
+ */
+class TranslationInterpolator
+{
+public:
+	TranslationInterpolator() : volume(nullptr), numDimensions(0) {}
+
+	/**
+	 * @param volume - the image, must outlive the interpolator
+	 * @param shift - position of the image's origin in output coordinates
+	 */
+	TranslationInterpolator(const SampleVolume* volume, const double* shift, int numDimensions)
+		: volume(volume), numDimensions(numDimensions)
+	{
+		for (int d = 0; d < 3; ++d)
+		{
+			// source = output - shift = output + base + weight
+			double s = d < numDimensions ? -shift[d] : 0;
+			base[d] = (int)std::floor(s);
+			weight[d] = (float)(s - base[d]);
+		}
+	}
+
+	/**
+	 * Samples n consecutive output pixels starting at output position (x, y, z).
+	 *
+	 * @param row - n values
+	 * @param scratch - temporary memory, e.g. one per thread
+	 */
+	void sampleRow(int x, int y, int z, int n, float* row, vector<float>& scratch) const
+	{
+		// the source columns x + base .. x + base + n are needed for n outputs
+		int sourceX = x + base[0];
+		scratch.resize(3 * ((size_t)n + 1));
+		float* rows = scratch.data();
+		float* upper = rows + n + 1;
+		float* lower = upper + n + 1;
+
+		int y0 = y + base[1];
+
+		if (numDimensions == 3)
+		{
+			int z0 = z + base[2];
+
+			blendRows(sourceX, n + 1, y0, z0, upper, lower);
+			blendRows(sourceX, n + 1, y0, z0 + 1, rows, lower);
+			lerp(upper, rows, weight[2], rows, n + 1);
+		}
+		else
+		{
+			blendRows(sourceX, n + 1, y0, 0, rows, lower);
+		}
+
+		// horizontal: row[i] = (1 - w) * v[i] + w * v[i + 1]
+		lerp(rows, rows + 1, weight[0], row, n);
+	}
+
+protected:
+	/** target = rows y0 and y0 + 1 of plane z blended by the y weight */
+	void blendRows(int sourceX, int n, int y0, int z, float* target, float* tmp) const
+	{
+		loadRow(sourceX, n, SampleVolume::mirror(y0, volume->height), SampleVolume::mirror(z, volume->depth), target);
+		loadRow(sourceX, n, SampleVolume::mirror(y0 + 1, volume->height), SampleVolume::mirror(z, volume->depth), tmp);
+		lerp(target, tmp, weight[1], target, n);
+	}
+
+	/** n samples of a row starting at column sourceX, converted to float */
+	void loadRow(int sourceX, int n, int y, int z, float* target) const
+	{
+		const void* plane = volume->planes[z];
+		size_t offset = (size_t)y * volume->rowStride;
+
+		switch (volume->format)
+		{
+		case PlaneCopy::UINT8:
+			loadRow((const uint8_t*)plane + offset, sourceX, n, target);
+			break;
+		case PlaneCopy::UINT16:
+			loadRow((const uint16_t*)plane + offset, sourceX, n, target);
+			break;
+		case PlaneCopy::FLOAT32:
+			loadRow((const float*)plane + offset, sourceX, n, target);
+			break;
+		}
+	}
+
+	template<class S>
+	void loadRow(const S* source, int sourceX, int n, float* target) const
+	{
+		int width = volume->width;
+
+		// the part inside the image is converted in bulk, the rest is mirrored
+		int first = std::max(0, std::min(n, -sourceX));
+		int last = std::max(first, std::min(n, width - sourceX));
+
+		for (int i = 0; i < first; ++i)
+			target[i] = (float)source[SampleVolume::mirror(sourceX + i, width)];
+
+		convert(source + sourceX + first, target + first, last - first);
+
+		for (int i = last; i < n; ++i)
+			target[i] = (float)source[SampleVolume::mirror(sourceX + i, width)];
+	}
+
+	/** target[i] = a[i] + w * (b[i] - a[i]), target may be a */
+	static void lerp(const float* a, const float* b, float w, float* target, int n)
+	{
+		int i = 0;
+#ifdef STITCHING_SSE2
+		__m128 vw = _mm_set1_ps(w);
+
+		for (; i + 4 <= n; i += 4)
+		{
+			__m128 va = _mm_loadu_ps(a + i);
+			__m128 vb = _mm_loadu_ps(b + i);
+			_mm_storeu_ps(target + i, _mm_add_ps(va, _mm_mul_ps(vw, _mm_sub_ps(vb, va))));
+		}
+#endif
+		for (; i < n; ++i)
+			target[i] = a[i] + w * (b[i] - a[i]);
+	}
+
+	static void convert(const float* source, float* target, int n)
+	{
+		std::copy(source, source + n, target);
+	}
+
+	static void convert(const uint16_t* source, float* target, int n)
+	{
+		int i = 0;
+#ifdef STITCHING_SSE2
+		__m128i zero = _mm_setzero_si128();
+
+		for (; i + 8 <= n; i += 8)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i*)(source + i));
+			_mm_storeu_ps(target + i, _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero)));
+			_mm_storeu_ps(target + i + 4, _mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero)));
+		}
+#endif
+		for (; i < n; ++i)
+			target[i] = source[i];
+	}
+
+	static void convert(const uint8_t* source, float* target, int n)
+	{
+		int i = 0;
+#ifdef STITCHING_SSE2
+		__m128i zero = _mm_setzero_si128();
+
+		for (; i + 16 <= n; i += 16)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i*)(source + i));
+			__m128i lo = _mm_unpacklo_epi8(v, zero);
+			__m128i hi = _mm_unpackhi_epi8(v, zero);
+			_mm_storeu_ps(target + i, _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)));
+			_mm_storeu_ps(target + i + 4, _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)));
+			_mm_storeu_ps(target + i + 8, _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)));
+			_mm_storeu_ps(target + i + 12, _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)));
+		}
+#endif
+		for (; i < n; ++i)
+			target[i] = source[i];
+	}
+
+	const SampleVolume* volume;
+	int numDimensions;
+	int base[3];
+	float weight[3];
+};
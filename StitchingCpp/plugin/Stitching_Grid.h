@@ -21,9 +21,15 @@
  */
 #include "header.h"
 #include "tools/timehelper.h"
+#include "tools/trace.h"
 #include "mpicbg/stitching/StitchingParameters.h"
 #include "mpicbg/stitching/ImageCollectionElement.h"
 #include "mpicbg/stitching/ImagePlusTimePoint.h"
+#include "mpicbg/stitching/MemoryEstimate.h"
+#include "mpicbg/stitching/ShardedRegistration.h"
+#include "stitching/io/TiffCodec.h"
+#include "stitching/io/TiffSaver.h"
+#include "mpicbg/stitching/fusion/OverlapSweep.h"
 
 //import ij.ImagePlus;
 //import ij.io.FileSaver;
@@ -97,6 +103,24 @@ public:
 		params.timeSelect = 0;
 		params.checkPeaks = 5;
 
+		// a restarted run (or one that only fuses differently) reuses the pairwise results,
+		// set useRegistrationJournal = false to always compute them again
+		if (!params.useRegistrationJournal)
+			params.registrationJournal = "";
+		else if (params.registrationJournal.empty())
+			params.registrationJournal = resultDir + "/" + resultFile + ".registration";
+
+		if (!params.traceFile.empty())
+			Trace::global().setEnabled(true);
+
+		// deflate and zstd are only compiled in with STITCHING_HAVE_ZLIB resp. STITCHING_HAVE_ZSTD,
+		// fail now rather than after the registration
+		if (!TiffCodec::available(params.tiffCompression))
+		{
+			LOGERR("TIFF compression " << params.tiffCompression << " is not available in this build. Aborting.");
+			return;
+		}
+
 		// get all imagecollectionelements
 		vector< ImageCollectionElement > elements;
 		if (gridType < 4)
@@ -116,22 +140,29 @@ public:
 			return;
 		}
 
-		// open all images (if not done already by grid parsing) and test them, collect information
+		// open all images (if not done already by grid parsing) and test them, collect information;
+		// a dry run and the shards only need the sizes, their tiles are opened later where needed
+		bool probeVirtual = params.bVirtual || params.dryRun || params.numShards > 0;
 		int numChannels = -1;
 		int numTimePoints = -1;
 
 		bool is2d = false;
 		bool is3d = false;
+		int bytesPerPixel = 0;
 
 		for (ImageCollectionElement& element : elements)
 		{
 			LOGINFO("Loading: " << element.getFile().getAbsolutePath() << " ... ");
 
+			TraceSpan span("probe", "io");
+
 			long time = TimeHelper::milliseconds();
-			ImagePlus imp = element.open(params.bVirtual);
+			ImagePlus imp = element.open(probeVirtual);
 			if (imp == nullptr)
 				return;
 
+			bytesPerPixel = std::max(bytesPerPixel, imp.getBytesPerPixel());
+
 			element.setSize({imp.getWidth(), (int)(imp.getHeight() * invalidScale)});
 
 			time = TimeHelper::milliseconds() - time;
@@ -199,8 +230,45 @@ public:
 
 		params.dimensionality = dimensionality;
 
+		if (params.dryRun)
+		{
+			LOGINFO("Predicted memory:\n" << MemoryEstimate.predict(elements, params, numChannels, numTimePoints, bytesPerPixel).toString());
+
+			for (ImageCollectionElement element : elements)
+				element.close();
+
+			return;
+		}
+
 		// call the stitching
-		vector<ImagePlusTimePoint> optimized = CollectionStitchingImgLib.stitchCollection(elements, params);
+		vector<ImagePlusTimePoint> optimized;
+
+		if (params.numShards > 0)
+		{
+			for (ImageCollectionElement& element : elements)
+				element.close();
+		}
+
+		if (params.numShards > 0 && params.shardIndex >= 0)
+		{
+			// a worker only registers its shard, the reducer optimizes and fuses
+			ShardedRegistration.runShard(elements, params, params.shardDirectory, params.shardIndex, params.numShards);
+
+			for (ImageCollectionElement element : elements)
+				element.close();
+
+			return;
+		}
+		else if (params.numShards > 0)
+		{
+			optimized = ShardedRegistration.reduce(elements, params, params.shardDirectory, params.numShards, params.shardTimeout);
+
+			// the reducer only reads the journals, the fusion opens the optimized tiles
+			for (ImagePlusTimePoint& imt : optimized)
+				imt.setImagePlus(imt.getElement().open(params.bVirtual));
+		}
+		else
+			optimized = CollectionStitchingImgLib.stitchCollection(elements, params);
 
 		if (optimized.empty())
 			return;
@@ -245,33 +313,175 @@ public:
 
 			// test if there is no overlap between any of the tiles
 			// if so fusion can be much faster
-			bool noOverlap = false;
+			bool noOverlap = detectNoOverlap(optimized, images, models, params);
+
+			if (params.outputVariant == 2)
+			{
+				// fuse chunk by chunk straight into the result file, the fused image is never in memory
+				string filename = new File(resultDir, resultFile).getAbsolutePath();
+				bool written = false;
+
+				if (is32bit)
+					written = Fusion.fuseChunked(FloatType(), images, models, params.dimensionality, params.subpixelAccuracy, params.fusionMethod, filename, false, params.fusionChunkSize, params.fusionChunkDepth, params.fusionPyramidLevels, params.tiffCompression, params.tiffPredictor);
+				else if (is16bit)
+					written = Fusion.fuseChunked(UnsignedShortType(), images, models, params.dimensionality, params.subpixelAccuracy, params.fusionMethod, filename, false, params.fusionChunkSize, params.fusionChunkDepth, params.fusionPyramidLevels, params.tiffCompression, params.tiffPredictor);
+				else if (is8bit)
+					written = Fusion.fuseChunked(UnsignedByteType(), images, models, params.dimensionality, params.subpixelAccuracy, params.fusionMethod, filename, false, params.fusionChunkSize, params.fusionChunkDepth, params.fusionPyramidLevels, params.tiffCompression, params.tiffPredictor);
+				else
+					LOGERR("Unknown image type for fusion.");
+
+				LOGINFO("Finished fusion (" << (TimeHelper::milliseconds() - time) << " ms)");
+				LOGINFO("Finished ... (" << (TimeHelper::milliseconds() - startTime) << " ms)");
+
+				if (!written)
+					LOGINFO("images stitching failed");
+			}
+			else if (params.outputVariant == 3)
+			{
+				// timepoints are fused in parallel and written as soon as they are done
+				long long budget = (long long)params.fusionMemoryBudget << 20;
+				bool written = false;
+
+				if (is32bit)
+					written = Fusion.fuseTimepoints(FloatType(), images, models, params.dimensionality, params.subpixelAccuracy, params.fusionMethod, resultDir, noOverlap, false, budget, params.tiffCompression, params.tiffPredictor);
+				else if (is16bit)
+					written = Fusion.fuseTimepoints(UnsignedShortType(), images, models, params.dimensionality, params.subpixelAccuracy, params.fusionMethod, resultDir, noOverlap, false, budget, params.tiffCompression, params.tiffPredictor);
+				else if (is8bit)
+					written = Fusion.fuseTimepoints(UnsignedByteType(), images, models, params.dimensionality, params.subpixelAccuracy, params.fusionMethod, resultDir, noOverlap, false, budget, params.tiffCompression, params.tiffPredictor);
+				else
+					LOGERR("Unknown image type for fusion.");
+
+				LOGINFO("Finished fusion (" << (TimeHelper::milliseconds() - time) << " ms)");
+				LOGINFO("Finished ... (" << (TimeHelper::milliseconds() - startTime) << " ms)");
+
+				if (!written)
+					LOGINFO("images stitching failed");
+			}
+			else if (params.outputVariant == 1)
+			{
+				// every slice is written to params.outputDirectory as soon as it is fused
+				bool written = false;
+
+				if (is32bit)
+					written = Fusion.fuseToDirectory(FloatType(), images, models, params.dimensionality, params.subpixelAccuracy, params.fusionMethod, params.outputDirectory, false);
+				else if (is16bit)
+					written = Fusion.fuseToDirectory(UnsignedShortType(), images, models, params.dimensionality, params.subpixelAccuracy, params.fusionMethod, params.outputDirectory, false);
+				else if (is8bit)
+					written = Fusion.fuseToDirectory(UnsignedByteType(), images, models, params.dimensionality, params.subpixelAccuracy, params.fusionMethod, params.outputDirectory, false);
+				else
+					LOGERR("Unknown image type for fusion.");
+
+				LOGINFO("Finished fusion (" << (TimeHelper::milliseconds() - time) << " ms)");
+				LOGINFO("Finished ... (" << (TimeHelper::milliseconds() - startTime) << " ms)");
+
+				if (!written)
+					LOGINFO("images stitching failed");
+			}
+			else if (params.outputVariant == 4)
+			{
+				// this process fuses its range of chunks, the others write theirs into the same directory
+				bool written = false;
+
+				if (is32bit)
+					written = Fusion.fusePartition(FloatType(), images, models, params.dimensionality, params.subpixelAccuracy, params.fusionMethod, resultDir, false, params.fusionChunkSize, params.fusionChunkDepth, params.fusionPartition, params.numFusionPartitions, params.tiffCompression, params.tiffPredictor);
+				else if (is16bit)
+					written = Fusion.fusePartition(UnsignedShortType(), images, models, params.dimensionality, params.subpixelAccuracy, params.fusionMethod, resultDir, false, params.fusionChunkSize, params.fusionChunkDepth, params.fusionPartition, params.numFusionPartitions, params.tiffCompression, params.tiffPredictor);
+				else if (is8bit)
+					written = Fusion.fusePartition(UnsignedByteType(), images, models, params.dimensionality, params.subpixelAccuracy, params.fusionMethod, resultDir, false, params.fusionChunkSize, params.fusionChunkDepth, params.fusionPartition, params.numFusionPartitions, params.tiffCompression, params.tiffPredictor);
+				else
+					LOGERR("Unknown image type for fusion.");
+
+				LOGINFO("Finished fusion (" << (TimeHelper::milliseconds() - time) << " ms)");
+				LOGINFO("Finished ... (" << (TimeHelper::milliseconds() - startTime) << " ms)");
 
-			if (is32bit)
-				imp = Fusion.fuse(FloatType(), images, models, params.dimensionality, params.subpixelAccuracy, params.fusionMethod, params.outputDirectory, noOverlap, false, params.displayFusion);
+				if (!written)
+					LOGINFO("images stitching failed");
+			}
+			else if (is32bit)
+				imp = Fusion.fuse(FloatType(), images, models, params.dimensionality, params.subpixelAccuracy, params.fusionMethod, null, noOverlap, false, params.displayFusion);
 			else if (is16bit)
-				imp = Fusion.fuse(UnsignedShortType(), images, models, params.dimensionality, params.subpixelAccuracy, params.fusionMethod, params.outputDirectory, noOverlap, false, params.displayFusion);
+				imp = Fusion.fuse(UnsignedShortType(), images, models, params.dimensionality, params.subpixelAccuracy, params.fusionMethod, null, noOverlap, false, params.displayFusion);
 			else if (is8bit)
-				imp = Fusion.fuse(UnsignedByteType(), images, models, params.dimensionality, params.subpixelAccuracy, params.fusionMethod, params.outputDirectory, noOverlap, false, params.displayFusion);
+				imp = Fusion.fuse(UnsignedByteType(), images, models, params.dimensionality, params.subpixelAccuracy, params.fusionMethod, null, noOverlap, false, params.displayFusion);
 			else
 				LOGERR("Unknown image type for fusion.");
 
-			LOGINFO("Finished fusion (" << (TimeHelper::milliseconds() - time) << " ms)");
-			LOGINFO("Finished ... (" << (TimeHelper::milliseconds() - startTime) << " ms)");
+			if (params.outputVariant != 1 && params.outputVariant != 2 && params.outputVariant != 3 && params.outputVariant != 4)
+			{
+				LOGINFO("Finished fusion (" << (TimeHelper::milliseconds() - time) << " ms)");
+				LOGINFO("Finished ... (" << (TimeHelper::milliseconds() - startTime) << " ms)");
 
-			if (imp != nullptr)
-				SavaFile(imp, resultDir, resultFile);
-			else
-				LOGINFO("images stitching failed");
+				if (imp != nullptr)
+					SavaFile(imp, resultDir, resultFile, params);
+				else
+					LOGINFO("images stitching failed");
+
+				// the result is not kept once it is saved
+				MemoryLedger::global().free(MemoryPhase::imageStack, MemoryLedger::global().getLive(MemoryPhase::imageStack));
+			}
 		}
 
 		// close all images
 		for (ImageCollectionElement element : elements)
 			element.close();
+
+		LOGINFO("Memory:\n" << MemoryLedger::global().report());
+
+		if (Trace::global().isEnabled())
+		{
+			LOGINFO("Phases:\n" << Trace::global().summary());
+
+			if (Trace::global().writeChromeTrace(params.traceFile))
+				LOGINFO("Trace written to " << params.traceFile);
+		}
 	}
 
-	void SavaFile(ImagePlus imp, string path, string name)
+	/**
+	 * Sweeps over the bounding boxes of the optimized tiles at their rounded positions
+	 * in the output, round(position - offset) like the fusion without blending puts them.
+	 *
+	 * @return true if no tile overlaps another one, or at most params.noOverlapFraction of them
+	 */
+	bool detectNoOverlap(vector<ImagePlusTimePoint>& optimized, vector<ImagePlus>& images, vector<InvertibleBoundable>& models, const StitchingParameters& params)
 	{
+		double[] offset = new double[params.dimensionality];
+		int[] outputSize = new int[params.dimensionality];
+		Fusion.estimateBounds(offset, outputSize, images, models, params.dimensionality);
+
+		vector< vector<double> > min, max;
+
+		for (ImagePlusTimePoint& imt : optimized)
+		{
+			ImagePlus imp = imt.getImagePlus();
+			int size[] = { imp.getWidth(), imp.getHeight(), imp.getNSlices() };
+
+			double[] position = new double[params.dimensionality];
+			((InvertibleBoundable)imt.getModel()).applyInPlace(position);
+
+			vector<double> tileMin(params.dimensionality), tileMax(params.dimensionality);
+
+			for (int d = 0; d < params.dimensionality; ++d)
+			{
+				tileMin[d] = Math.round(position[d] - offset[d]);
+				tileMax[d] = tileMin[d] + size[d];
+			}
+
+			min.push_back(tileMin);
+			max.push_back(tileMax);
+		}
+
+		double fraction = OverlapSweep::overlappingFraction(min, max);
+		bool noOverlap = fraction <= params.noOverlapFraction;
+
+		LOGINFO((int)std::round(fraction * optimized.size()) << " of " << optimized.size() << " tiles overlap"
+			<< (noOverlap ? ", fusing without blending" : ""));
+
+		return noOverlap;
+	}
+
+	void SavaFile(ImagePlus imp, string path, string name, const StitchingParameters& params)
+	{
+		TraceSpan span("save", "io");
 		FileSaver fs = new FileSaver(imp);
 		LOGINFO(path << " " << name);
 		File file = new File(path, name);
@@ -290,7 +500,14 @@ public:
 			fs.saveAsJpeg(filename);
 			break;
 		default:
-			fs.saveAsTiff(filename);
+			// grayscale results are compressed and written in parallel
+			if (TiffSaver::supports(imp))
+			{
+				if (!TiffSaver::save(imp, filename, params.tiffCompression, params.tiffPredictor))
+					LOGERR("Cannot save the result to " << filename << ".");
+			}
+			else
+				fs.saveAsTiff(filename);
 			break;
 		}
 	}
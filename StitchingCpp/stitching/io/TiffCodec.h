@@ -0,0 +1,262 @@
+#pragma once
+
+#include "header.h"
+#include <cstring>
+#include <cstdint>
+
+#ifdef STITCHING_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef STITCHING_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+/**
+ * Compression and prediction of TIFF tiles/strips.
+ *
+ * LZW is always available. Deflate and zstd need zlib resp. libzstd and are only
+ * compiled in if STITCHING_HAVE_ZLIB resp. STITCHING_HAVE_ZSTD are defined.
+ *
+ * All functions are stateless and can be called from several threads at once.
+ */
+class TiffCodec {
+public:
+	/** values of the Compression tag */
+	static const int NONE = 1;
+	static const int LZW = 5;
+	static const int DEFLATE = 8;
+	static const int ZSTD = 50000;
+
+	static bool available(int compression)
+	{
+		switch (compression)
+		{
+		case NONE:
+		case LZW:
+			return true;
+#ifdef STITCHING_HAVE_ZLIB
+		case DEFLATE:
+			return true;
+#endif
+#ifdef STITCHING_HAVE_ZSTD
+		case ZSTD:
+			return true;
+#endif
+		default:
+			return false;
+		}
+	}
+
+	/** value of the Predictor tag: horizontal differencing for integers, floating point predictor for floats */
+	static int predictor(bool floatingPoint) { return floatingPoint ? 3 : 2; }
+
+	/**
+	 * Applies the predictor in place to rows of width samples each.
+	 */
+	static void predict(char* data, int width, int rows, int bitsPerSample, bool floatingPoint)
+	{
+		if (floatingPoint)
+		{
+			vector<uint8_t> row((size_t)width * 4);
+
+			for (int y = 0; y < rows; ++y)
+				predictFloatRow((uint8_t*)data + (size_t)y * width * 4, row.data(), width);
+		}
+		else if (bitsPerSample == 16)
+		{
+			for (int y = 0; y < rows; ++y)
+				differentiate((uint16_t*)data + (size_t)y * width, width);
+		}
+		else
+		{
+			for (int y = 0; y < rows; ++y)
+				differentiate((uint8_t*)data + (size_t)y * width, width);
+		}
+	}
+
+	/** @return the most bytes that size bytes can be encoded into */
+	static uint64_t bound(int compression, size_t size)
+	{
+		switch (compression)
+		{
+		case LZW:
+			// at most 12 bits per byte, plus a clear code every 3838 codes and the end code
+			return (uint64_t)size + size / 2 + size / 1024 + 16;
+#ifdef STITCHING_HAVE_ZLIB
+		case DEFLATE:
+			return compressBound((uLong)size);
+#endif
+#ifdef STITCHING_HAVE_ZSTD
+		case ZSTD:
+			return ZSTD_compressBound(size);
+#endif
+		default:
+			return size;
+		}
+	}
+
+	/**
+	 * Compresses size bytes into out (which is overwritten).
+	 *
+	 * @return false if the compression is not available or failed
+	 */
+	static bool encode(int compression, const char* data, size_t size, vector<char>& out)
+	{
+		switch (compression)
+		{
+		case NONE:
+			out.assign(data, data + size);
+			return true;
+		case LZW:
+			encodeLZW((const uint8_t*)data, size, out);
+			return true;
+#ifdef STITCHING_HAVE_ZLIB
+		case DEFLATE:
+		{
+			uLongf length = compressBound((uLong)size);
+			out.resize(length);
+
+			if (compress2((Bytef*)out.data(), &length, (const Bytef*)data, (uLong)size, Z_DEFAULT_COMPRESSION) != Z_OK)
+				return false;
+
+			out.resize(length);
+			return true;
+		}
+#endif
+#ifdef STITCHING_HAVE_ZSTD
+		case ZSTD:
+		{
+			out.resize(ZSTD_compressBound(size));
+			size_t length = ZSTD_compress(out.data(), out.size(), data, size, ZSTD_CLEVEL_DEFAULT);
+
+			if (ZSTD_isError(length))
+				return false;
+
+			out.resize(length);
+			return true;
+		}
+#endif
+		default:
+			return false;
+		}
+	}
+
+protected:
+	template<class T>
+	static void differentiate(T* row, int width)
+	{
+		for (int x = width - 1; x > 0; --x)
+			row[x] = (T)(row[x] - row[x - 1]);
+	}
+
+	/**
+	 * Floating point predictor (Adobe TIFF technical note 3): the bytes of a row are
+	 * sorted by significance (most significant first), then differenced.
+	 */
+	static void predictFloatRow(uint8_t* data, uint8_t* tmp, int width)
+	{
+		// little-endian samples, the most significant byte is the last one
+		for (int x = 0; x < width; ++x)
+			for (int b = 0; b < 4; ++b)
+				tmp[(size_t)(3 - b) * width + x] = data[(size_t)x * 4 + b];
+
+		std::memcpy(data, tmp, (size_t)width * 4);
+		differentiate(data, width * 4);
+	}
+
+	/**
+	 * TIFF flavoured LZW: codes are written MSB first and the code width grows
+	 * one code early, like libtiff does. Each tile/strip starts with a clear code.
+	 */
+	static void encodeLZW(const uint8_t* data, size_t size, vector<char>& out)
+	{
+		static const int CLEAR = 256, EOI = 257, FIRST = 258, MAX_CODE = 4095;
+		static const int HASH_SIZE = 1 << 13;
+
+		out.clear();
+		out.reserve(size / 2 + 16);
+
+		// open addressing table of (prefix code, byte) -> code
+		vector<int32_t> keys(HASH_SIZE);
+		vector<int16_t> codes(HASH_SIZE);
+
+		uint32_t buffer = 0;
+		int bits = 0;
+		int width = 9;
+		int maxCode = 511;
+		int next = FIRST;
+
+		auto put = [&](int code)
+		{
+			buffer = (buffer << width) | (uint32_t)code;
+			bits += width;
+
+			while (bits >= 8)
+			{
+				bits -= 8;
+				out.push_back((char)(buffer >> bits));
+			}
+		};
+
+		auto reset = [&]()
+		{
+			std::fill(keys.begin(), keys.end(), -1);
+			width = 9;
+			maxCode = 511;
+			next = FIRST;
+		};
+
+		// a new code was assigned, widen or start over
+		auto grow = [&]()
+		{
+			if (++next == MAX_CODE - 1)
+			{
+				put(CLEAR);
+				reset();
+			}
+			else if (next > maxCode)
+			{
+				++width;
+				maxCode = (1 << width) - 1;
+			}
+		};
+
+		reset();
+		put(CLEAR);
+
+		if (size > 0)
+		{
+			int prefix = data[0];
+
+			for (size_t i = 1; i < size; ++i)
+			{
+				int key = (prefix << 8) | data[i];
+				size_t slot = ((size_t)key * 2654435761u) & (HASH_SIZE - 1);
+
+				while (keys[slot] != -1 && keys[slot] != key)
+					slot = (slot + 1) & (HASH_SIZE - 1);
+
+				if (keys[slot] == key)
+				{
+					prefix = codes[slot];
+					continue;
+				}
+
+				put(prefix);
+				keys[slot] = key;
+				codes[slot] = (int16_t)next;
+				grow();
+				prefix = data[i];
+			}
+
+			put(prefix);
+			grow();
+		}
+
+		put(EOI);
+
+		if (bits > 0)
+			out.push_back((char)(buffer << (8 - bits)));
+	}
+};
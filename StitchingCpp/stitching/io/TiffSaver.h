@@ -0,0 +1,116 @@
+#pragma once
+
+#include "header.h"
+#include "tools/threadpool.h"
+#include "tools/trace.h"
+#include "TiledTiffWriter.h"
+#include <sstream>
+
+/**
+ * Saves a grayscale (8, 16 or 32 bit) ImagePlus as an ImageJ TIFF, optionally
+ * compressed, using all pool threads.
+ *
+ * Every plane is cut into strips which are predicted, compressed and written as
+ * independent tasks, so encoding scales with the number of threads instead of
+ * running on one. Dimensions and calibration are stored in the ImageJ description
+ * like {@link FileSaver} does; files that could exceed 4 GB become BigTIFF.
+ */
+class TiffSaver {
+public:
+	/** uncompressed size of a strip, i.e. of one task */
+	static const int defaultStripBytes = 1 << 18;
+
+	/** RGB and other types are left to {@link FileSaver} */
+	static bool supports(ImagePlus imp)
+	{
+		return imp.getType() == ImagePlus.GRAY8 || imp.getType() == ImagePlus.GRAY16 || imp.getType() == ImagePlus.GRAY32;
+	}
+
+	/**
+	 * @param compression - one of {@link TiffCodec}::NONE, LZW, DEFLATE, ZSTD
+	 * @param predictor - difference the samples before compressing
+	 * @return false if the image could not be written
+	 */
+	static bool save(ImagePlus imp, const string& filename, int compression, bool predictor)
+	{
+		TraceSpan span("tiff encode", "io");
+
+		if (!supports(imp))
+		{
+			LOGERR("Cannot save image type " << imp.getType() << " as TIFF");
+			return false;
+		}
+
+		int bitsPerSample = imp.getType() == ImagePlus.GRAY32 ? 32 : imp.getType() == ImagePlus.GRAY16 ? 16 : 8;
+		int bytesPerSample = bitsPerSample / 8;
+		int width = imp.getWidth();
+		int height = imp.getHeight();
+		ImageStack stack = imp.getStack();
+		int numPages = stack.getSize();
+		int rowsPerStrip = std::max(1, defaultStripBytes / (width * bytesPerSample));
+
+		TiledTiffWriter writer(filename, width, height, numPages, width, rowsPerStrip, bitsPerSample, bitsPerSample == 32);
+		writer.setStrips(rowsPerStrip);
+		writer.setCompression(compression, predictor);
+		writer.setDescription(description(imp));
+
+		Calibration cal = imp.getCalibration();
+
+		if (cal.scaled())
+			writer.setResolution(1.0 / cal.pixelWidth, 1.0 / cal.pixelHeight);
+
+		if (!writer.open())
+			return false;
+
+		long long stripsPerPage = writer.tilesY();
+		atomic<bool> failed(false);
+
+		ThreadPool::global().parallelFor(0, numPages * stripsPerPage, 1, [&](long long from, long long to)
+		{
+			for (long long i = from; i < to && !failed; ++i)
+			{
+				int page = (int)(i / stripsPerPage);
+				int strip = (int)(i % stripsPerPage);
+
+				// strips are whole rows, i.e. contiguous in the plane
+				const char* pixels = (const char*)stack.getPixels(page + 1);
+
+				if (!writer.writeTile(page, 0, strip, pixels + (size_t)strip * rowsPerStrip * width * bytesPerSample))
+					failed = true;
+			}
+		});
+
+		return writer.close() && !failed;
+	}
+
+	/** The description ImageJ reads dimensions, calibration and display range from */
+	static string description(ImagePlus imp)
+	{
+		std::ostringstream d;
+		d << "ImageJ=1.53t\n";
+		d << "images=" << imp.getStackSize() << "\n";
+
+		if (imp.getNChannels() > 1)
+			d << "channels=" << imp.getNChannels() << "\n";
+		if (imp.getNSlices() > 1)
+			d << "slices=" << imp.getNSlices() << "\n";
+		if (imp.getNFrames() > 1)
+			d << "frames=" << imp.getNFrames() << "\n";
+		if (imp.isHyperStack())
+			d << "hyperstack=true\n";
+		if (imp.isComposite())
+			d << "mode=composite\n";
+
+		Calibration cal = imp.getCalibration();
+
+		if (cal.scaled())
+			d << "unit=" << cal.getUnit() << "\n";
+		if (imp.getNSlices() > 1)
+			d << "spacing=" << cal.pixelDepth << "\n";
+
+		d << "min=" << imp.getDisplayRangeMin() << "\n";
+		d << "max=" << imp.getDisplayRangeMax() << "\n";
+
+		return d.str();
+	}
+};
@@ -0,0 +1,169 @@
+#pragma once
+
+#include "header.h"
+#include "TiledTiffWriter.h"
+#include <mutex>
+#include <cstring>
+#include <cstdint>
+
+/**
+ * Builds the reduced resolutions of a pyramidal {@link TiledTiffWriter} from the
+ * full resolution tiles while they are produced, so the image never has to be read
+ * back.
+ *
+ * Every full resolution tile is halved repeatedly (2x2 average) and the results are
+ * copied into the tiles of the coarser levels they belong to. A tile of level l
+ * covers 2^l x 2^l full resolution tiles; it is written as soon as all of them were
+ * added and is freed afterwards, so only the partially covered tiles stay in memory.
+ */
+class TilePyramid {
+public:
+	/** @param writer - an opened writer, tiles are written through it */
+	explicit TilePyramid(TiledTiffWriter& writer)
+		: writer(writer), pending(writer.levels()) {}
+
+	/**
+	 * Number of levels (including the full resolution) until the image fits into a
+	 * single tile, but at most as many as a tile can be halved without a remainder:
+	 * a tile of level l is assembled from blocks of tileWidth / 2^l pixels, so that
+	 * has to be exact (e.g. 4 reduced resolutions for 48 pixel tiles).
+	 */
+	static int levelsFor(int width, int height, int tileWidth, int tileHeight)
+	{
+		int levels = 1;
+
+		while ((width > tileWidth || height > tileHeight) && tileWidth % (1 << levels) == 0 && tileHeight % (1 << levels) == 0)
+		{
+			width = (width + 1) / 2;
+			height = (height + 1) / 2;
+			++levels;
+		}
+
+		return levels;
+	}
+
+	/**
+	 * Writes a full resolution tile and adds it to all reduced resolutions, thread-safe.
+	 *
+	 * @param data - the tile as passed to {@link TiledTiffWriter#writeTile}, or nullptr for
+	 * a tile that is empty; it is not written but still counts as added
+	 * @return false if a tile could not be written
+	 */
+	bool add(int page, int tileX, int tileY, const void* data)
+	{
+		if (data != nullptr && !writer.writeTile(page, tileX, tileY, data))
+			return false;
+
+		if (writer.levels() == 1)
+			return true;
+
+		if (writer.isFloatingPoint())
+			return addToLevels<float>(page, tileX, tileY, (const float*)data);
+		if (writer.getBitsPerSample() == 16)
+			return addToLevels<uint16_t>(page, tileX, tileY, (const uint16_t*)data);
+		return addToLevels<uint8_t>(page, tileX, tileY, (const uint8_t*)data);
+	}
+
+protected:
+	struct PendingTile {
+		vector<char> data;
+		int added = 0;
+	};
+
+	template<class T>
+	bool addToLevels(int page, int tileX, int tileY, const T* data)
+	{
+		int width = writer.getTileWidth();
+		int height = writer.getTileHeight();
+
+		// the current level, halved in place
+		vector<T> block;
+
+		if (data != nullptr)
+			block.assign(data, data + (size_t)width * height);
+
+		for (int level = 1; level < writer.levels(); ++level)
+		{
+			if (data != nullptr)
+				halve(block, width, height);
+
+			width /= 2;
+			height /= 2;
+
+			int scale = 1 << level;
+			int x = tileX / scale, y = tileY / scale;
+			vector<char> complete;
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+
+				PendingTile& tile = pending[level][key(page, x, y)];
+
+				if (data != nullptr)
+				{
+					if (tile.data.empty())
+						tile.data.assign(writer.tileBytes(), 0);
+
+					// the position of this block inside the tile of the level
+					T* target = (T*)tile.data.data();
+					int offsetX = (tileX % scale) * width;
+					int offsetY = (tileY % scale) * height;
+
+					for (int row = 0; row < height; ++row)
+						std::memcpy(target + (size_t)(offsetY + row) * writer.getTileWidth() + offsetX,
+							block.data() + (size_t)row * width, width * sizeof(T));
+				}
+
+				if (++tile.added == expected(x, y, scale))
+				{
+					complete.swap(tile.data);
+					pending[level].erase(key(page, x, y));
+				}
+			}
+
+			// tiles that only cover empty tiles are left to the writer as well
+			if (!complete.empty() && !writer.writeTile(page, level, x, y, complete.data()))
+				return false;
+		}
+
+		return true;
+	}
+
+	/** Number of full resolution tiles covered by tile x, y of a level */
+	int expected(int x, int y, int scale) const
+	{
+		int coveredX = std::min(scale, writer.tilesX() - x * scale);
+		int coveredY = std::min(scale, writer.tilesY() - y * scale);
+		return coveredX * coveredY;
+	}
+
+	static long long key(int page, int x, int y)
+	{
+		return ((long long)page << 40) | ((long long)y << 20) | x;
+	}
+
+	/** 2x2 average, the result is stored at the beginning of the block */
+	template<class T>
+	static void halve(vector<T>& block, int width, int height)
+	{
+		int halfWidth = width / 2;
+
+		for (int y = 0; y < height / 2; ++y)
+		{
+			const T* row0 = block.data() + (size_t)(2 * y) * width;
+			const T* row1 = row0 + width;
+			T* target = block.data() + (size_t)y * halfWidth;
+
+			for (int x = 0; x < halfWidth; ++x)
+				target[x] = average(row0[2 * x], row0[2 * x + 1], row1[2 * x], row1[2 * x + 1]);
+		}
+	}
+
+	static float average(float a, float b, float c, float d) { return (a + b + c + d) * 0.25f; }
+	static uint16_t average(uint16_t a, uint16_t b, uint16_t c, uint16_t d) { return (uint16_t)(((uint32_t)a + b + c + d + 2) / 4); }
+	static uint8_t average(uint8_t a, uint8_t b, uint8_t c, uint8_t d) { return (uint8_t)(((uint32_t)a + b + c + d + 2) / 4); }
+
+	TiledTiffWriter& writer;
+	vector<map<long long, PendingTile>> pending; // per level
+	std::mutex mutex;
+};
@@ -0,0 +1,516 @@
+#pragma once
+
+#include "header.h"
+#include "TiffCodec.h"
+#include <fstream>
+#include <mutex>
+#include <cstring>
+#include <cstdint>
+
+/**
+ * Writes a multi-page grayscale image as tiled TIFF while it is being computed.
+ *
+ * Tiles may be written in any order and from several threads. They are predicted
+ * and compressed by the calling thread, then appended to the file right away; only
+ * the offsets stay in memory, so the image never has to exist in RAM as a whole.
+ * The image file directories (one per page) are written by {@link #close()}; tiles
+ * that were never written all point to one shared empty tile.
+ *
+ * Instead of tiles the image can be cut into strips of full rows (see
+ * {@link #setStrips(int)}), which is what ImageJ reads without plugins.
+ *
+ * Optionally the file is pyramidal: every page gets numLevels - 1 reduced
+ * resolutions (each half the size of the previous one) as SubIFDs, tiled like the
+ * page itself. See {@link TilePyramid} for producing them.
+ *
+ * Files that could exceed 4 GB are written as BigTIFF, all others as classic TIFF.
+ * The file is written little-endian ("II"), i.e. in the byte order of the host.
+ */
+class TiledTiffWriter {
+public:
+	/**
+	 * @param path - the output file
+	 * @param width, height - size of each page
+	 * @param numPages - number of pages, for hyperstacks ordered like ImageJ (XYCZT)
+	 * @param tileWidth, tileHeight - size of the tiles, multiples of 16
+	 * @param bitsPerSample - 8, 16 or 32
+	 * @param floatingPoint - true for 32 bit float samples
+	 * @param numLevels - 1 + number of reduced resolutions per page
+	 */
+	TiledTiffWriter(const string& path, int width, int height, int numPages, int tileWidth, int tileHeight, int bitsPerSample, bool floatingPoint,
+		int numLevels = 1)
+		: path(path), width(width), height(height), numPages(numPages), tileWidth(tileWidth), tileHeight(tileHeight),
+		bitsPerSample(bitsPerSample), floatingPoint(floatingPoint), numLevels(std::max(1, numLevels))
+	{
+	}
+
+	~TiledTiffWriter()
+	{
+		if (file.is_open())
+			close();
+	}
+
+	/** Stored with the first page, e.g. the ImageJ hyperstack description. */
+	void setDescription(const string& description) { this->description = description; }
+
+	/**
+	 * Pixels per unit in x and y, stored as XResolution/YResolution without a
+	 * ResolutionUnit (ImageJ keeps the unit in the description).
+	 */
+	void setResolution(double xResolution, double yResolution)
+	{
+		this->xResolution = xResolution;
+		this->yResolution = yResolution;
+	}
+
+	/**
+	 * @param compression - one of {@link TiffCodec}::NONE, LZW, DEFLATE, ZSTD
+	 * @param predictor - difference the samples of each row before compressing
+	 */
+	void setCompression(int compression, bool predictor)
+	{
+		this->compression = compression;
+		this->predictor = predictor && compression != TiffCodec::NONE;
+	}
+
+	/**
+	 * Write strips of rowsPerStrip full rows instead of tiles; tileX is always 0 and
+	 * tileY is the strip. Must be called before {@link #open()}, not for pyramids.
+	 */
+	void setStrips(int rowsPerStrip)
+	{
+		strips = true;
+		tileWidth = width;
+		tileHeight = std::max(1, std::min(rowsPerStrip, height));
+	}
+
+	/** -1 (default) chooses BigTIFF if the file could exceed 4 GB, 0 forces classic TIFF, 1 BigTIFF */
+	void setBigTiff(int bigTiff) { bigTiffMode = bigTiff; }
+
+	bool open()
+	{
+		if (!strips && (tileWidth % 16 != 0 || tileHeight % 16 != 0))
+		{
+			LOGERR("TIFF tile size must be a multiple of 16, got " << tileWidth << "x" << tileHeight);
+			return false;
+		}
+
+		if (!TiffCodec::available(compression))
+		{
+			LOGERR("TIFF compression " << compression << " is not available in this build");
+			return false;
+		}
+
+		offsets.resize(numLevels);
+		byteCounts.resize(numLevels);
+
+		for (int level = 0; level < numLevels; ++level)
+		{
+			offsets[level].assign((size_t)numPages * numTiles(level), 0);
+			byteCounts[level].assign(offsets[level].size(), 0);
+		}
+
+		// classic TIFF only if even the worst case stays clear of 4 GB, its offsets are 32 bit
+		bigTiff = bigTiffMode > 0 || (bigTiffMode < 0 && estimatedBytes() >= (1ULL << 32) - (1ULL << 24));
+
+		file.open(path, std::ios::binary | std::ios::out | std::ios::trunc);
+
+		if (!file)
+		{
+			LOGERR("Cannot create file: '" << path << "'");
+			return false;
+		}
+
+		// the offset of the first directory is patched in close()
+		if (bigTiff)
+		{
+			const char magic[] = { 'I', 'I', 43, 0, 8, 0, 0, 0 };
+			file.write(magic, sizeof(magic));
+			writeValue<uint64_t>(0);
+			end = 16;
+		}
+		else
+		{
+			const char magic[] = { 'I', 'I', 42, 0 };
+			file.write(magic, sizeof(magic));
+			writeValue<uint32_t>(0);
+			end = 8;
+		}
+
+		return (bool)file;
+	}
+
+	int levels() const { return numLevels; }
+	int levelWidth(int level) const { return (int)(((long long)width + (1LL << level) - 1) >> level); }
+	int levelHeight(int level) const { return (int)(((long long)height + (1LL << level) - 1) >> level); }
+
+	int tilesX(int level = 0) const { return (levelWidth(level) + tileWidth - 1) / tileWidth; }
+	int tilesY(int level = 0) const { return (levelHeight(level) + tileHeight - 1) / tileHeight; }
+	int numTiles(int level = 0) const { return tilesX(level) * tilesY(level); }
+
+	int getTileWidth() const { return tileWidth; }
+	int getTileHeight() const { return tileHeight; }
+	int getBitsPerSample() const { return bitsPerSample; }
+	bool isFloatingPoint() const { return floatingPoint; }
+	bool isBigTiff() const { return bigTiff; }
+
+	/** Where a tile of a page was written, 0 if it was not (yet), empty tiles get theirs in {@link #close()} */
+	uint64_t tileOffset(int page, int level, int tileX, int tileY) const
+	{
+		return offsets[level][(size_t)page * numTiles(level) + (size_t)tileY * tilesX(level) + tileX];
+	}
+
+	/** Size of the data of one tile, tiles at the border are padded to the full size. */
+	size_t tileBytes() const { return (size_t)tileWidth * tileHeight * (bitsPerSample / 8); }
+
+	/**
+	 * Appends one tile, thread-safe.
+	 *
+	 * @param data - tileWidth x tileHeight samples, x is the fastest dimension; of the
+	 * last strip only the rows inside the image are read
+	 */
+	bool writeTile(int page, int tileX, int tileY, const void* data)
+	{
+		return writeTile(page, 0, tileX, tileY, data);
+	}
+
+	/** Appends one tile of a resolution level, thread-safe. */
+	bool writeTile(int page, int level, int tileX, int tileY, const void* data)
+	{
+		size_t index = (size_t)page * numTiles(level) + (size_t)tileY * tilesX(level) + tileX;
+		int rows = tileRows(level, tileY);
+		size_t size = (size_t)tileWidth * rows * (bitsPerSample / 8);
+
+		// prediction and compression happen outside the lock, in parallel
+		vector<char> encoded;
+		const char* bytes = (const char*)data;
+
+		if (compression != TiffCodec::NONE)
+		{
+			if (predictor)
+			{
+				vector<char> predicted(bytes, bytes + size);
+				TiffCodec::predict(predicted.data(), tileWidth, rows, bitsPerSample, floatingPoint);
+
+				if (!TiffCodec::encode(compression, predicted.data(), size, encoded))
+					return encodingFailed();
+			}
+			else if (!TiffCodec::encode(compression, bytes, size, encoded))
+			{
+				return encodingFailed();
+			}
+
+			bytes = encoded.data();
+			size = encoded.size();
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+
+		offsets[level][index] = end;
+		byteCounts[level][index] = size;
+
+		file.write(bytes, size);
+		end += size;
+
+		if (!file)
+		{
+			LOGERR("Cannot write tile to '" << path << "'");
+			return false;
+		}
+
+		return true;
+	}
+
+	/** Writes all directories and closes the file. */
+	bool close()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		if (!file.is_open())
+			return false;
+
+		// all tiles that were never written share one empty tile (per number of rows)
+		map<int, std::pair<uint64_t, uint64_t>> emptyTiles;
+
+		for (int level = 0; level < numLevels; ++level)
+			for (size_t i = 0; i < offsets[level].size(); ++i)
+			{
+				if (byteCounts[level][i] != 0)
+					continue;
+
+				int rows = tileRows(level, (int)((i % numTiles(level)) / tilesX(level)));
+
+				if (emptyTiles.count(rows) == 0)
+				{
+					vector<char> zeros((size_t)tileWidth * rows * (bitsPerSample / 8), 0), encoded;
+					TiffCodec::encode(compression, zeros.data(), zeros.size(), encoded);
+
+					emptyTiles[rows] = std::make_pair(end, (uint64_t)encoded.size());
+					file.write(encoded.data(), encoded.size());
+					end += encoded.size();
+				}
+
+				offsets[level][i] = emptyTiles[rows].first;
+				byteCounts[level][i] = emptyTiles[rows].second;
+			}
+
+		for (int page = 0; page < numPages; ++page)
+		{
+			// the reduced resolutions go first, the page refers to them
+			vector<uint64_t> subDirectories;
+
+			for (int level = 1; level < numLevels; ++level)
+				subDirectories.push_back(writeDirectory(page, level, vector<uint64_t>()));
+
+			directories.push_back(writeDirectory(page, 0, subDirectories));
+		}
+
+		// chain the directories
+		for (int page = 0; page + 1 < numPages; ++page)
+		{
+			file.seekp(nextLinks[page]);
+			writeOffset(directories[page + 1]);
+		}
+
+		file.seekp(bigTiff ? 8 : 4);
+		writeOffset(directories.empty() ? 0 : directories[0]);
+
+		bool success = (bool)file;
+		file.close();
+
+		if (!success)
+			LOGERR("Cannot finish TIFF file '" << path << "'");
+		else if (!bigTiff && end >= (1ULL << 32))
+		{
+			LOGERR("TIFF file '" << path << "' exceeds 4 GB, use BigTIFF");
+			success = false;
+		}
+
+		return success;
+	}
+
+protected:
+	struct Entry {
+		uint16_t tag;
+		uint16_t type;
+		uint64_t count;
+		uint64_t value; // or the offset of the values if they do not fit inline
+	};
+
+	static const uint16_t ASCII = 2, SHORT = 3, LONG = 4, RATIONAL = 5, IFD = 13, LONG8 = 16, IFD8 = 18;
+
+	/** rows of a tile that are inside the image, only strips are cut at the bottom */
+	int tileRows(int level, int tileY) const
+	{
+		return strips ? std::min(tileHeight, levelHeight(level) - tileY * tileHeight) : tileHeight;
+	}
+
+	/**
+	 * An upper bound of the file size, to decide whether BigTIFF is needed: every tile
+	 * (and the shared empty tiles) as large as the codec can expand it, and its offset and
+	 * byte count in the directory.
+	 */
+	uint64_t estimatedBytes() const
+	{
+		uint64_t tile = TiffCodec::bound(compression, tileBytes());
+		uint64_t bytes = 2 * tile;
+
+		for (int level = 0; level < numLevels; ++level)
+			bytes += (uint64_t)numPages * numTiles(level) * (tile + 16);
+
+		return bytes + (uint64_t)numPages * numLevels * 512 + description.size();
+	}
+
+	bool encodingFailed()
+	{
+		LOGERR("Cannot compress tile for '" << path << "'");
+		return false;
+	}
+
+	/**
+	 * Appends the arrays and the directory of one page or of one of its reduced resolutions.
+	 *
+	 * @param subDirectories - the directories of the reduced resolutions (level 0 only)
+	 * @return the offset of the directory
+	 */
+	uint64_t writeDirectory(int page, int level, const vector<uint64_t>& subDirectories)
+	{
+		int tiles = numTiles(level);
+		size_t first = (size_t)page * tiles;
+		uint16_t offsetType = bigTiff ? LONG8 : LONG;
+
+		// tiles have any length, directories and their values start on a word boundary
+		align();
+
+		vector<Entry> entries;
+		entries.push_back({ 254, LONG, 1, (uint64_t)(level > 0 ? 1 : 0) }); // NewSubfileType: reduced resolution
+		entries.push_back({ 256, LONG, 1, (uint64_t)levelWidth(level) }); // ImageWidth
+		entries.push_back({ 257, LONG, 1, (uint64_t)levelHeight(level) }); // ImageLength
+		entries.push_back({ 258, SHORT, 1, (uint64_t)bitsPerSample }); // BitsPerSample
+		entries.push_back({ 259, SHORT, 1, (uint64_t)compression }); // Compression
+		entries.push_back({ 262, SHORT, 1, 1 }); // PhotometricInterpretation: BlackIsZero
+
+		if (page == 0 && level == 0 && !description.empty())
+			entries.push_back({ 270, ASCII, description.size() + 1, writeData(description.c_str(), description.size() + 1) }); // ImageDescription
+
+		if (strips)
+			entries.push_back({ 273, offsetType, (uint64_t)tiles, writeOffsets(&offsets[level][first], tiles) }); // StripOffsets
+
+		entries.push_back({ 277, SHORT, 1, 1 }); // SamplesPerPixel
+
+		if (strips)
+		{
+			entries.push_back({ 278, LONG, 1, (uint64_t)tileHeight }); // RowsPerStrip
+			entries.push_back({ 279, offsetType, (uint64_t)tiles, writeOffsets(&byteCounts[level][first], tiles) }); // StripByteCounts
+		}
+
+		if (xResolution > 0 && yResolution > 0)
+		{
+			entries.push_back({ 282, RATIONAL, 1, writeRational(xResolution / (1 << level)) }); // XResolution
+			entries.push_back({ 283, RATIONAL, 1, writeRational(yResolution / (1 << level)) }); // YResolution
+			entries.push_back({ 296, SHORT, 1, 1 }); // ResolutionUnit: none
+		}
+
+		if (predictor)
+			entries.push_back({ 317, SHORT, 1, (uint64_t)TiffCodec::predictor(floatingPoint) }); // Predictor
+
+		if (!strips)
+		{
+			entries.push_back({ 322, LONG, 1, (uint64_t)tileWidth }); // TileWidth
+			entries.push_back({ 323, LONG, 1, (uint64_t)tileHeight }); // TileLength
+			entries.push_back({ 324, offsetType, (uint64_t)tiles, writeOffsets(&offsets[level][first], tiles) }); // TileOffsets
+			entries.push_back({ 325, offsetType, (uint64_t)tiles, writeOffsets(&byteCounts[level][first], tiles) }); // TileByteCounts
+		}
+
+		if (!subDirectories.empty())
+			entries.push_back({ 330, bigTiff ? IFD8 : IFD, (uint64_t)subDirectories.size(), writeOffsets(subDirectories.data(), subDirectories.size()) }); // SubIFDs
+
+		entries.push_back({ 339, SHORT, 1, (uint64_t)(floatingPoint ? 3 : 1) }); // SampleFormat
+
+		uint64_t directory = end;
+		size_t entrySize = bigTiff ? 20 : 12;
+
+		if (bigTiff)
+			writeValue<uint64_t>(entries.size());
+		else
+			writeValue<uint16_t>((uint16_t)entries.size());
+
+		for (const Entry& e : entries)
+		{
+			writeValue<uint16_t>(e.tag);
+			writeValue<uint16_t>(e.type);
+
+			if (bigTiff)
+			{
+				writeValue<uint64_t>(e.count);
+				writeValue<uint64_t>(e.value);
+			}
+			else
+			{
+				writeValue<uint32_t>((uint32_t)e.count);
+				writeValue<uint32_t>((uint32_t)e.value);
+			}
+		}
+
+		uint64_t countSize = bigTiff ? 8 : 2;
+
+		// the link to the next page is patched in close(), reduced resolutions are not chained
+		if (level == 0)
+			nextLinks.push_back(directory + countSize + entries.size() * entrySize);
+
+		writeOffset(0);
+		end += countSize + entries.size() * entrySize + offsetSize();
+
+		return directory;
+	}
+
+	size_t offsetSize() const { return bigTiff ? 8 : 4; }
+
+	/**
+	 * Values that fit into the value field of an entry are returned as the value
+	 * itself, all others are appended and their offset is returned.
+	 */
+	uint64_t writeData(const void* data, size_t size)
+	{
+		if (size <= offsetSize())
+		{
+			uint64_t value = 0;
+			std::memcpy(&value, data, size);
+			return value;
+		}
+
+		uint64_t position = end;
+		file.write((const char*)data, size);
+		end += size;
+
+		// keep the directories word aligned
+		align();
+
+		return position;
+	}
+
+	/** Pads the file to an even length */
+	void align()
+	{
+		if (end % 2 != 0)
+		{
+			file.put(0);
+			++end;
+		}
+	}
+
+	/** An array of offsets/byte counts as LONG8 (BigTIFF) or LONG */
+	uint64_t writeOffsets(const uint64_t* values, size_t count)
+	{
+		if (bigTiff)
+			return writeData(values, count * sizeof(uint64_t));
+
+		vector<uint32_t> values32(values, values + count);
+		return writeData(values32.data(), count * sizeof(uint32_t));
+	}
+
+	/** Numerator and denominator chosen like ImageJ does */
+	uint64_t writeRational(double value)
+	{
+		double scale = value > 1000.0 ? 1000.0 : 1000000.0;
+		uint32_t rational[] = { (uint32_t)(value * scale), (uint32_t)scale };
+		return writeData(rational, sizeof(rational));
+	}
+
+	void writeOffset(uint64_t offset)
+	{
+		if (bigTiff)
+			writeValue<uint64_t>(offset);
+		else
+			writeValue<uint32_t>((uint32_t)offset);
+	}
+
+	template<class V>
+	void writeValue(V value)
+	{
+		file.write((const char*)&value, sizeof(V));
+	}
+
+	string path;
+	int width, height, numPages;
+	int tileWidth, tileHeight;
+	int bitsPerSample;
+	bool floatingPoint;
+	int numLevels;
+	string description;
+	double xResolution = 0, yResolution = 0;
+	int compression = TiffCodec::NONE;
+	bool predictor = false;
+	bool strips = false;
+	int bigTiffMode = -1;
+	bool bigTiff = true;
+
+	std::ofstream file;
+	std::mutex mutex;
+	uint64_t end = 0;
+
+	vector<vector<uint64_t>> offsets; // [level][page * numTiles(level) + tile]
+	vector<vector<uint64_t>> byteCounts;
+	vector<uint64_t> directories;
+	vector<uint64_t> nextLinks;
+};
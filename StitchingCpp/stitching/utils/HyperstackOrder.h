@@ -0,0 +1,70 @@
+#pragma once
+
+#include "header.h"
+
+import ij.ImageStack;
+
+/**
+ * Slice order of ImageJ hyperstacks. A fused image is put together in the order
+ * ImageJ expects (XYCZT) right away, and switching the order of an existing stack
+ * only moves the references to the slices around, so no pixels are copied and no
+ * second stack is built.
+ */
+class HyperstackOrder {
+public:
+	/** @return the 0-based slice of channel c, slice z and frame t (1-based like ImageJ) in a XYCZT stack */
+	static int xyczt(int c, int z, int t, int numChannels, int numSlices)
+	{
+		return ((t - 1) * numSlices + (z - 1)) * numChannels + (c - 1);
+	}
+
+	/** @return the 0-based slice of channel c, slice z and frame t (1-based like ImageJ) in a XYZCT stack */
+	static int xyzct(int c, int z, int t, int numChannels, int numSlices)
+	{
+		return ((t - 1) * numChannels + (c - 1)) * numSlices + (z - 1);
+	}
+
+	/** @return the 0-based slice of channel c, slice z and frame t (1-based like ImageJ) in a XYCTZ stack */
+	static int xyctz(int c, int z, int t, int numChannels, int numFrames)
+	{
+		return ((z - 1) * numFrames + (t - 1)) * numChannels + (c - 1);
+	}
+
+	/**
+	 * Reorders the slices of a stack in place, slice i moves to target[i]. Only the
+	 * pixel array references and labels are swapped, following the cycles of the
+	 * permutation.
+	 */
+	static void permute(ImageStack stack, const vector<int>& target)
+	{
+		Object[] pixels = stack.getImageArray();
+		vector<bool> placed(target.size(), false);
+
+		for (int start = 0; start < (int)target.size(); ++start)
+		{
+			if (placed[start])
+				continue;
+
+			// carry the slice of start along its cycle until the cycle closes
+			Object carried = pixels[start];
+			String label = stack.getSliceLabel(start + 1);
+			int i = start;
+
+			do
+			{
+				int next = target[i];
+				Object displaced = pixels[next];
+				String displacedLabel = stack.getSliceLabel(next + 1);
+
+				pixels[next] = carried;
+				stack.setSliceLabel(label, next + 1);
+				placed[next] = true;
+
+				carried = displaced;
+				label = displacedLabel;
+				i = next;
+			}
+			while (i != start);
+		}
+	}
+};
@@ -33,7 +33,12 @@ public:
 
 	/** Issues an informational message to the ImageJ log window. */
 	static void info(string message) {
-		cout << message << endl;
+		Logger::global().log(LogLevel::info, message);
+	}
+
+	/** Issues an informational message with structured fields, e.g. { LogField("pair", 12), LogField("ms", 40) }. */
+	static void info(string message, vector<LogField> fields) {
+		Logger::global().log(LogLevel::info, message, fields);
 	}
 
 	/** Issues an informational message with timestamp to the ImageJ log window. */
@@ -51,7 +56,7 @@ public:
 	 * @see IJ#log(string)
 	 */
 	static void error(string message) {
-		cout << "Error: " << message << endl;
+		Logger::global().log(LogLevel::error, message);
 	}
 
 	/**
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "header.h"
+#include "memoryledger.h"
+#include "scratcharena.h"
+#include <cstring>
+
+/**
+ * Storage aligned to 64 bytes (a cache line, and enough for any SIMD load), owned
+ * by exactly one object: it can be moved but not copied. Buffers created with
+ * {@link #scratch(size_t)} come from the {@link ScratchArena} of the calling thread
+ * and go back to it when they are destroyed.
+ *
+ * The bytes are charged to the {@link MemoryPhase} current on the allocating thread
+ * for as long as the buffer lives.
+ */
+template<class T>
+class AlignedBuffer {
+public:
+	static const size_t alignment = 64;
+
+	AlignedBuffer() : data_(nullptr), size_(0), arena(nullptr), bytes(0), phase(MemoryPhase::other) {}
+
+	/** @param size - number of elements, they are zero-initialized */
+	explicit AlignedBuffer(size_t size) : data_(allocate(size)), size_(size), arena(nullptr), bytes(size * sizeof(T)), phase(MemoryLedger::current())
+	{
+		MemoryLedger::global().allocate(phase, (long long)bytes);
+		clear();
+	}
+
+	/** A zero-initialized buffer from the scratch arena of the calling thread. */
+	static AlignedBuffer scratch(size_t size)
+	{
+		AlignedBuffer buffer;
+
+		if (size > 0)
+		{
+			buffer.arena = &ScratchPool::global().local();
+			buffer.bytes = size * sizeof(T);
+			buffer.data_ = (T*)buffer.arena->acquire(buffer.bytes);
+			buffer.size_ = size;
+			buffer.phase = MemoryLedger::current();
+			MemoryLedger::global().allocate(buffer.phase, (long long)buffer.bytes);
+			buffer.clear();
+		}
+
+		return buffer;
+	}
+
+	AlignedBuffer(const AlignedBuffer&) = delete;
+	AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+
+	AlignedBuffer(AlignedBuffer&& other) : data_(other.data_), size_(other.size_), arena(other.arena), bytes(other.bytes), phase(other.phase)
+	{
+		other.data_ = nullptr;
+		other.size_ = 0;
+		other.arena = nullptr;
+		other.bytes = 0;
+	}
+
+	AlignedBuffer& operator=(AlignedBuffer&& other)
+	{
+		if (this != &other)
+		{
+			free();
+			data_ = other.data_;
+			size_ = other.size_;
+			arena = other.arena;
+			bytes = other.bytes;
+			phase = other.phase;
+			other.data_ = nullptr;
+			other.size_ = 0;
+			other.arena = nullptr;
+			other.bytes = 0;
+		}
+		return *this;
+	}
+
+	~AlignedBuffer() { free(); }
+
+	T* data() { return data_; }
+	const T* data() const { return data_; }
+	size_t size() const { return size_; }
+	bool isScratch() const { return arena != nullptr; }
+
+	static T* allocate(size_t size) { return (T*)alignedAlloc(size * sizeof(T)); }
+
+	static void release(T* data) { alignedFree(data); }
+
+private:
+	void clear()
+	{
+		if (size_ > 0)
+			std::memset((void*)data_, 0, size_ * sizeof(T));
+	}
+
+	void free()
+	{
+		if (data_ == nullptr)
+			return;
+
+		MemoryLedger::global().free(phase, (long long)bytes);
+
+		if (arena != nullptr)
+			arena->release(data_, bytes);
+		else
+			release(data_);
+	}
+
+	T* data_;
+	size_t size_;
+	ScratchArena* arena;
+	size_t bytes;
+	MemoryPhase phase;
+};
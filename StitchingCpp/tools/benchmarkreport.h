@@ -0,0 +1,104 @@
+#pragma once
+
+#include "header.h"
+#include <cmath>
+#include <cstdio>
+#include <sstream>
+
+/**
+ * Results of benchmark runs: the time of each case, its throughput and, where there is a
+ * ground truth, its error. Printed as a table and written as JSON lines (one object per
+ * case, with the configuration of the run), so the results of different builds can be
+ * collected and compared.
+ */
+class BenchmarkReport {
+public:
+	struct Result {
+		string name;
+		/** best time of the repetitions */
+		double seconds = 0;
+		/** items processed per run, the throughput is amount / seconds */
+		double amount = 0;
+		string unit;
+		/** NaN if there is no ground truth */
+		double meanError = NAN;
+		double maxError = NAN;
+		string errorUnit;
+		/** key=value pairs of the case, e.g. the pixel type */
+		vector< std::pair<string, string> > parameters;
+	};
+
+	/** @param configuration - key=value pairs describing the run, repeated in every JSON line */
+	explicit BenchmarkReport(vector< std::pair<string, string> > configuration = {}) : configuration(configuration) {}
+
+	void add(const Result& result) { results.push_back(result); }
+
+	const vector<Result>& getResults() const { return results; }
+
+	string table() const
+	{
+		std::ostringstream table;
+		char line[256];
+
+		snprintf(line, sizeof(line), "%-32s %12s %16s %-10s %12s %12s\n", "benchmark", "ms", "throughput", "", "mean error", "max error");
+		table << line;
+
+		for (const Result& r : results)
+		{
+			string name = r.name;
+
+			for (const auto& entry : r.parameters)
+				name += " " + entry.first + "=" + entry.second;
+
+			snprintf(line, sizeof(line), "%-32s %12.3f %16.2f %-10s", name.c_str(), r.seconds * 1e3, throughput(r), r.unit.c_str());
+			table << line;
+
+			if (!std::isnan(r.meanError))
+			{
+				snprintf(line, sizeof(line), " %12.4f %12.4f %s", r.meanError, r.maxError, r.errorUnit.c_str());
+				table << line;
+			}
+
+			table << '\n';
+		}
+
+		return table.str();
+	}
+
+	/** @return false if the file could not be written */
+	bool writeJson(const string& path) const
+	{
+		FILE* file = fopen(path.c_str(), "w");
+
+		if (file == nullptr)
+		{
+			LOGERR("Cannot write benchmark results '" << path << "'.");
+			return false;
+		}
+
+		for (const Result& r : results)
+		{
+			fprintf(file, "{\"benchmark\":\"%s\",\"seconds\":%.9g,\"amount\":%.9g,\"throughput\":%.9g,\"unit\":\"%s\"",
+				r.name.c_str(), r.seconds, r.amount, throughput(r), r.unit.c_str());
+
+			if (!std::isnan(r.meanError))
+				fprintf(file, ",\"meanError\":%.9g,\"maxError\":%.9g,\"errorUnit\":\"%s\"", r.meanError, r.maxError, r.errorUnit.c_str());
+
+			for (const auto& entry : r.parameters)
+				fprintf(file, ",\"%s\":\"%s\"", entry.first.c_str(), entry.second.c_str());
+
+			for (const auto& entry : configuration)
+				fprintf(file, ",\"%s\":\"%s\"", entry.first.c_str(), entry.second.c_str());
+
+			fprintf(file, "}\n");
+		}
+
+		return fclose(file) == 0;
+	}
+
+	static double throughput(const Result& r) { return r.seconds > 0 ? r.amount / r.seconds : 0; }
+
+private:
+	vector< std::pair<string, string> > configuration;
+	vector<Result> results;
+};
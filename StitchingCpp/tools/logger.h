@@ -0,0 +1,381 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+enum class LogLevel { debug, info, warning, error, off };
+
+enum class LogFormat {
+	/** the message followed by key=value for each field, errors prefixed with "Error: " */
+	text,
+	/** one JSON object per line with level, message and the fields */
+	json
+};
+
+/** A key and a value of a log message, the value is formatted when the message is built. */
+struct LogField {
+	std::string key;
+	std::string value;
+
+	template<class T>
+	LogField(std::string key, const T& value) : key(std::move(key))
+	{
+		std::ostringstream text;
+		text << value;
+		this->value = text.str();
+	}
+};
+
+/** Collects the text and the fields of one message, {@code LogMessage() << "a " << 1 << LogField("b", 2)}. */
+class LogMessage {
+public:
+	template<class T>
+	LogMessage& operator<<(const T& value)
+	{
+		text << value;
+		return *this;
+	}
+
+	LogMessage& operator<<(const LogField& field)
+	{
+		fields.push_back(field);
+		return *this;
+	}
+
+	std::ostringstream text;
+	std::vector<LogField> fields;
+};
+
+/**
+ * Writes log messages from a background thread, so that a worker that logs (e.g. one line
+ * per registered pair) neither waits for the console nor serializes with the other workers
+ * on the stream.
+ *
+ * Messages are put into a bounded lock-free ring (one sequence number per slot, producers
+ * claim slots with a CAS on the tail) that a single thread drains in batches and writes
+ * with one flush per batch. When the ring is full, messages below warning are dropped and
+ * counted, warnings and errors wait for a free slot. A message below the level is not even
+ * formatted, the macros LOGINFO and LOGERR only do one relaxed load then.
+ *
+ * The consumer is the only thread that writes while the logger runs. Messages logged
+ * after it was shut down at exit are written synchronously.
+ */
+class Logger {
+public:
+	static Logger& global()
+	{
+		// never destroyed, threads of other static objects may still log during exit
+		static Logger* logger = new Logger();
+		static Shutdown shutdown;
+		return *logger;
+	}
+
+	void setLevel(LogLevel level) { this->level.store((int)level, std::memory_order_relaxed); }
+	LogLevel getLevel() const { return (LogLevel)level.load(std::memory_order_relaxed); }
+
+	void setFormat(LogFormat format) { this->format.store((int)format, std::memory_order_relaxed); }
+
+	bool isEnabled(LogLevel level) const { return (int)level >= this->level.load(std::memory_order_relaxed); }
+
+	void log(LogLevel level, LogMessage& message)
+	{
+		Record record;
+		record.level = level;
+		record.text = message.text.str();
+		record.fields = std::move(message.fields);
+		log(std::move(record));
+	}
+
+	void log(LogLevel level, std::string text, std::vector<LogField> fields = std::vector<LogField>())
+	{
+		Record record;
+		record.level = level;
+		record.text = std::move(text);
+		record.fields = std::move(fields);
+		log(std::move(record));
+	}
+
+	/** Blocks until every message logged before the call is written. */
+	void flush()
+	{
+		size_t target = tail.load(std::memory_order_acquire);
+		std::unique_lock<std::mutex> lock(mutex);
+		drained.wait(lock, [&] { return !running || written >= target; });
+	}
+
+	/** @return the number of messages that were dropped because the ring was full */
+	long long getNumDropped() const { return dropped.load(std::memory_order_relaxed); }
+
+	/** Writes everything that is queued and stops the background thread, later messages are written directly. */
+	void shutdown()
+	{
+		std::lock_guard<std::mutex> exitLock(exitMutex);
+
+		if (!async.load(std::memory_order_relaxed))
+			return;
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			running = false;
+		}
+
+		async.store(false, std::memory_order_release);
+		wakeup.notify_one();
+		consumer.join();
+		drain();
+	}
+
+private:
+	struct Record {
+		LogLevel level = LogLevel::info;
+		std::string text;
+		std::vector<LogField> fields;
+	};
+
+	struct Slot {
+		std::atomic<size_t> sequence;
+		Record record;
+	};
+
+	struct Shutdown {
+		~Shutdown() { Logger::global().shutdown(); }
+	};
+
+	static const size_t capacity = 1 << 14;
+
+	Logger() : slots(new Slot[capacity])
+	{
+		for (size_t i = 0; i < capacity; ++i)
+			slots[i].sequence.store(i, std::memory_order_relaxed);
+
+		consumer = std::thread([this] { run(); });
+	}
+
+	void log(Record&& record)
+	{
+		if (!isEnabled(record.level))
+			return;
+
+		if (!async.load(std::memory_order_acquire))
+		{
+			std::lock_guard<std::mutex> lock(exitMutex);
+			drain();
+
+			std::string line;
+			append(line, record);
+			std::cout << line << std::flush;
+			return;
+		}
+
+		while (!tryPush(record))
+		{
+			if (record.level < LogLevel::warning)
+			{
+				dropped.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+
+			std::this_thread::yield();
+		}
+
+		// the consumer stopped while this message was queued
+		if (!async.load(std::memory_order_acquire))
+		{
+			std::lock_guard<std::mutex> lock(exitMutex);
+			drain();
+		}
+	}
+
+	bool tryPush(Record& record)
+	{
+		size_t position = tail.load(std::memory_order_relaxed);
+
+		for (;;)
+		{
+			Slot& slot = slots[position & (capacity - 1)];
+			size_t sequence = slot.sequence.load(std::memory_order_acquire);
+			intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+
+			if (difference == 0)
+			{
+				if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+				{
+					slot.record = std::move(record);
+					slot.sequence.store(position + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (difference < 0)
+			{
+				return false;
+			}
+			else
+			{
+				position = tail.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	/** Only called by the consumer, or under exitMutex after it stopped. */
+	bool tryPop(Record& record)
+	{
+		Slot& slot = slots[head & (capacity - 1)];
+
+		if (slot.sequence.load(std::memory_order_acquire) != head + 1)
+			return false;
+
+		record = std::move(slot.record);
+		slot.sequence.store(head + capacity, std::memory_order_release);
+		++head;
+		return true;
+	}
+
+	void run()
+	{
+		for (;;)
+		{
+			bool stopping;
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stopping = !running;
+			}
+
+			if (!drain())
+			{
+				if (stopping)
+					return;
+
+				// producers never notify, a message waits at most this long
+				std::unique_lock<std::mutex> lock(mutex);
+				wakeup.wait_for(lock, std::chrono::milliseconds(2));
+			}
+		}
+	}
+
+	/** Writes all queued messages with one flush, @return false if there were none */
+	bool drain()
+	{
+		std::string batch;
+		Record record;
+		size_t count = 0;
+
+		while (tryPop(record))
+		{
+			append(batch, record);
+			++count;
+		}
+
+		long long lost = dropped.load(std::memory_order_relaxed) - reported;
+
+		if (lost > 0)
+		{
+			batch += "Warning: " + std::to_string(lost) + " log messages dropped\n";
+			reported += lost;
+		}
+
+		if (!batch.empty())
+			std::cout << batch << std::flush;
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			written = head;
+		}
+
+		drained.notify_all();
+		return count > 0;
+	}
+
+	void append(std::string& out, const Record& record)
+	{
+		if ((LogFormat)format.load(std::memory_order_relaxed) == LogFormat::json)
+		{
+			static const char* names[] = { "debug", "info", "warning", "error", "off" };
+
+			out += "{\"level\":\"";
+			out += names[(int)record.level];
+			out += "\",\"message\":";
+			appendJson(out, record.text);
+
+			for (const LogField& field : record.fields)
+			{
+				out += ',';
+				appendJson(out, field.key);
+				out += ':';
+				appendJson(out, field.value);
+			}
+
+			out += "}\n";
+			return;
+		}
+
+		if (record.level == LogLevel::error)
+			out += "Error: ";
+		else if (record.level == LogLevel::warning)
+			out += "Warning: ";
+
+		out += record.text;
+
+		for (const LogField& field : record.fields)
+		{
+			out += ' ';
+			out += field.key;
+			out += '=';
+			out += field.value;
+		}
+
+		out += '\n';
+	}
+
+	static void appendJson(std::string& out, const std::string& text)
+	{
+		out += '"';
+
+		for (char c : text)
+		{
+			if (c == '"' || c == '\\')
+			{
+				out += '\\';
+				out += c;
+			}
+			else if (c == '\n')
+				out += "\\n";
+			else if ((unsigned char)c < 0x20)
+				out += ' ';
+			else
+				out += c;
+		}
+
+		out += '"';
+	}
+
+	std::unique_ptr<Slot[]> slots;
+	std::atomic<size_t> tail{ 0 };
+	size_t head = 0;
+
+	std::atomic<int> level{ (int)LogLevel::info };
+	std::atomic<int> format{ (int)LogFormat::text };
+	std::atomic<long long> dropped{ 0 };
+	long long reported = 0;
+
+	std::mutex mutex;
+	std::condition_variable wakeup;
+	std::condition_variable drained;
+	bool running = true;
+	size_t written = 0;
+
+	// cleared at exit, from then on messages are written directly, one at a time under exitMutex
+	std::atomic<bool> async{ true };
+	std::mutex exitMutex;
+	std::thread consumer;
+};
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "header.h"
+#include <mutex>
+#include <condition_variable>
+
+/**
+ * Limits the memory of work items that run concurrently (e.g. timepoints fused in
+ * parallel). A producer has to {@link #reserve(long long)} the bytes an item needs
+ * before it starts it and {@link #release(long long)} them once the item is done.
+ *
+ * An item larger than the whole budget is still admitted when nothing else is
+ * reserved, so the work always makes progress, just without any concurrency.
+ */
+class MemoryBudget {
+public:
+	/** @param bytes - the budget, 0 or less means unlimited */
+	explicit MemoryBudget(long long bytes) : bytes(bytes) {}
+
+	/** Blocks until the bytes fit into the budget. */
+	void reserve(long long size)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		changed.wait(lock, [&] { return bytes <= 0 || reserved == 0 || reserved + size <= bytes; });
+		reserved += size;
+	}
+
+	void release(long long size)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			reserved -= size;
+		}
+		changed.notify_all();
+	}
+
+	long long getReserved()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return reserved;
+	}
+
+private:
+	long long bytes;
+	long long reserved = 0;
+	std::mutex mutex;
+	std::condition_variable changed;
+};
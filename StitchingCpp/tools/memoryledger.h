@@ -0,0 +1,189 @@
+#pragma once
+
+#include "header.h"
+#include <atomic>
+#include <cstdio>
+#include <sstream>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+/** The pipeline phases live memory is attributed to. */
+enum class MemoryPhase {
+	other,
+	tiles,
+	pairRoi,
+	fft,
+	fusionOutput,
+	imageStack,
+	count
+};
+
+/**
+ * Live and peak bytes per {@link MemoryPhase}, so that a run that gets close to the
+ * memory limit tells which stage holds the memory.
+ *
+ * Buffers are charged to the phase that is current on the allocating thread (see
+ * {@link MemoryScope}) and credited to the same phase when they are freed, on any
+ * thread. Images that are not allocated through {@link AlignedBuffer} (the tiles
+ * and the fused stack) are charged explicitly. The counters are atomics, charging
+ * a buffer costs two atomic adds and a compare for the peaks.
+ */
+class MemoryLedger {
+public:
+	static MemoryLedger& global()
+	{
+		static MemoryLedger ledger;
+		return ledger;
+	}
+
+	void allocate(MemoryPhase phase, long long bytes)
+	{
+		if (bytes <= 0)
+			return;
+
+		int p = (int)phase;
+		raise(peak[p], live[p].fetch_add(bytes, std::memory_order_relaxed) + bytes);
+		raise(totalPeak, totalLive.fetch_add(bytes, std::memory_order_relaxed) + bytes);
+	}
+
+	void free(MemoryPhase phase, long long bytes)
+	{
+		if (bytes <= 0)
+			return;
+
+		live[(int)phase].fetch_sub(bytes, std::memory_order_relaxed);
+		totalLive.fetch_sub(bytes, std::memory_order_relaxed);
+	}
+
+	/** Moves bytes from one phase to another, e.g. fused planes that become part of the stack. */
+	void transfer(MemoryPhase from, MemoryPhase to, long long bytes)
+	{
+		if (bytes <= 0)
+			return;
+
+		live[(int)from].fetch_sub(bytes, std::memory_order_relaxed);
+		raise(peak[(int)to], live[(int)to].fetch_add(bytes, std::memory_order_relaxed) + bytes);
+	}
+
+	long long getLive(MemoryPhase phase) const { return live[(int)phase].load(std::memory_order_relaxed); }
+	long long getPeak(MemoryPhase phase) const { return peak[(int)phase].load(std::memory_order_relaxed); }
+	long long getTotalLive() const { return totalLive.load(std::memory_order_relaxed); }
+	long long getTotalPeak() const { return totalPeak.load(std::memory_order_relaxed); }
+
+	/** @return the phase of the calling thread, allocations are charged to it */
+	static MemoryPhase& current()
+	{
+		static thread_local MemoryPhase phase = MemoryPhase::other;
+		return phase;
+	}
+
+	static const char* name(MemoryPhase phase)
+	{
+		switch (phase)
+		{
+		case MemoryPhase::tiles: return "tiles";
+		case MemoryPhase::pairRoi: return "pair roi";
+		case MemoryPhase::fft: return "fft";
+		case MemoryPhase::fusionOutput: return "fusion output";
+		case MemoryPhase::imageStack: return "image stack";
+		default: return "other";
+		}
+	}
+
+	/** @return the peak resident set size of the process in bytes, 0 if it is not available */
+	static long long peakResidentBytes()
+	{
+#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS counters;
+
+		if (K32GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+			return (long long)counters.PeakWorkingSetSize;
+
+		return 0;
+#else
+		struct rusage usage;
+
+		if (getrusage(RUSAGE_SELF, &usage) != 0)
+			return 0;
+#ifdef __APPLE__
+		return (long long)usage.ru_maxrss;
+#else
+		return (long long)usage.ru_maxrss * 1024;
+#endif
+#endif
+	}
+
+	/** The high-water mark and the live bytes of each phase, the tracked total and the peak RSS. */
+	string report() const
+	{
+		std::ostringstream table;
+		char line[128];
+
+		snprintf(line, sizeof(line), "%-16s %12s %12s\n", "memory", "peak MB", "live MB");
+		table << line;
+
+		for (int p = 0; p < (int)MemoryPhase::count; ++p)
+		{
+			snprintf(line, sizeof(line), "%-16s %12.1f %12.1f\n", name((MemoryPhase)p),
+				peak[p].load(std::memory_order_relaxed) / 1048576.0, live[p].load(std::memory_order_relaxed) / 1048576.0);
+			table << line;
+		}
+
+		snprintf(line, sizeof(line), "%-16s %12.1f %12.1f\n", "tracked total", getTotalPeak() / 1048576.0, getTotalLive() / 1048576.0);
+		table << line;
+		snprintf(line, sizeof(line), "%-16s %12.1f\n", "peak RSS", peakResidentBytes() / 1048576.0);
+		table << line;
+
+		return table.str();
+	}
+
+private:
+	static void raise(std::atomic<long long>& peak, long long value)
+	{
+		long long seen = peak.load(std::memory_order_relaxed);
+
+		while (value > seen && !peak.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {}
+	}
+
+	std::atomic<long long> live[(int)MemoryPhase::count] = {};
+	std::atomic<long long> peak[(int)MemoryPhase::count] = {};
+	std::atomic<long long> totalLive{ 0 };
+	std::atomic<long long> totalPeak{ 0 };
+};
+
+/** Charges bytes to a phase for its lifetime, for images that are not an {@link AlignedBuffer}. */
+class MemoryCharge {
+public:
+	MemoryCharge(MemoryPhase phase, long long bytes) : phase(phase), bytes(bytes) { MemoryLedger::global().allocate(phase, bytes); }
+
+	MemoryCharge(const MemoryCharge&) = delete;
+	MemoryCharge& operator=(const MemoryCharge&) = delete;
+
+	~MemoryCharge() { MemoryLedger::global().free(phase, bytes); }
+
+private:
+	MemoryPhase phase;
+	long long bytes;
+};
+
+/** Makes a phase current on the calling thread for its lifetime, the previous one is restored afterwards. */
+class MemoryScope {
+public:
+	explicit MemoryScope(MemoryPhase phase) : previous(MemoryLedger::current()) { MemoryLedger::current() = phase; }
+
+	MemoryScope(const MemoryScope&) = delete;
+	MemoryScope& operator=(const MemoryScope&) = delete;
+
+	~MemoryScope() { MemoryLedger::current() = previous; }
+
+private:
+	MemoryPhase previous;
+};
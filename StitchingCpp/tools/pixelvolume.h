@@ -0,0 +1,137 @@
+#pragma once
+
+#include "header.h"
+#include "alignedbuffer.h"
+#include <cstddef>
+#include <utility>
+
+/**
+ * A non-owning view of pixels with explicit strides (in elements) for x, y, channel,
+ * z and t. Views of a {@link PixelVolume} stay valid as long as the volume lives and
+ * is not moved from. Cropping or picking a plane only changes the origin and the
+ * extents, the pixels are never copied.
+ */
+template<class T>
+struct PixelView {
+	T* data = nullptr;
+	int width = 0, height = 0, channels = 1, depth = 1, frames = 1;
+	ptrdiff_t strideX = 1, strideY = 0, strideC = 0, strideZ = 0, strideT = 0;
+
+	T& at(int x, int y, int c = 0, int z = 0, int t = 0) const
+	{
+		return data[x * strideX + y * strideY + c * strideC + z * strideZ + t * strideT];
+	}
+
+	/** first pixel of a row, the row is contiguous if strideX == 1 */
+	T* row(int y, int c = 0, int z = 0, int t = 0) const { return &at(0, y, c, z, t); }
+
+	/** the part [x, x + w) x [y, y + h) x [z, z + d) of all channels and frames */
+	PixelView crop(int x, int y, int z, int w, int h, int d) const
+	{
+		PixelView view = *this;
+		view.data = &at(x, y, 0, z, 0);
+		view.width = w;
+		view.height = h;
+		view.depth = d;
+		return view;
+	}
+
+	/** one xy plane */
+	PixelView plane(int c, int z, int t) const
+	{
+		PixelView view = *this;
+		view.data = &at(0, 0, c, z, t);
+		view.channels = view.depth = view.frames = 1;
+		return view;
+	}
+
+	/** one channel of one frame, i.e. a 2d or 3d image */
+	PixelView volume(int c, int t) const
+	{
+		PixelView view = *this;
+		view.data = &at(0, 0, c, 0, t);
+		view.channels = view.frames = 1;
+		return view;
+	}
+
+	long long numPixels() const { return (long long)width * height * channels * depth * frames; }
+
+	operator PixelView<const T>() const
+	{
+		PixelView<const T> view;
+		view.data = data;
+		view.width = width; view.height = height; view.channels = channels; view.depth = depth; view.frames = frames;
+		view.strideX = strideX; view.strideY = strideY; view.strideC = strideC; view.strideZ = strideZ; view.strideT = strideT;
+		return view;
+	}
+};
+
+/**
+ * The pixels of a hyperstack without any of the GUI state of an ImagePlus, for the
+ * registration and fusion pipeline. The storage is 64-byte aligned and ordered
+ * XYCZT like ImageJ, rows can be padded so that every row starts aligned as well.
+ * A volume is move-only, everything else works on {@link PixelView}s.
+ */
+template<class T>
+class PixelVolume {
+public:
+	PixelVolume() {}
+
+	/**
+	 * @param alignRows - pad the rows so each one starts at a 64 byte boundary
+	 * @param scratch - take the storage from the scratch arena of the calling thread
+	 */
+	PixelVolume(int width, int height, int channels = 1, int depth = 1, int frames = 1, bool alignRows = false, bool scratch = false)
+	{
+		size_t perLine = AlignedBuffer<T>::alignment / sizeof(T);
+		ptrdiff_t rowLength = alignRows ? (ptrdiff_t)((width + perLine - 1) / perLine * perLine) : width;
+
+		pixels.width = width;
+		pixels.height = height;
+		pixels.channels = channels;
+		pixels.depth = depth;
+		pixels.frames = frames;
+		pixels.strideX = 1;
+		pixels.strideY = rowLength;
+		pixels.strideC = rowLength * height;
+		pixels.strideZ = pixels.strideC * channels;
+		pixels.strideT = pixels.strideZ * depth;
+
+		size_t size = (size_t)pixels.strideT * frames;
+		buffer = scratch ? AlignedBuffer<T>::scratch(size) : AlignedBuffer<T>(size);
+		pixels.data = buffer.data();
+	}
+
+	PixelVolume(const PixelVolume&) = delete;
+	PixelVolume& operator=(const PixelVolume&) = delete;
+
+	PixelVolume(PixelVolume&& other) : buffer(std::move(other.buffer)), pixels(other.pixels)
+	{
+		other.pixels = PixelView<T>();
+	}
+
+	PixelVolume& operator=(PixelVolume&& other)
+	{
+		buffer = std::move(other.buffer);
+		pixels = other.pixels;
+		other.pixels = PixelView<T>();
+		return *this;
+	}
+
+	int width() const { return pixels.width; }
+	int height() const { return pixels.height; }
+	int channels() const { return pixels.channels; }
+	int depth() const { return pixels.depth; }
+	int frames() const { return pixels.frames; }
+	bool empty() const { return pixels.data == nullptr; }
+
+	T& at(int x, int y, int c = 0, int z = 0, int t = 0) { return pixels.at(x, y, c, z, t); }
+	const T& at(int x, int y, int c = 0, int z = 0, int t = 0) const { return pixels.at(x, y, c, z, t); }
+
+	PixelView<T> view() { return pixels; }
+	PixelView<const T> view() const { return pixels; }
+
+private:
+	AlignedBuffer<T> buffer;
+	PixelView<T> pixels;
+};
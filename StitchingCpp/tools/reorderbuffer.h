@@ -0,0 +1,85 @@
+#pragma once
+
+#include "header.h"
+#include <mutex>
+#include <condition_variable>
+
+/**
+ * Hands items that are produced out of order (e.g. slices fused in parallel) to a
+ * single consumer in their original order 0, 1, ..., count-1.
+ *
+ * The buffer is bounded: a producer has to {@link #acquire(long long)} the index
+ * before it starts working on it, which blocks while the index is more than
+ * capacity items ahead of the consumer. This limits the number of items that are
+ * in flight or waiting, and with it the memory.
+ */
+template<class T>
+class ReorderBuffer {
+public:
+	ReorderBuffer(long long count, int capacity)
+		: count(count), capacity(std::max(1, capacity)) {}
+
+	/**
+	 * Blocks until item index may be produced.
+	 *
+	 * @return false if the buffer was aborted
+	 */
+	bool acquire(long long index)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		changed.wait(lock, [&] { return aborted || index < next + capacity; });
+		return !aborted;
+	}
+
+	/** Stores a produced item, never blocks. */
+	void put(long long index, T item)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			items.emplace(index, std::move(item));
+		}
+		changed.notify_all();
+	}
+
+	/**
+	 * Blocks until the next item in order is available.
+	 *
+	 * @return false if all items were taken or the buffer was aborted
+	 */
+	bool take(T& item)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		changed.wait(lock, [&] { return aborted || next == count || items.count(next) > 0; });
+
+		if (aborted || next == count)
+			return false;
+
+		auto it = items.find(next);
+		item = std::move(it->second);
+		items.erase(it);
+		++next;
+
+		lock.unlock();
+		changed.notify_all();
+		return true;
+	}
+
+	/** Wakes up producers and the consumer, all further calls fail. */
+	void abort()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			aborted = true;
+		}
+		changed.notify_all();
+	}
+
+private:
+	long long count;
+	int capacity;
+	long long next = 0;
+	bool aborted = false;
+	map<long long, T> items;
+	std::mutex mutex;
+	std::condition_variable changed;
+};
@@ -0,0 +1,200 @@
+#pragma once
+
+#include "header.h"
+#include <cstdlib>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+
+/**
+ * Allocates bytes aligned to 64 (a cache line, and enough for any SIMD load). The
+ * pointer malloc returned is stored just before the data.
+ */
+inline void* alignedAlloc(size_t bytes)
+{
+	const size_t alignment = 64;
+
+	if (bytes == 0)
+		return nullptr;
+
+	void* raw = std::malloc(bytes + alignment + sizeof(void*));
+
+	if (raw == nullptr)
+		throw std::bad_alloc();
+
+	uintptr_t aligned = ((uintptr_t)raw + sizeof(void*) + alignment - 1) & ~(uintptr_t)(alignment - 1);
+	((void**)aligned)[-1] = raw;
+
+	return (void*)aligned;
+}
+
+inline void alignedFree(void* data)
+{
+	if (data != nullptr)
+		std::free(((void**)data)[-1]);
+}
+
+/**
+ * Aligned blocks that are kept after use and handed out again, for the scratch
+ * buffers of the pairwise registration: the roi images, the FFTs and the phase
+ * correlation matrix of one pair have the same sizes as those of the next pair of
+ * the same grid, so after the first pair a thread hardly ever calls malloc again.
+ *
+ * Blocks are grouped into size classes (four per power of two, i.e. at most 25%
+ * waste), so rois that differ by a few pixels still share blocks. Each thread has
+ * its own arena (see {@link ScratchPool}), the mutex only guards against a block
+ * that is returned by another thread and is never contended otherwise.
+ */
+class ScratchArena {
+public:
+	ScratchArena() {}
+	ScratchArena(const ScratchArena&) = delete;
+	ScratchArena& operator=(const ScratchArena&) = delete;
+
+	~ScratchArena() { releaseAll(); }
+
+	/**
+	 * @param bytes - the requested size, set to the size of the block that is returned
+	 */
+	void* acquire(size_t& bytes)
+	{
+		bytes = sizeClass(bytes);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			vector<void*>& blocks = cached[bytes];
+
+			if (!blocks.empty())
+			{
+				void* block = blocks.back();
+				blocks.pop_back();
+				cachedBytes -= bytes;
+				++reused;
+				return block;
+			}
+
+			++allocated;
+		}
+
+		return alignedAlloc(bytes);
+	}
+
+	/** Gives a block of acquire(bytes) back, it is kept for the next acquire of that size. */
+	void release(void* block, size_t bytes)
+	{
+		if (block == nullptr)
+			return;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		cached[bytes].push_back(block);
+		cachedBytes += bytes;
+	}
+
+	/** Frees all cached blocks, blocks that are still in use are not affected. */
+	void releaseAll()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		for (auto& entry : cached)
+			for (void* block : entry.second)
+				alignedFree(block);
+
+		cached.clear();
+		cachedBytes = 0;
+	}
+
+	long long getCachedBytes() { std::lock_guard<std::mutex> lock(mutex); return cachedBytes; }
+	long long getNumAllocated() { std::lock_guard<std::mutex> lock(mutex); return allocated; }
+	long long getNumReused() { std::lock_guard<std::mutex> lock(mutex); return reused; }
+
+	/** 64 byte steps up to 4k, above that four classes per power of two */
+	static size_t sizeClass(size_t bytes)
+	{
+		if (bytes <= 4096)
+			return (bytes + 63) & ~(size_t)63;
+
+		size_t top = 1;
+		while ((top << 1) <= bytes)
+			top <<= 1;
+
+		size_t step = top / 4;
+		return (bytes + step - 1) / step * step;
+	}
+
+private:
+	std::mutex mutex;
+	std::map< size_t, vector<void*> > cached;
+	long long cachedBytes = 0;
+	long long allocated = 0;
+	long long reused = 0;
+};
+
+/**
+ * The arenas of all threads. A thread gets its arena on first use and keeps it for
+ * its lifetime; pool workers live as long as the process, so their arenas are reused
+ * across registrations. {@link #releaseAll()} frees the cached blocks of all arenas
+ * in one go once a registration is done.
+ */
+class ScratchPool {
+public:
+	static ScratchPool& global()
+	{
+		static ScratchPool pool;
+		return pool;
+	}
+
+	/** @return the arena of the calling thread */
+	ScratchArena& local()
+	{
+		static thread_local ScratchArena* arena = nullptr;
+
+		if (arena == nullptr)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			arenas.emplace_back(new ScratchArena());
+			arena = arenas.back().get();
+		}
+
+		return *arena;
+	}
+
+	void releaseAll()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		for (auto& arena : arenas)
+			arena->releaseAll();
+	}
+
+	long long getCachedBytes()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		long long bytes = 0;
+
+		for (auto& arena : arenas)
+			bytes += arena->getCachedBytes();
+
+		return bytes;
+	}
+
+	/** @return the fraction of acquires that were served from a cache */
+	double getReuseRatio()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		long long allocated = 0, reused = 0;
+
+		for (auto& arena : arenas)
+		{
+			allocated += arena->getNumAllocated();
+			reused += arena->getNumReused();
+		}
+
+		return allocated + reused == 0 ? 0 : (double)reused / (allocated + reused);
+	}
+
+private:
+	std::mutex mutex;
+	vector< std::unique_ptr<ScratchArena> > arenas;
+};
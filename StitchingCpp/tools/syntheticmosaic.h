@@ -0,0 +1,232 @@
+#pragma once
+
+#include "header.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <random>
+
+/** The layout and the pixels of a {@link SyntheticMosaic}. */
+struct SyntheticMosaicParameters {
+	int dimensionality = 2;
+	int tilesX = 4, tilesY = 3, tilesZ = 1;
+	/** tileDepth is ignored in 2d */
+	int tileWidth = 512, tileHeight = 512, tileDepth = 64;
+	/** the fraction of a tile that overlaps its neighbor in the nominal grid */
+	double overlap = 0.2;
+	/** the true position of a tile deviates from the nominal grid by up to this many pixels in each dimension */
+	double jitter = 4;
+	/** sigma of the gaussian noise of each tile, relative to the intensity range */
+	double noise = 0.02;
+	/** 8, 16 or 32 (float) */
+	int bitDepth = 16;
+	int channels = 1;
+	uint64_t seed = 1;
+};
+
+/**
+ * A deterministic mosaic for benchmarks: tiles cut from one textured world at known,
+ * subpixel positions near a regular grid. The same parameters give the same positions
+ * and pixels with any standard library, so timings and errors of different builds can
+ * be compared: the random numbers are converted from the raw output of std::mt19937_64,
+ * which the standard fixes, and not with the <random> distributions, which it leaves to
+ * the implementation. The noise uses std::log, std::sin and std::cos, a libm that rounds
+ * them differently can change a noisy pixel in the last bit.
+ *
+ * The texture is value noise with four octaves (periods of 64 down to 3.5 pixels), so
+ * every overlap has structure at all scales for the phase correlation. Each channel
+ * has its own texture. The noise of a tile is drawn from its own generator, the tiles
+ * can be rendered in any order and in parallel.
+ */
+class SyntheticMosaic {
+public:
+	explicit SyntheticMosaic(const SyntheticMosaicParameters& parameters) : parameters(parameters)
+	{
+		if (this->parameters.dimensionality == 2)
+		{
+			this->parameters.tilesZ = 1;
+			this->parameters.tileDepth = 1;
+		}
+
+		std::mt19937_64 random(parameters.seed);
+
+		for (int i = 0; i < numTiles(); ++i)
+		{
+			std::array<double, 3> position = nominalPosition(i);
+
+			for (int d = 0; d < this->parameters.dimensionality; ++d)
+				position[d] += (2 * uniform(random) - 1) * parameters.jitter;
+
+			positions.push_back(position);
+		}
+	}
+
+	const SyntheticMosaicParameters& getParameters() const { return parameters; }
+
+	int numTiles() const { return parameters.tilesX * parameters.tilesY * parameters.tilesZ; }
+
+	/** tiles are numbered row by row, x fastest */
+	std::array<int, 3> gridPosition(int tile) const
+	{
+		return {{ tile % parameters.tilesX, tile / parameters.tilesX % parameters.tilesY, tile / (parameters.tilesX * parameters.tilesY) }};
+	}
+
+	/** the position of a tile in the regular grid, the approximate layout that is given to the stitching */
+	std::array<double, 3> nominalPosition(int tile) const
+	{
+		std::array<int, 3> grid = gridPosition(tile);
+		int size[] = { parameters.tileWidth, parameters.tileHeight, parameters.tileDepth };
+		std::array<double, 3> position = {{ 0, 0, 0 }};
+
+		for (int d = 0; d < parameters.dimensionality; ++d)
+			position[d] = grid[d] * std::round(size[d] * (1 - parameters.overlap));
+
+		return position;
+	}
+
+	/** the ground truth */
+	const std::array<double, 3>& truePosition(int tile) const { return positions[tile]; }
+
+	/** the largest pixel value, 1 for 32 bit */
+	double maxValue() const { return parameters.bitDepth == 8 ? 255 : parameters.bitDepth == 16 ? 65535 : 1; }
+
+	/** the noiseless texture at world coordinates, in [0, 1] */
+	float texture(double x, double y, double z, int channel) const
+	{
+		static const double periods[] = { 64, 24, 9, 3.5 };
+		static const double amplitudes[] = { 0.45, 0.3, 0.17, 0.08 };
+		double value = 0;
+
+		for (int octave = 0; octave < 4; ++octave)
+			value += amplitudes[octave] * valueNoise(x / periods[octave], y / periods[octave],
+				parameters.dimensionality == 3 ? z / periods[octave] : 0, octave + 4 * channel);
+
+		return (float)value;
+	}
+
+	/**
+	 * The pixels of one channel of a tile, x fastest, then y, then z, with noise, scaled to
+	 * {@link #maxValue()} and rounded for 8 and 16 bit.
+	 */
+	vector<float> renderTile(int tile, int channel) const
+	{
+		int w = parameters.tileWidth, h = parameters.tileHeight, depth = parameters.tileDepth;
+		const std::array<double, 3>& position = positions[tile];
+		double scale = maxValue();
+		bool integer = parameters.bitDepth != 32;
+
+		std::mt19937_64 random(mix(parameters.seed ^ mix((uint64_t)tile * 0x9E3779B97F4A7C15ull + (uint64_t)channel + 1)));
+		double spare = 0;
+		bool hasSpare = false;
+
+		vector<float> pixels((size_t)w * h * depth);
+		size_t i = 0;
+
+		for (int z = 0; z < depth; ++z)
+			for (int y = 0; y < h; ++y)
+				for (int x = 0; x < w; ++x)
+				{
+					double value = texture(position[0] + x, position[1] + y, position[2] + z, channel);
+
+					if (parameters.noise > 0)
+						value += parameters.noise * gaussian(random, spare, hasSpare);
+
+					value = std::min(1.0, std::max(0.0, value)) * scale;
+					pixels[i++] = (float)(integer ? std::round(value) : value);
+				}
+
+		return pixels;
+	}
+
+	/**
+	 * Mean and largest distance of estimated tile positions from the truth, after moving
+	 * both so that the reference tile is at its true position.
+	 */
+	void positionError(const vector< std::array<double, 3> >& estimated, int reference, double& mean, double& max) const
+	{
+		mean = max = 0;
+
+		for (int i = 0; i < numTiles(); ++i)
+		{
+			double distance = 0;
+
+			for (int d = 0; d < parameters.dimensionality; ++d)
+			{
+				double e = (estimated[i][d] - estimated[reference][d]) - (positions[i][d] - positions[reference][d]);
+				distance += e * e;
+			}
+
+			distance = std::sqrt(distance);
+			mean += distance / numTiles();
+			max = std::max(max, distance);
+		}
+	}
+
+private:
+	static uint64_t mix(uint64_t x)
+	{
+		// splitmix64 finalizer
+		x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+		x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+		return x ^ (x >> 31);
+	}
+
+	/** uniform in [0, 1), the upper 53 bits of the generator */
+	static double uniform(std::mt19937_64& random)
+	{
+		return (random() >> 11) * (1.0 / 9007199254740992.0);
+	}
+
+	/** standard normal by the Box-Muller transform, which gives two values per pair of uniforms */
+	static double gaussian(std::mt19937_64& random, double& spare, bool& hasSpare)
+	{
+		if (hasSpare)
+		{
+			hasSpare = false;
+			return spare;
+		}
+
+		double r = std::sqrt(-2 * std::log(1 - uniform(random)));
+		double angle = 6.283185307179586 * uniform(random);
+
+		spare = r * std::sin(angle);
+		hasSpare = true;
+
+		return r * std::cos(angle);
+	}
+
+	double lattice(int64_t x, int64_t y, int64_t z, int octave) const
+	{
+		uint64_t h = mix(parameters.seed + 0x632BE59BD9B4E019ull * (uint64_t)octave);
+		h = mix(h ^ (uint64_t)x);
+		h = mix(h ^ (uint64_t)y);
+		h = mix(h ^ (uint64_t)z);
+		return (h >> 11) * (1.0 / 9007199254740992.0);
+	}
+
+	/** lattice values interpolated with a smoothstep, in [0, 1) */
+	double valueNoise(double x, double y, double z, int octave) const
+	{
+		double fx = std::floor(x), fy = std::floor(y), fz = std::floor(z);
+		int64_t ix = (int64_t)fx, iy = (int64_t)fy, iz = (int64_t)fz;
+		double tx = smooth(x - fx), ty = smooth(y - fy), tz = smooth(z - fz);
+		double value = 0;
+
+		for (int dz = 0; dz < (parameters.dimensionality == 3 ? 2 : 1); ++dz)
+		{
+			double wz = parameters.dimensionality == 3 ? (dz ? tz : 1 - tz) : 1;
+
+			for (int dy = 0; dy < 2; ++dy)
+				for (int dx = 0; dx < 2; ++dx)
+					value += wz * (dy ? ty : 1 - ty) * (dx ? tx : 1 - tx) * lattice(ix + dx, iy + dy, iz + dz, octave);
+		}
+
+		return value;
+	}
+
+	static double smooth(double t) { return t * t * (3 - 2 * t); }
+
+	SyntheticMosaicParameters parameters;
+	vector< std::array<double, 3> > positions;
+};
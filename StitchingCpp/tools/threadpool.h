@@ -0,0 +1,266 @@
+#pragma once
+
+#include "header.h"
+#include <functional>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+#include <algorithm>
+
+/**
+ * A persistent pool of worker threads shared by registration and fusion.
+ *
+ * The threads are created once per process, work is handed to them as tasks
+ * that belong to a {@link TaskGroup}. Waiting on a group from inside a worker
+ * executes the queued tasks of that group instead of blocking, so nested parallel
+ * loops cannot deadlock the pool. Only tasks of the waited group are run, so a
+ * waiting worker never starts unrelated work on top of its stack: the nesting depth
+ * is the nesting of the groups, not the length of the queue. Each group keeps its
+ * queued tasks in order, so finding one to help with takes constant time.
+ */
+class ThreadPool {
+public:
+	class TaskGroup;
+
+private:
+	struct Task {
+		std::function<void()> run;
+		TaskGroup* group;
+	};
+
+public:
+	/**
+	 * A set of tasks that can be waited for. The first exception thrown by one
+	 * of the tasks is rethrown by {@link #wait()}.
+	 */
+	class TaskGroup {
+	public:
+		TaskGroup() : pending(0) {}
+		TaskGroup(const TaskGroup&) = delete;
+		TaskGroup& operator=(const TaskGroup&) = delete;
+
+		~TaskGroup() { wait(false); }
+
+		/** Blocks until all tasks submitted to this group are done. */
+		void wait() { wait(true); }
+
+	private:
+		friend class ThreadPool;
+
+		void wait(bool rethrow)
+		{
+			ThreadPool* pool = ThreadPool::current();
+
+			// a worker waiting for a nested group helps with it instead of sleeping
+			while (pool != nullptr && pending.load() > 0)
+			{
+				if (!pool->runPendingTask(this))
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					done.wait_for(lock, std::chrono::microseconds(100), [this] { return pending.load() == 0; });
+				}
+			}
+
+			std::unique_lock<std::mutex> lock(mutex);
+			done.wait(lock, [this] { return pending.load() == 0; });
+
+			if (rethrow && error)
+			{
+				std::exception_ptr e = error;
+				error = nullptr;
+				std::rethrow_exception(e);
+			}
+		}
+
+		void finished(std::exception_ptr e)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (e && !error)
+				error = e;
+			// the waiter may rethrow and free the exception as soon as pending is 0
+			e = nullptr;
+			if (--pending == 0)
+				done.notify_all();
+		}
+
+		std::atomic<int> pending;
+		std::mutex mutex;
+		std::condition_variable done;
+		std::exception_ptr error;
+
+		// the tasks of this group still in the queue of the pool, oldest first, guarded by the pool's mutex
+		std::deque<std::list<Task>::iterator> queued;
+	};
+
+	/**
+	 * @param numThreads - number of workers, 0 means one per hardware thread
+	 */
+	explicit ThreadPool(int numThreads = 0)
+	{
+		if (numThreads <= 0)
+			numThreads = std::max(1, (int)std::thread::hardware_concurrency());
+
+		for (int i = 0; i < numThreads; ++i)
+			workers.emplace_back([this, i] { workerLoop(i); });
+	}
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		available.notify_all();
+
+		for (std::thread& t : workers)
+			t.join();
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	/** The process wide pool, created on first use. */
+	static ThreadPool& global()
+	{
+		static ThreadPool pool;
+		return pool;
+	}
+
+	int numThreads() const { return (int)workers.size(); }
+
+	/**
+	 * @return the index [0, numThreads) of the pool worker executing the calling code,
+	 * or -1 if called from a thread that does not belong to a pool. Tasks only ever run
+	 * on workers, so it can be used to address per-worker state.
+	 */
+	static int workerIndex() { return currentIndex(); }
+
+	/** Queue a task, it is accounted to the given group. */
+	void submit(TaskGroup& group, std::function<void()> task)
+	{
+		++group.pending;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			queue.push_back(Task{ std::move(task), &group });
+			group.queued.push_back(std::prev(queue.end()));
+		}
+		available.notify_one();
+	}
+
+	/**
+	 * Runs body(from, to) over [begin, end) in pieces of at most grain elements and
+	 * returns when all pieces are done. The number of queued tasks is bounded by a small
+	 * multiple of the pool size, the pieces are handed out dynamically.
+	 */
+	void parallelFor(long long begin, long long end, long long grain, const std::function<void(long long, long long)>& body)
+	{
+		if (end <= begin)
+			return;
+
+		grain = std::max(1LL, grain);
+		long long numPieces = (end - begin + grain - 1) / grain;
+
+		if (numPieces == 1)
+		{
+			body(begin, end);
+			return;
+		}
+
+		std::atomic<long long> next(0);
+		TaskGroup group;
+		long long numTasks = std::min(numPieces, (long long)numThreads() * 4);
+
+		for (long long i = 0; i < numTasks; ++i)
+			submit(group, [&]
+			{
+				for (long long piece = next++; piece < numPieces; piece = next++)
+				{
+					long long from = begin + piece * grain;
+					body(from, std::min(end, from + grain));
+				}
+			});
+
+		group.wait();
+	}
+
+private:
+	void workerLoop(int index)
+	{
+		current() = this;
+		currentIndex() = index;
+
+		for (;;)
+		{
+			Task task;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				available.wait(lock, [this] { return stopping || !queue.empty(); });
+
+				if (queue.empty())
+					return;
+
+				// the oldest task of the queue is also the oldest queued task of its group
+				task = std::move(queue.front());
+				task.group->queued.pop_front();
+				queue.pop_front();
+			}
+			execute(task);
+		}
+	}
+
+	/** Runs the oldest queued task of the group, @return false if none is queued */
+	bool runPendingTask(TaskGroup* group)
+	{
+		Task task;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			if (group->queued.empty())
+				return false;
+
+			auto it = group->queued.front();
+			group->queued.pop_front();
+			task = std::move(*it);
+			queue.erase(it);
+		}
+		execute(task);
+		return true;
+	}
+
+	static void execute(Task& task)
+	{
+		std::exception_ptr error;
+		try
+		{
+			task.run();
+		}
+		catch (...)
+		{
+			error = std::current_exception();
+		}
+		// the captures of the task may refer to the group's owner, which may return once it is finished
+		task.run = nullptr;
+		task.group->finished(std::move(error));
+	}
+
+	std::vector<std::thread> workers;
+	std::list<Task> queue;
+	std::mutex mutex;
+	std::condition_variable available;
+	bool stopping = false;
+
+	static ThreadPool*& current()
+	{
+		static thread_local ThreadPool* pool = nullptr;
+		return pool;
+	}
+
+	static int& currentIndex()
+	{
+		static thread_local int index = -1;
+		return index;
+	}
+};
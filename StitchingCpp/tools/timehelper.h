@@ -10,4 +10,9 @@ public:
 		auto now_ms = std::chrono::time_point_cast<std::chrono::milliseconds>(now);
 		return now_ms.time_since_epoch().count();
 	}
+
+	/** steady_clock, for measuring durations: it never jumps when the system time is adjusted */
+	static long long nanoseconds() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
 };
\ No newline at end of file
@@ -0,0 +1,213 @@
+#pragma once
+
+#include "header.h"
+#include "timehelper.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+
+/**
+ * Spans of the pipeline phases (open, roi extraction, FFT, fusion of a region, ...)
+ * with steady_clock nanosecond timestamps and the thread they ran on, exported as a
+ * Chrome trace (chrome://tracing, Perfetto) or summarized as a table.
+ *
+ * Recording is off by default and then costs one relaxed atomic load per span. When it
+ * is on, each thread appends to its own buffer, so spans from the pool workers do not
+ * contend. Span names and categories must be string literals, they are not copied.
+ */
+class Trace {
+public:
+	struct Event {
+		const char* name;
+		const char* category;
+		long long start;
+		long long duration;
+		int thread;
+	};
+
+	static Trace& global()
+	{
+		static Trace trace;
+		return trace;
+	}
+
+	void setEnabled(bool enabled)
+	{
+		if (enabled && origin == 0)
+			origin = TimeHelper::nanoseconds();
+
+		this->enabled.store(enabled, std::memory_order_relaxed);
+	}
+
+	bool isEnabled() const { return enabled.load(std::memory_order_relaxed); }
+
+	void record(const char* name, const char* category, long long start, long long end)
+	{
+		Buffer& buffer = local();
+		std::lock_guard<std::mutex> lock(buffer.mutex);
+		buffer.events.push_back(Event{ name, category, start - origin, end - start, buffer.thread });
+	}
+
+	/** All events recorded so far, sorted by start time. */
+	vector<Event> events()
+	{
+		vector<Event> all;
+		std::lock_guard<std::mutex> lock(mutex);
+
+		for (auto& buffer : buffers)
+		{
+			std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+			all.insert(all.end(), buffer->events.begin(), buffer->events.end());
+		}
+
+		std::sort(all.begin(), all.end(), [](const Event& a, const Event& b) { return a.start < b.start; });
+		return all;
+	}
+
+	void clear()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		for (auto& buffer : buffers)
+		{
+			std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+			buffer->events.clear();
+		}
+	}
+
+	/**
+	 * Writes the events as complete ("X") events of the Chrome trace event format, the
+	 * timestamps are microseconds since tracing was enabled.
+	 *
+	 * @return false if the file could not be written
+	 */
+	bool writeChromeTrace(const string& path)
+	{
+		FILE* file = fopen(path.c_str(), "w");
+
+		if (file == nullptr)
+		{
+			LOGERR("Cannot write trace '" << path << "'.");
+			return false;
+		}
+
+		fprintf(file, "{\"traceEvents\":[\n");
+		bool first = true;
+
+		for (const Event& e : events())
+		{
+			fprintf(file, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d}",
+				first ? "" : ",\n", e.name, e.category, e.start / 1000.0, e.duration / 1000.0, e.thread);
+			first = false;
+		}
+
+		fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+		return fclose(file) == 0;
+	}
+
+	/**
+	 * One line per span name: count, total, mean and max time, and the share of the wall
+	 * time from the first to the last event. Spans on several threads overlap, so the
+	 * shares of parallel phases can add up to more than 100%.
+	 */
+	string summary()
+	{
+		struct Row { const char* name; long long count = 0, total = 0, max = 0; };
+
+		vector<Event> all = events();
+		vector<Row> rows;
+		std::unordered_map<string, size_t> index;
+		long long begin = all.empty() ? 0 : all.front().start, end = begin;
+
+		for (const Event& e : all)
+		{
+			auto it = index.find(e.name);
+
+			if (it == index.end())
+			{
+				it = index.emplace(e.name, rows.size()).first;
+				rows.push_back(Row());
+				rows.back().name = e.name;
+			}
+
+			Row& row = rows[it->second];
+			++row.count;
+			row.total += e.duration;
+			row.max = std::max(row.max, e.duration);
+			end = std::max(end, e.start + e.duration);
+		}
+
+		std::sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) { return a.total > b.total; });
+
+		std::ostringstream table;
+		double wall = std::max(1LL, end - begin);
+		char line[256];
+
+		snprintf(line, sizeof(line), "%-24s %10s %12s %12s %12s %8s\n", "phase", "count", "total ms", "mean ms", "max ms", "% wall");
+		table << line;
+
+		for (const Row& row : rows)
+		{
+			snprintf(line, sizeof(line), "%-24s %10lld %12.3f %12.3f %12.3f %7.1f%%\n", row.name, row.count,
+				row.total / 1e6, row.total / 1e6 / row.count, row.max / 1e6, 100.0 * row.total / wall);
+			table << line;
+		}
+
+		snprintf(line, sizeof(line), "wall time %.3f ms\n", (end - begin) / 1e6);
+		table << line;
+
+		return table.str();
+	}
+
+private:
+	struct Buffer {
+		std::mutex mutex;
+		vector<Event> events;
+		int thread;
+	};
+
+	Buffer& local()
+	{
+		static thread_local Buffer* buffer = nullptr;
+
+		if (buffer == nullptr)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			buffers.emplace_back(new Buffer());
+			buffer = buffers.back().get();
+			buffer->thread = (int)buffers.size();
+		}
+
+		return *buffer;
+	}
+
+	std::atomic<bool> enabled{ false };
+	long long origin = 0;
+	std::mutex mutex;
+	vector< std::unique_ptr<Buffer> > buffers;
+};
+
+/** Records the time from its construction to its destruction as a span of the global {@link Trace}. */
+class TraceSpan {
+public:
+	explicit TraceSpan(const char* name, const char* category = "stitching")
+		: name(name), category(category), start(Trace::global().isEnabled() ? TimeHelper::nanoseconds() : -1) {}
+
+	TraceSpan(const TraceSpan&) = delete;
+	TraceSpan& operator=(const TraceSpan&) = delete;
+
+	~TraceSpan()
+	{
+		if (start >= 0)
+			Trace::global().record(name, category, start, TimeHelper::nanoseconds());
+	}
+
+private:
+	const char* name;
+	const char* category;
+	long long start;
+};